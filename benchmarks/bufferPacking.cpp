@@ -0,0 +1,73 @@
+#include <chrono>
+
+#include <TypedBuffer.hpp>
+
+/*
+	A job with several small input arrays: one allocation and copy per array against a BufferPack
+	with one allocation and one multi-region copy, including buffer creation.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("arrays", { "-a", "--arrays" }, true, "Input arrays per job (default: 5)");
+	parser.add("elements", { "-n", "--elements" }, true, "Elements per array (default: 4096)");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Jobs per variant (default: 200)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const int32_t arrayCount = parser.getValueAsInt("arrays", 5);
+	const uint32_t elementCount = parser.getValueAsInt("elements", 4096);
+	const int32_t iterations = parser.getValueAsInt("iterations", 200);
+
+	ComputeManager *manager = new ComputeManager();
+	std::vector<std::vector<uint32_t>> inputs(arrayCount, std::vector<uint32_t>(elementCount));
+	for (int32_t a = 0; a < arrayCount; a++) {
+		for (uint32_t i = 0; i < elementCount; i++) {
+			inputs[a][i] = a * elementCount + i;
+		}
+	}
+
+	// One staging and one device buffer per array
+	auto start = std::chrono::steady_clock::now();
+	for (int32_t j = 0; j < iterations; j++) {
+		std::vector<TypedBuffer<uint32_t>> hostBuffers(arrayCount), deviceBuffers(arrayCount);
+		for (int32_t a = 0; a < arrayCount; a++) {
+			hostBuffers[a].create(manager, CPU_BUFFER, elementCount);
+			deviceBuffers[a].create(manager, GPU_BUFFER, elementCount);
+			manager->blockMemoryCopy(&hostBuffers[a].block, inputs[a].data(), MEMORY_USER_TO_BLOCK);
+			manager->stageMemorycpy(&hostBuffers[a].block, &deviceBuffers[a].block);
+		}
+		for (int32_t a = 0; a < arrayCount; a++) {
+			manager->clean(&deviceBuffers[a].block);
+			manager->clean(&hostBuffers[a].block);
+		}
+	}
+	double separateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	// All arrays in one pack, the last iteration's copy is read back for checking
+	std::vector<std::vector<uint32_t>> outputs(arrayCount, std::vector<uint32_t>(elementCount));
+	bool correct = true;
+	start = std::chrono::steady_clock::now();
+	for (int32_t j = 0; j < iterations; j++) {
+		BufferPack pack(manager);
+		std::vector<TypedBuffer<uint32_t>> views(arrayCount);
+		for (int32_t a = 0; a < arrayCount; a++) {
+			pack.add(&views[a], elementCount, inputs[a].data(), outputs[a].data());
+		}
+		pack.create();
+		pack.upload();
+		if (j == iterations - 1) {
+			pack.download();
+			correct = outputs == inputs;
+		}
+	}
+	double packedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	printf("%d arrays x %u elements: separate %.3f ms/job, packed %.3f ms/job (%.2fx), %s\n", arrayCount, elementCount,
+		separateSeconds * 1e3, packedSeconds * 1e3, separateSeconds / packedSeconds, correct ? "ok" : "MISMATCH");
+
+	delete(manager);
+	return correct ? 0 : 1;
+}
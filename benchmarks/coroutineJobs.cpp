@@ -0,0 +1,80 @@
+#include <chrono>
+
+#include <GpuScheduler.hpp>
+
+#define BUFFER_ELEMENTS 32
+
+struct JobBuffers
+{
+	DeviceMemoryBlock hostMemory, deviceMemory;
+};
+
+// CPU pre-processing, upload, dispatch, readback and CPU post-processing, repeated jobCount times
+static GpuTask job(GpuScheduler* scheduler, ComputeKernel* kernel, JobBuffers* buffers, int32_t jobCount, std::atomic<uint64_t>* checksum) {
+	const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
+	std::vector<uint32_t> data(BUFFER_ELEMENTS);
+	std::vector<DeviceMemoryBlock*> bindings = { &buffers->deviceMemory };
+	for (int32_t j = 0; j < jobCount; j++) {
+		for (uint32_t i = 0; i < BUFFER_ELEMENTS; i++) {
+			data[i] = (i + j) % BUFFER_ELEMENTS;
+		}
+		co_await scheduler->upload(data.data(), bufferSize, &buffers->hostMemory, &buffers->deviceMemory);
+		co_await scheduler->dispatch(kernel, bindings, BUFFER_ELEMENTS);
+		co_await scheduler->readback(&buffers->deviceMemory, &buffers->hostMemory, data.data(), bufferSize);
+		uint64_t sum = 0;
+		for (uint32_t v : data) {
+			sum += v;
+		}
+		checksum->fetch_add(sum, std::memory_order_relaxed);
+	}
+}
+
+/*
+	Many concurrent upload -> compute -> readback jobs driven by coroutines on a few worker threads.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("tasks", { "-t", "--tasks" }, true, "Concurrent tasks (default: 1024)");
+	parser.add("jobs", { "-j", "--jobs" }, true, "Jobs per task (default: 16)");
+	parser.add("workers", { "-w", "--workers" }, true, "Worker threads (default: half the hardware threads)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const int32_t taskCount = parser.getValueAsInt("tasks", 1024);
+	const int32_t jobsPerTask = parser.getValueAsInt("jobs", 16);
+
+	const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
+	ComputeManager *manager = new ComputeManager();
+	ComputeKernel kernel;
+	manager->createKernel("headless.comp.spv", 1, &kernel);
+	GpuScheduler *scheduler = new GpuScheduler(manager, parser.getValueAsInt("workers", 0));
+
+	std::vector<JobBuffers> buffers(taskCount);
+	for (JobBuffers& jobBuffers : buffers) {
+		jobBuffers.hostMemory.size = bufferSize;
+		jobBuffers.deviceMemory.size = bufferSize;
+		manager->createBuffer(CPU_BUFFER, &jobBuffers.hostMemory);
+		manager->createBuffer(GPU_BUFFER, &jobBuffers.deviceMemory);
+	}
+
+	std::atomic<uint64_t> checksum{ 0 };
+	auto start = std::chrono::steady_clock::now();
+	for (JobBuffers& jobBuffers : buffers) {
+		scheduler->spawn(job(scheduler, &kernel, &jobBuffers, jobsPerTask, &checksum));
+	}
+	scheduler->waitIdle();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("tasks %d, jobs/s %.0f, checksum %llu\n", taskCount, taskCount * jobsPerTask / seconds, (unsigned long long)checksum.load());
+
+	delete(scheduler);
+	for (JobBuffers& jobBuffers : buffers) {
+		manager->clean(&jobBuffers.deviceMemory);
+		manager->clean(&jobBuffers.hostMemory);
+	}
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return 0;
+}
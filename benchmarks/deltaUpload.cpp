@@ -0,0 +1,85 @@
+#include <chrono>
+#include <random>
+
+#include <TrackedBuffer.hpp>
+
+/*
+	Iterative updates that touch a few pages of a large buffer: whole-buffer copies through
+	blockMemoryCopy / stageMemorycpy against a TrackedBuffer uploading only its dirty ranges.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("megabytes", { "-m", "--megabytes" }, true, "Buffer size in MiB (default: 256)");
+	parser.add("updates", { "-u", "--updates" }, true, "Random 64 byte writes per iteration (default: 256)");
+	parser.add("granularity", { "-g", "--granularity" }, true, "Dirty tracking granularity in bytes (default: 4096)");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Iterations per variant (default: 20)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const VkDeviceSize size = (VkDeviceSize)parser.getValueAsInt("megabytes", 256) << 20;
+	const int32_t updateCount = parser.getValueAsInt("updates", 256);
+	const int32_t iterations = parser.getValueAsInt("iterations", 20);
+	const VkDeviceSize updateSize = 64;
+
+	ComputeManager *manager = new ComputeManager();
+	std::vector<char> host(size);
+	std::mt19937_64 random(1);
+	std::uniform_int_distribution<VkDeviceSize> position(0, size / updateSize - 1);
+
+	// Whole buffer every iteration
+	DeviceMemoryBlock hostMemory, deviceMemory;
+	hostMemory.size = deviceMemory.size = size;
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &deviceMemory);
+	auto start = std::chrono::steady_clock::now();
+	for (int32_t j = 0; j < iterations; j++) {
+		for (int32_t u = 0; u < updateCount; u++) {
+			memset(host.data() + position(random) * updateSize, j, updateSize);
+		}
+		manager->blockMemoryCopy(&hostMemory, host.data(), MEMORY_USER_TO_BLOCK);
+		manager->stageMemorycpy(&hostMemory, &deviceMemory);
+	}
+	double fullSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+	manager->clean(&deviceMemory);
+	manager->clean(&hostMemory);
+
+	// Dirty ranges only, starting from the same contents
+	TrackedBuffer *tracked = new TrackedBuffer(manager, size, parser.getValueAsInt("granularity", 4096));
+	tracked->write(0, host.data(), size);
+	tracked->upload();
+	VkDeviceSize uploadedBytes = 0;
+	char* mapped = static_cast<char*>(tracked->data());
+	start = std::chrono::steady_clock::now();
+	for (int32_t j = 0; j < iterations; j++) {
+		for (int32_t u = 0; u < updateCount; u++) {
+			VkDeviceSize offset = position(random) * updateSize;
+			memset(host.data() + offset, j, updateSize);
+			memset(mapped + offset, j, updateSize);
+			tracked->markDirty(offset, updateSize);
+		}
+		VkDeviceSize uploaded;
+		tracked->upload(&uploaded);
+		uploadedBytes += uploaded;
+	}
+	double deltaSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	// Read back a few ranges and compare with the host copy
+	std::vector<char> check(updateSize * 16);
+	bool correct = true;
+	for (int32_t r = 0; r < 16; r++) {
+		VkDeviceSize offset = position(random) * updateSize;
+		tracked->read(offset, check.data(), check.size() <= size - offset ? check.size() : size - offset);
+		correct = correct && memcmp(check.data(), host.data() + offset, std::min<VkDeviceSize>(check.size(), size - offset)) == 0;
+	}
+
+	printf("%llu MiB, %d updates: full %.2f ms/iteration, delta %.3f ms/iteration (%.1fx), %.2f MiB uploaded per iteration, %s\n",
+		(unsigned long long)(size >> 20), updateCount, fullSeconds * 1e3, deltaSeconds * 1e3, fullSeconds / deltaSeconds,
+		uploadedBytes / (double)iterations / (1 << 20), correct ? "ok" : "MISMATCH");
+
+	delete(tracked);
+	delete(manager);
+	return correct ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <cstdio>
+
+#ifdef __linux__
+#include <FileStream.hpp>
+#else
+#include <ComputeManager.hpp>
+#endif
+
+/*
+	End to end file -> GPU -> file throughput of FileStream, with one slot (no overlap between the stages)
+	against several slots in flight. The input holds values 0..47, so the output is checked against fibonacci on the host.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("megabytes", { "-m", "--megabytes" }, true, "Size of the generated input in MiB (default: 1024)");
+	parser.add("chunk", { "-c", "--chunk" }, true, "Chunk size in MiB (default: 16)");
+	parser.add("slots", { "-s", "--slots" }, true, "Chunks in flight when pipelined (default: 3)");
+	parser.add("directory", { "-d", "--directory" }, true, "Directory for the input and output files (default: .)");
+	parser.add("buffered", { "--buffered" }, false, "Go through the page cache instead of O_DIRECT");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+#ifdef __linux__
+	const size_t size = (size_t)parser.getValueAsInt("megabytes", 1024) << 20;
+	const size_t chunkSize = (size_t)parser.getValueAsInt("chunk", 16) << 20;
+	const std::string directory = parser.getValueAsString("directory", ".");
+	const std::string inputPath = directory + "/vkhpc_stream_input.bin";
+	const std::string outputPath = directory + "/vkhpc_stream_output.bin";
+
+	std::vector<uint32_t> block(chunkSize / sizeof(uint32_t));
+	for (size_t i = 0; i < block.size(); i++) {
+		block[i] = i % 48;
+	}
+	FILE* file = fopen(inputPath.c_str(), "wb");
+	if (file == nullptr) {
+		std::cerr << "Could not create " << inputPath << "\n";
+		return 1;
+	}
+	for (size_t written = 0; written < size; written += chunkSize) {
+		fwrite(block.data(), 1, std::min(chunkSize, size - written), file);
+	}
+	fclose(file);
+
+	uint32_t expected[48];
+	expected[0] = 0;
+	expected[1] = 1;
+	for (int i = 2; i < 48; i++) {
+		expected[i] = expected[i - 1] + expected[i - 2];
+	}
+
+	uint32_t localSize = 256;
+	ComputeManager *manager = new ComputeManager();
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("stream.comp.spv", 1, &kernel, sizeof(uint32_t), &specializationInfo);
+
+	bool correct = true;
+	for (uint32_t slotCount : { 1u, (uint32_t)parser.getValueAsInt("slots", 3) }) {
+		FileStream *stream = new FileStream(manager, &kernel, chunkSize, slotCount, localSize);
+		stream->directIO = !parser.isSet("buffered");
+		StreamStats stats;
+		if (stream->run(inputPath, outputPath, &stats) != VK_SUCCESS) {
+			correct = false;
+			delete(stream);
+			break;
+		}
+		printf("%u slot(s): %.2f GB/s end to end, read %.2f s, gpu submit %.2f s, write %.2f s, wall %.2f s (O_DIRECT %d, io_uring %d)\n",
+			slotCount, stats.gigabytesPerSecond(), stats.readSeconds, stats.gpuSeconds, stats.writeSeconds, stats.seconds, stats.directIO, stats.ioUring);
+		delete(stream);
+
+		// Check the first chunk of the output
+		file = fopen(outputPath.c_str(), "rb");
+		size_t read = fread(block.data(), 1, std::min(chunkSize, size), file);
+		fclose(file);
+		for (size_t i = 0; i < read / sizeof(uint32_t); i++) {
+			correct = correct && block[i] == expected[i % 48];
+		}
+	}
+	printf("%s\n", correct ? "ok" : "MISMATCH");
+
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	remove(inputPath.c_str());
+	remove(outputPath.c_str());
+	return correct ? 0 : 1;
+#else
+	std::cerr << "File streaming is only available on Linux\n";
+	return 1;
+#endif
+}
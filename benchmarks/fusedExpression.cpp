@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cmath>
+
+#include <FusedExpression.hpp>
+
+/*
+	y = max(a * b + c, 0) * alpha as one generated kernel against one dispatch per operation
+	with intermediates in a device buffer, plus the cost of the first (compiling) and a cached evaluation.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-n", "--elements" }, true, "Elements per array (default: 16777216)");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Timed iterations per variant (default: 20)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 24);
+	const int32_t iterations = parser.getValueAsInt("iterations", 20);
+	const float alpha = 0.5f;
+
+	ComputeManager *manager = new ComputeManager();
+	DeviceMemoryBlock hostMemory, aMemory, bMemory, cMemory, tMemory, yMemory;
+	hostMemory.size = (VkDeviceSize)elementCount * sizeof(float);
+	aMemory.size = bMemory.size = cMemory.size = tMemory.size = yMemory.size = hostMemory.size;
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	for (DeviceMemoryBlock* block : { &aMemory, &bMemory, &cMemory, &tMemory, &yMemory }) {
+		manager->createBuffer(GPU_BUFFER, block);
+	}
+	std::vector<float> a(elementCount), b(elementCount), c(elementCount), y(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		a[i] = std::sin(i * 0.01f);
+		b[i] = std::cos(i * 0.01f);
+		c[i] = (i % 7) * 0.1f - 0.3f;
+	}
+	manager->blockMemoryCopy(&hostMemory, a.data(), MEMORY_USER_TO_BLOCK);
+	manager->stageMemorycpy(&hostMemory, &aMemory);
+	manager->blockMemoryCopy(&hostMemory, b.data(), MEMORY_USER_TO_BLOCK);
+	manager->stageMemorycpy(&hostMemory, &bMemory);
+	manager->blockMemoryCopy(&hostMemory, c.data(), MEMORY_USER_TO_BLOCK);
+	manager->stageMemorycpy(&hostMemory, &cMemory);
+
+	FusedKernels *kernels = new FusedKernels(manager);
+	fused::Buffer A(&aMemory), B(&bMemory), C(&cMemory), T(&tMemory);
+
+	auto start = std::chrono::steady_clock::now();
+	if (kernels->evaluate(&yMemory, elementCount, fused::max(A * B + C, 0.0f) * alpha) != VK_SUCCESS) {
+		std::cerr << "Could not build the fused kernel\n";
+		return 1;
+	}
+	double firstSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	kernels->evaluate(&yMemory, elementCount, fused::max(A * B + C, 0.0f) * alpha);
+	double cachedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Same expression, one kernel
+	KernelChain *fusedChain = new KernelChain(manager, 1, kernels->maxBindings);
+	kernels->enqueue(*fusedChain, &yMemory, elementCount, fused::max(A * B + C, 0.0f) * alpha);
+	start = std::chrono::steady_clock::now();
+	for (int32_t i = 0; i < iterations; i++) {
+		fusedChain->run();
+	}
+	double fusedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	// One dispatch per operation through an intermediate buffer
+	KernelChain *unfusedChain = new KernelChain(manager, 4, kernels->maxBindings);
+	kernels->enqueue(*unfusedChain, &tMemory, elementCount, A * B);
+	kernels->enqueue(*unfusedChain, &tMemory, elementCount, T + C);
+	kernels->enqueue(*unfusedChain, &tMemory, elementCount, fused::max(T, 0.0f));
+	kernels->enqueue(*unfusedChain, &yMemory, elementCount, T * alpha);
+	start = std::chrono::steady_clock::now();
+	for (int32_t i = 0; i < iterations; i++) {
+		unfusedChain->run();
+	}
+	double unfusedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	manager->stageMemorycpy(&yMemory, &hostMemory);
+	manager->blockMemoryCopy(&hostMemory, y.data(), MEMORY_BLOCK_TO_USER);
+	double maxError = 0.0;
+	for (uint32_t i = 0; i < elementCount; i++) {
+		maxError = std::max(maxError, (double)std::fabs(y[i] - std::max(a[i] * b[i] + c[i], 0.0f) * alpha));
+	}
+
+	printf("first evaluation %.2f ms, cached %.2f ms, %zu kernels cached\n", firstSeconds * 1e3, cachedSeconds * 1e3, kernels->cachedKernelCount());
+	printf("fused %.3f ms, unfused %.3f ms (%.2fx), max error %g\n", fusedSeconds * 1e3, unfusedSeconds * 1e3, unfusedSeconds / fusedSeconds, maxError);
+
+	delete(unfusedChain);
+	delete(fusedChain);
+	delete(kernels);
+	for (DeviceMemoryBlock* block : { &yMemory, &tMemory, &cMemory, &bMemory, &aMemory, &hostMemory }) {
+		manager->clean(block);
+	}
+	delete(manager);
+	return maxError < 1e-5 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <HeterogeneousScheduler.hpp>
+
+static uint32_t fibonacci(uint32_t n) {
+	if (n <= 1) {
+		return n;
+	}
+	uint32_t curr = 1;
+	uint32_t prev = 1;
+	for (uint32_t i = 2; i < n; ++i) {
+		uint32_t temp = curr;
+		curr += prev;
+		prev = temp;
+	}
+	return curr;
+}
+
+/*
+	The stream kernel (bounded fibonacci) on the GPU only, on the host thread pool only, and split adaptively
+	between both, with the split printed per run as it converges.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-n", "--elements" }, true, "Elements per job (default: 16777216)");
+	parser.add("runs", { "-r", "--runs" }, true, "Jobs per configuration (default: 10)");
+	parser.add("threads", { "-t", "--threads" }, true, "Host worker threads (default: hardware threads - 1)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 24);
+	const int32_t runs = parser.getValueAsInt("runs", 10);
+
+	uint32_t localSize = 256;
+	ComputeManager *manager = new ComputeManager();
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("stream.comp.spv", 1, &kernel, sizeof(uint32_t), &specializationInfo);
+	HeterogeneousKernel job = { &kernel, localSize, [](uint32_t* data, uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+			data[i] = fibonacci(std::min(data[i], 47u));
+		}
+	} };
+
+	DeviceMemoryBlock hostMemory, deviceMemory;
+	hostMemory.size = deviceMemory.size = (VkDeviceSize)elementCount * sizeof(uint32_t);
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &deviceMemory);
+	std::vector<uint32_t> input(elementCount), output(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		input[i] = i % 48;
+	}
+
+	HeterogeneousScheduler *scheduler = new HeterogeneousScheduler(manager, parser.getValueAsInt("threads", 0));
+	bool correct = true;
+	struct Configuration {
+		const char* name;
+		double gpuFraction;
+		bool adapt;
+	};
+	for (Configuration configuration : { Configuration{ "gpu", 1.0, false }, Configuration{ "cpu", 0.0, false }, Configuration{ "adaptive", 0.5, true } }) {
+		scheduler->gpuFraction = configuration.gpuFraction;
+		scheduler->adapt = configuration.adapt;
+		scheduler->gpuRate = scheduler->cpuRate = 0.0;
+		double totalSeconds = 0.0;
+		for (int32_t r = 0; r < runs; r++) {
+			manager->blockMemoryCopy(&hostMemory, input.data(), MEMORY_USER_TO_BLOCK);
+			double fraction = scheduler->gpuFraction;
+			auto start = std::chrono::steady_clock::now();
+			scheduler->run(job, &hostMemory, &deviceMemory, elementCount);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			totalSeconds += seconds;
+			if (configuration.adapt) {
+				printf("  run %d: gpu share %.3f, %.2f ms\n", r, fraction, seconds * 1e3);
+			}
+		}
+		manager->blockMemoryCopy(&hostMemory, output.data(), MEMORY_BLOCK_TO_USER);
+		for (uint32_t i = 0; i < elementCount; i++) {
+			correct = correct && output[i] == fibonacci(input[i]);
+		}
+		printf("%s (%u host threads): %.2f ms/job, %.2f Gelem/s\n", configuration.name, scheduler->threadCount(),
+			totalSeconds / runs * 1e3, (double)elementCount * runs / totalSeconds / 1e9);
+	}
+	printf("%s\n", correct ? "ok" : "MISMATCH");
+
+	delete(scheduler);
+	manager->clean(&deviceMemory);
+	manager->clean(&hostMemory);
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return correct ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <chrono>
+
+#include <ShaderLaunchers.hpp>
+
+/*
+	Filter-then-process with a data-dependent work size.
+	Compares a single submission chained through vkCmdDispatchIndirect
+	against reading the filter count back to the host before dispatching the second kernel.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-n", "--elements" }, true, "Number of input elements (default: 1048576)");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Timed iterations per variant (default: 100)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 20);
+	const int32_t iterations = parser.getValueAsInt("iterations", 100);
+	const uint32_t localSize = 64;
+	shaders::filter::PushConstants filterPushConstants = { elementCount, 16 };
+	// groupCountX, groupCountY, groupCountZ, count
+	const uint32_t resetArguments[4] = { 0, 1, 1, 0 };
+
+	std::vector<uint32_t> input(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		input[i] = i % 32;
+	}
+
+	ComputeManager *manager = new ComputeManager();
+	DeviceMemoryBlock hostMemory, inputMemory, compactedMemory, argumentMemory, argumentHostMemory;
+	hostMemory.size = elementCount * sizeof(uint32_t);
+	inputMemory.size = hostMemory.size;
+	compactedMemory.size = hostMemory.size;
+	argumentMemory.size = sizeof(resetArguments);
+	argumentHostMemory.size = sizeof(resetArguments);
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &inputMemory);
+	manager->createBuffer(GPU_BUFFER, &compactedMemory);
+	manager->createBuffer(INDIRECT_BUFFER, &argumentMemory);
+	manager->createBuffer(CPU_BUFFER, &argumentHostMemory);
+	manager->blockMemoryCopy(&hostMemory, input.data(), MEMORY_USER_TO_BLOCK);
+	manager->stageMemorycpy(&hostMemory, &inputMemory);
+
+	shaders::filter::Specialization filterSpecialization;
+	filterSpecialization.nextLocalSize = localSize;
+	ComputeKernel filterKernel, processKernel;
+	shaders::filter::createKernel(manager, &filterKernel, filterSpecialization);
+	shaders::process::createKernel(manager, &processKernel);
+	const shaders::filter::Bindings filterBindings = { &inputMemory, &compactedMemory, &argumentMemory };
+	const shaders::process::Bindings processBindings = { &compactedMemory, &argumentMemory };
+	const uint32_t filterGroups = (elementCount + localSize - 1) / localSize;
+
+	// GPU-driven: filter writes the group count, process consumes it in the same submission
+	KernelChain *chain = new KernelChain(manager);
+	chain->update(&argumentMemory, 0, resetArguments, sizeof(resetArguments));
+	shaders::filter::dispatch(*chain, &filterKernel, filterBindings, filterPushConstants, filterGroups);
+	shaders::process::dispatchIndirect(*chain, &processKernel, processBindings, &argumentMemory);
+	auto start = std::chrono::steady_clock::now();
+	for (int32_t i = 0; i < iterations; i++) {
+		chain->run();
+	}
+	double indirectSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Host round-trip: run the filter, read the count back, then dispatch process with host-side group counts
+	KernelChain *filterOnly = new KernelChain(manager);
+	KernelChain *processOnly = new KernelChain(manager);
+	filterOnly->update(&argumentMemory, 0, resetArguments, sizeof(resetArguments));
+	shaders::filter::dispatch(*filterOnly, &filterKernel, filterBindings, filterPushConstants, filterGroups);
+	uint32_t arguments[4] = {};
+	start = std::chrono::steady_clock::now();
+	for (int32_t i = 0; i < iterations; i++) {
+		filterOnly->run();
+		manager->stageMemorycpy(&argumentMemory, &argumentHostMemory);
+		manager->blockMemoryCopy(&argumentHostMemory, arguments, MEMORY_BLOCK_TO_USER);
+		processOnly->reset();
+		shaders::process::dispatch(*processOnly, &processKernel, processBindings, (arguments[3] + localSize - 1) / localSize);
+		processOnly->run();
+	}
+	double roundTripSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	manager->stageMemorycpy(&argumentMemory, &argumentHostMemory);
+	manager->blockMemoryCopy(&argumentHostMemory, arguments, MEMORY_BLOCK_TO_USER);
+	printf("Selected %u of %u elements, indirect group count %u\n", arguments[3], elementCount, arguments[0]);
+	printf("indirect chain: \t%.3f ms/iteration\n", indirectSeconds * 1000.0 / iterations);
+	printf("host round-trip: \t%.3f ms/iteration\n", roundTripSeconds * 1000.0 / iterations);
+
+	delete(processOnly);
+	delete(filterOnly);
+	delete(chain);
+	manager->destroyKernel(&processKernel);
+	manager->destroyKernel(&filterKernel);
+	manager->clean(&argumentHostMemory);
+	manager->clean(&argumentMemory);
+	manager->clean(&compactedMemory);
+	manager->clean(&inputMemory);
+	manager->clean(&hostMemory);
+	delete(manager);
+	return 0;
+}
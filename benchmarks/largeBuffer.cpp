@@ -0,0 +1,93 @@
+#include <chrono>
+
+#include <KernelChain.hpp>
+#include <SegmentedBuffer.hpp>
+
+struct SegmentedParameters {
+	uint32_t count;
+	uint32_t segmentShift;
+	float a;
+};
+
+/*
+	Reversed axpy (y[i] = a * x[n - 1 - i] + y[i]) over arrays that are bound as segments, so every thread reads from the
+	mirrored segment. --segment forces small segments to exercise the splitting on devices with a large maxStorageBufferRange.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-e", "--elements" }, true, "Floats per array (default: 268435456)");
+	parser.add("segment", { "-s", "--segment" }, true, "Largest segment in MiB, 0 for the device limit (default: 0)");
+	parser.add("runs", { "-r", "--runs" }, true, "Kernel runs (default: 5)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 28);
+	const VkDeviceSize maxSegmentBytes = (VkDeviceSize)parser.getValueAsInt("segment", 0) << 20;
+	const int32_t runs = parser.getValueAsInt("runs", 5);
+	const float a = 2.0f;
+
+	uint32_t localSize = 256;
+	ComputeManager *manager = new ComputeManager();
+	manager->profile.print();
+	if (!manager->profile.storageBufferArrays) {
+		std::cerr << "Device does not support runtime sized storage buffer arrays\n";
+		delete(manager);
+		return 1;
+	}
+
+	SegmentedBuffer *x = new SegmentedBuffer(manager, GPU_BUFFER, elementCount, sizeof(float), maxSegmentBytes);
+	SegmentedBuffer *y = new SegmentedBuffer(manager, GPU_BUFFER, elementCount, sizeof(float), maxSegmentBytes);
+	printf("%u floats per array in %u segment(s) of %llu elements\n", elementCount, x->segmentCount(), (unsigned long long)x->segmentElements());
+	if (x->segmentCount() + y->segmentCount() > manager->profile.maxPerStageDescriptorStorageBuffers) {
+		std::cerr << "Too many segments for maxPerStageDescriptorStorageBuffers, pass a larger --segment\n";
+		delete(y);
+		delete(x);
+		delete(manager);
+		return 1;
+	}
+
+	std::vector<float> values(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		values[i] = (float)(i % 1000);
+	}
+	x->upload(values.data());
+	std::fill(values.begin(), values.end(), 1.0f);
+	y->upload(values.data());
+
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("segmented.comp.spv", { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, &kernel, sizeof(SegmentedParameters), &specializationInfo,
+		0, 0, { x->segmentCount(), y->segmentCount() });
+
+	SegmentedParameters parameters = { elementCount, x->segmentShift, a };
+	uint32_t groupCount = std::min<uint32_t>((elementCount + localSize - 1) / localSize, 65535);
+	KernelChain *chain = new KernelChain(manager, 1, x->segmentCount() + y->segmentCount());
+	chain->dispatch(&kernel, { x->block(), y->block() }, groupCount, 1, 1, &parameters);
+	double seconds = 0.0;
+	for (int32_t r = 0; r < runs; r++) {
+		auto start = std::chrono::steady_clock::now();
+		chain->run();
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	delete(chain);
+
+	y->download(values.data());
+	bool correct = true;
+	for (uint32_t i = 0; i < elementCount && correct; i++) {
+		correct = values[i] == 1.0f + runs * a * (float)((elementCount - 1 - i) % 1000);
+	}
+	// Reads x and y, writes y
+	double bytes = 3.0 * elementCount * sizeof(float) * runs;
+	printf("%.2f ms per run, %.2f GB/s\n", seconds / runs * 1e3, bytes / seconds / 1e9);
+	printf("%s\n", correct ? "ok" : "MISMATCH");
+
+	manager->destroyKernel(&kernel);
+	delete(y);
+	delete(x);
+	delete(manager);
+	return correct ? 0 : 1;
+}
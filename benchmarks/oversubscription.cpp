@@ -0,0 +1,76 @@
+#include <chrono>
+
+#include <ConcurrentComputeManager.hpp>
+#include <ResidencyManager.hpp>
+
+/*
+	Throughput of jobs over a working set larger than the device heap limit.
+	Buffers are touched round robin, so every job past the limit pays for an eviction and a restore.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("limit", { "-l", "--limit" }, true, "Device heap limit in MiB (default: 256)");
+	parser.add("buffers", { "-b", "--buffers" }, true, "Number of buffers (default: 16)");
+	parser.add("size", { "-s", "--size" }, true, "Buffer size in MiB (default: 32)");
+	parser.add("jobs", { "-j", "--jobs" }, true, "Jobs (default: 256)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const VkDeviceSize limit = (VkDeviceSize)parser.getValueAsInt("limit", 256) << 20;
+	const int32_t bufferCount = parser.getValueAsInt("buffers", 16);
+	const VkDeviceSize bufferSize = (VkDeviceSize)parser.getValueAsInt("size", 32) << 20;
+	const int32_t jobCount = parser.getValueAsInt("jobs", 256);
+
+	ComputeManager *manager = new ComputeManager();
+	ConcurrentComputeManager *frontend = new ConcurrentComputeManager(manager);
+	ResidencyManager *residency = new ResidencyManager(manager);
+	for (VkDeviceSize& heapLimit : residency->heapLimits) {
+		heapLimit = limit;
+	}
+
+	uint32_t elementCount = static_cast<uint32_t>(bufferSize / sizeof(uint32_t));
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &elementCount);
+	ComputeKernel kernel;
+	manager->createKernel("headless.comp.spv", 1, &kernel, 0, &specializationInfo);
+
+	DeviceMemoryBlock hostMemory;
+	hostMemory.size = bufferSize;
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	// Spills happen while the buffers are created, the counters cover creation and the jobs
+	MetricSnapshot before = Metrics::instance().snapshot();
+	std::vector<ResidentBuffer*> buffers(bufferCount);
+	for (ResidentBuffer*& buffer : buffers) {
+		VK_CHECK_RESULT(residency->create(bufferSize, &buffer));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int32_t j = 0; j < jobCount; j++) {
+		ResidentBuffer* buffer = buffers[j % bufferCount];
+		DeviceMemoryBlock* deviceMemory = residency->acquire(buffer);
+		// Only the first elements are worth computing, the point is the traffic
+		frontend->runJob(&kernel, &hostMemory, deviceMemory, sizeof(uint32_t) * 32, 32);
+		residency->release(buffer);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	MetricSnapshot after = Metrics::instance().snapshot();
+
+	printf("working set %.0f MiB, limit %.0f MiB\n", (double)(bufferCount * bufferSize) / (1 << 20), (double)limit / (1 << 20));
+	printf("jobs/s %.1f, evictions %llu, restores %llu, host spills %llu\n", jobCount / seconds,
+		(unsigned long long)(after.counters[METRIC_EVICTIONS] - before.counters[METRIC_EVICTIONS]),
+		(unsigned long long)(after.counters[METRIC_RESTORES] - before.counters[METRIC_RESTORES]),
+		(unsigned long long)(after.counters[METRIC_HOST_SPILLS] - before.counters[METRIC_HOST_SPILLS]));
+
+	for (ResidentBuffer* buffer : buffers) {
+		residency->destroy(buffer);
+	}
+	delete(residency);
+	delete(frontend);
+	manager->clean(&hostMemory);
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+
+#include <PersistentKernel.hpp>
+
+#define BUFFER_ELEMENTS 32
+
+static double percentile(std::vector<double> samples, double fraction) {
+	std::sort(samples.begin(), samples.end());
+	size_t index = std::min(samples.size() - 1, (size_t)(fraction * samples.size()));
+	return samples[index];
+}
+
+/*
+	Per-job latency of small jobs: regular submit path (upload, dispatch, readback) against the persistent kernel queue.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("jobs", { "-j", "--jobs" }, true, "Jobs per mode (default: 10000)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const int32_t jobCount = parser.getValueAsInt("jobs", 10000);
+
+	std::vector<uint32_t> input(BUFFER_ELEMENTS);
+	std::vector<uint32_t> output(BUFFER_ELEMENTS);
+	uint32_t n = 0;
+	std::generate(input.begin(), input.end(), [&n] { return n++; });
+	const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
+	ComputeManager *manager = new ComputeManager();
+
+	// Regular submit path
+	DeviceMemoryBlock hostMemory, deviceMemory;
+	hostMemory.size = bufferSize;
+	deviceMemory.size = bufferSize;
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &deviceMemory);
+	manager->preparePipeline(&deviceMemory);
+	std::vector<double> submitLatency;
+	for (int32_t i = 0; i < jobCount; i++) {
+		auto start = std::chrono::steady_clock::now();
+		manager->blockMemoryCopy(&hostMemory, input.data(), MEMORY_USER_TO_BLOCK);
+		manager->stageMemorycpy(&hostMemory, &deviceMemory);
+		manager->compute(&hostMemory, &deviceMemory);
+		manager->stageMemorycpy(&deviceMemory, &hostMemory);
+		manager->blockMemoryCopy(&hostMemory, output.data(), MEMORY_BLOCK_TO_USER);
+		submitLatency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	// Persistent kernel path
+	PersistentKernelQueue *queue = new PersistentKernelQueue(manager, 256, BUFFER_ELEMENTS);
+	std::vector<double> persistentLatency;
+	int32_t timeouts = 0;
+	for (int32_t i = 0; i < jobCount; i++) {
+		auto start = std::chrono::steady_clock::now();
+		memcpy(queue->values(), input.data(), bufferSize);
+		uint32_t ticket;
+		VkResult result = queue->submit(0, BUFFER_ELEMENTS, &ticket, 1000000000ull);
+		if (result == VK_SUCCESS) {
+			result = queue->wait(ticket, 1000000000ull);
+		}
+		if (result == VK_TIMEOUT) {
+			timeouts++;
+			continue;
+		}
+		VK_CHECK_RESULT(result);
+		memcpy(output.data(), queue->values(), bufferSize);
+		persistentLatency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+	uint32_t launches = queue->launches();
+	VK_CHECK_RESULT(queue->stop(5000000000ull));
+	delete(queue);
+
+	printf("mode \t\tp50 (us) \tp99 (us)\n");
+	printf("submit \t\t%.1f \t\t%.1f\n", percentile(submitLatency, 0.50), percentile(submitLatency, 0.99));
+	if (!persistentLatency.empty()) {
+		printf("persistent \t%.1f \t\t%.1f\n", percentile(persistentLatency, 0.50), percentile(persistentLatency, 0.99));
+	}
+	printf("persistent kernel launches: %u, timeouts: %d\n", launches, timeouts);
+
+	manager->clean(&deviceMemory);
+	manager->clean(&hostMemory);
+	delete(manager);
+	return 0;
+}
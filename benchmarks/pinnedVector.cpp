@@ -0,0 +1,70 @@
+#include <chrono>
+
+#include <PinnedVector.hpp>
+
+/*
+	Upload and readback of a host array: std::vector with a blockMemoryCopy into and out of a staging buffer
+	against a PinnedVector that the GPU copies from and into directly.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("megabytes", { "-m", "--megabytes" }, true, "Array size in MiB (default: 256)");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Round trips per variant (default: 20)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const size_t elementCount = ((size_t)parser.getValueAsInt("megabytes", 256) << 20) / sizeof(uint32_t);
+	const int32_t iterations = parser.getValueAsInt("iterations", 20);
+	const VkDeviceSize bufferSize = elementCount * sizeof(uint32_t);
+
+	ComputeManager *manager = new ComputeManager();
+	DeviceMemoryBlock deviceMemory;
+	deviceMemory.size = bufferSize;
+	manager->createBuffer(GPU_BUFFER, &deviceMemory);
+	bool correct = true;
+
+	// Plain vectors copied through a staging buffer
+	std::vector<uint32_t> input(elementCount), output(elementCount);
+	for (size_t i = 0; i < elementCount; i++) {
+		input[i] = static_cast<uint32_t>(i);
+	}
+	DeviceMemoryBlock hostMemory;
+	hostMemory.size = bufferSize;
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	auto start = std::chrono::steady_clock::now();
+	for (int32_t j = 0; j < iterations; j++) {
+		manager->blockMemoryCopy(&hostMemory, input.data(), MEMORY_USER_TO_BLOCK);
+		manager->stageMemorycpy(&hostMemory, &deviceMemory);
+		manager->stageMemorycpy(&deviceMemory, &hostMemory);
+		manager->blockMemoryCopy(&hostMemory, output.data(), MEMORY_BLOCK_TO_USER);
+	}
+	double stagedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+	correct = correct && output == input;
+	manager->clean(&hostMemory);
+
+	// Pinned vectors copied directly
+	{
+		PinnedVector<uint32_t> pinnedInput(input.begin(), input.end(), PinnedAllocator<uint32_t>(manager));
+		PinnedVector<uint32_t> pinnedOutput(elementCount, PinnedAllocator<uint32_t>(manager));
+		DeviceMemoryBlock inputBlock = pinnedBlock(pinnedInput);
+		DeviceMemoryBlock outputBlock = pinnedBlock(pinnedOutput);
+		start = std::chrono::steady_clock::now();
+		for (int32_t j = 0; j < iterations; j++) {
+			manager->stageMemorycpy(&inputBlock, &deviceMemory);
+			manager->stageMemorycpy(&deviceMemory, &outputBlock);
+		}
+		double pinnedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+		correct = correct && std::equal(pinnedOutput.begin(), pinnedOutput.end(), input.begin());
+
+		printf("%.0f MiB round trip: std::vector + staging %.2f ms (%.2f GB/s), PinnedVector %.2f ms (%.2f GB/s), %.2fx, %s\n",
+			bufferSize / 1048576.0, stagedSeconds * 1e3, 2 * bufferSize / stagedSeconds / 1e9,
+			pinnedSeconds * 1e3, 2 * bufferSize / pinnedSeconds / 1e9, stagedSeconds / pinnedSeconds, correct ? "ok" : "MISMATCH");
+	}
+
+	manager->clean(&deviceMemory);
+	delete(manager);
+	return correct ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cmath>
+
+#include <Precision.hpp>
+
+struct SaxpyPushConstants
+{
+	uint32_t elementCount;
+	float alpha;
+	float xScale;
+	float yScale;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+	saxpy on fp32, fp16, bf16 and int8 storage: host conversion speed (SIMD against scalar), effective
+	device bandwidth of the kernel and the error against the fp32 result.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-e", "--elements" }, true, "Elements per vector (default: 16777216)");
+	parser.add("repetitions", { "-r", "--repetitions" }, true, "saxpy dispatches per measurement (default: 32)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 24);
+	const uint32_t repetitions = parser.getValueAsInt("repetitions", 32);
+
+	ComputeManager *manager = new ComputeManager();
+	manager->profile.print();
+
+	std::vector<float> x(elementCount), y(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		x[i] = std::sin(i * 0.001f);
+		y[i] = std::cos(i * 0.001f);
+	}
+	// Both inputs lie in [-1, 1], alpha * x + y stays within [-2, 2] for one dispatch
+	const float alpha = 1.0f;
+	const float int8Scale = 2.0f / 127.0f;
+	std::vector<float> reference(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		reference[i] = alpha * x[i] + y[i];
+	}
+
+	std::vector<uint8_t> packed(elementCount * sizeof(float));
+	std::vector<float> result(elementCount);
+	double float32ElementRate = 0.0;
+	for (ElementType type : { ELEMENT_FLOAT32, ELEMENT_FLOAT16, ELEMENT_BFLOAT16, ELEMENT_INT8 }) {
+		KernelVariant variant = saxpyVariant(type);
+		if (!variant.legal(manager->profile)) {
+			printf("%s: not supported on this device\n", elementTypeName(type));
+			continue;
+		}
+		float scale = type == ELEMENT_INT8 ? int8Scale : 1.0f;
+
+		// Host conversion only
+		auto start = std::chrono::steady_clock::now();
+		packElements(x.data(), packed.data(), elementCount, type, scale, false);
+		double scalarSeconds = secondsSince(start);
+		start = std::chrono::steady_clock::now();
+		packElements(x.data(), packed.data(), elementCount, type, scale, true);
+		double simdSeconds = secondsSince(start);
+
+		ComputeKernel kernel;
+		VK_CHECK_RESULT(variant.create(manager, 2, sizeof(SaxpyPushConstants), &kernel));
+		{
+			PrecisionBuffer xBuffer(manager, type, elementCount, scale);
+			PrecisionBuffer yBuffer(manager, type, elementCount, scale);
+			xBuffer.upload(x.data());
+			SaxpyPushConstants pushConstants = { elementCount, alpha, scale, scale };
+			std::vector<DeviceMemoryBlock*> bindings = { &xBuffer.deviceMemory, &yBuffer.deviceMemory };
+			uint32_t groupCount = (elementCount + variant.localSizeX - 1) / variant.localSizeX;
+
+			// One dispatch checks the result, the chain measures bandwidth
+			yBuffer.upload(y.data());
+			{
+				KernelChain chain(manager, 1, 2);
+				chain.dispatch(&kernel, bindings, groupCount, 1, 1, &pushConstants);
+				chain.run();
+			}
+			yBuffer.download(result.data());
+			double maxError = 0.0;
+			for (uint32_t i = 0; i < elementCount; i++) {
+				maxError = std::max(maxError, (double)std::fabs(result[i] - reference[i]));
+			}
+
+			KernelChain chain(manager, repetitions, 2);
+			for (uint32_t i = 0; i < repetitions; i++) {
+				chain.dispatch(&kernel, bindings, groupCount, 1, 1, &pushConstants);
+			}
+			chain.run();
+			start = std::chrono::steady_clock::now();
+			chain.run();
+			double kernelSeconds = secondsSince(start);
+
+			// saxpy reads x and y and writes y
+			double bytes = 3.0 * elementCount * elementSize(type) * repetitions;
+			double bandwidth = bytes / kernelSeconds / 1e9;
+			double elementRate = (double)elementCount * repetitions / kernelSeconds / 1e9;
+			if (type == ELEMENT_FLOAT32) {
+				float32ElementRate = elementRate;
+			}
+			printf("%s: pack scalar %.2f GB/s, simd %.2f GB/s | saxpy %.2f GB/s, %.2f Gelem/s (%.2fx fp32) | max error %g\n",
+				elementTypeName(type),
+				elementCount * sizeof(float) / scalarSeconds / 1e9, elementCount * sizeof(float) / simdSeconds / 1e9,
+				bandwidth, elementRate, float32ElementRate > 0.0 ? elementRate / float32ElementRate : 0.0, maxError);
+		}
+		manager->destroyKernel(&kernel);
+	}
+
+	delete(manager);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include <chrono>
+
+#include <KernelChain.hpp>
+#include <ResultArena.hpp>
+
+/*
+	A Jacobi solver that checks its residual after every sweep. The residual comes back either through a device
+	buffer, a copy submission and a mapped staging buffer, or straight from a ResultArena slot the sweep writes into.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-n", "--elements" }, true, "Grid points (default: 4096)");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Maximum sweeps (default: 2000)");
+	parser.add("tolerance", { "-t", "--tolerance" }, true, "Stop once the largest change is below 1/tolerance (default: 1000000)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	uint32_t elementCount = parser.getValueAsInt("elements", 4096);
+	const int32_t maxIterations = parser.getValueAsInt("iterations", 2000);
+	const float tolerance = 1.0f / parser.getValueAsInt("tolerance", 1000000);
+
+	uint32_t localSize = 256;
+	ComputeManager *manager = new ComputeManager();
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("jacobi.comp.spv", 3, &kernel, sizeof(uint32_t), &specializationInfo);
+	const uint32_t groupCount = (elementCount + localSize - 1) / localSize;
+
+	// Boundary values 1 and 0, interior starts at 0
+	std::vector<float> initial(elementCount, 0.0f);
+	initial[0] = 1.0f;
+	DeviceMemoryBlock hostMemory, grid[2], residualMemory, residualHostMemory;
+	hostMemory.size = grid[0].size = grid[1].size = (VkDeviceSize)elementCount * sizeof(float);
+	residualMemory.size = residualHostMemory.size = sizeof(uint32_t);
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &grid[0]);
+	manager->createBuffer(GPU_BUFFER, &grid[1]);
+	manager->createBuffer(GPU_BUFFER, &residualMemory);
+	manager->createBuffer(CPU_BUFFER, &residualHostMemory);
+	manager->blockMemoryCopy(&hostMemory, initial.data(), MEMORY_USER_TO_BLOCK);
+
+	ResultArena *arena = new ResultArena(manager);
+	uint32_t slot = arena->acquire();
+	DeviceMemoryBlock residualSlot = arena->slot(slot);
+
+	for (bool useArena : { false, true }) {
+		manager->stageMemorycpy(&hostMemory, &grid[0]);
+		manager->stageMemorycpy(&hostMemory, &grid[1]);
+		DeviceMemoryBlock* residual = useArena ? &residualSlot : &residualMemory;
+		// One chain per sweep direction, rerun every iteration
+		KernelChain even(manager, 1, 3), odd(manager, 1, 3);
+		const uint32_t zero = 0;
+		if (!useArena) {
+			even.update(residual, 0, &zero, sizeof(zero));
+			odd.update(residual, 0, &zero, sizeof(zero));
+		}
+		even.dispatch(&kernel, { &grid[0], &grid[1], residual }, groupCount, 1, 1, &elementCount);
+		odd.dispatch(&kernel, { &grid[1], &grid[0], residual }, groupCount, 1, 1, &elementCount);
+
+		float change = 0.0f;
+		int32_t iteration = 0;
+		auto start = std::chrono::steady_clock::now();
+		while (iteration < maxIterations) {
+			uint32_t bits;
+			if (useArena) {
+				arena->write(slot, zero);
+				(iteration % 2 == 0 ? even : odd).run();
+				bits = arena->read<uint32_t>(slot);
+			}
+			else {
+				(iteration % 2 == 0 ? even : odd).run();
+				manager->stageMemorycpy(&residualMemory, &residualHostMemory);
+				manager->blockMemoryCopy(&residualHostMemory, &bits, MEMORY_BLOCK_TO_USER);
+			}
+			memcpy(&change, &bits, sizeof(change));
+			iteration++;
+			if (change < tolerance) {
+				break;
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%s: %d sweeps, last change %g, %.1f us per sweep and check\n", useArena ? "result arena" : "copy + map  ",
+			iteration, change, seconds / iteration * 1e6);
+	}
+
+	arena->release(slot);
+	delete(arena);
+	manager->destroyKernel(&kernel);
+	manager->clean(&residualHostMemory);
+	manager->clean(&residualMemory);
+	manager->clean(&grid[1]);
+	manager->clean(&grid[0]);
+	manager->clean(&hostMemory);
+	delete(manager);
+	return 0;
+}
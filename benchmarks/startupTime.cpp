@@ -0,0 +1,164 @@
+#include <chrono>
+#include <filesystem>
+
+#include <AsyncStartup.hpp>
+#include <KernelChain.hpp>
+
+static uint32_t fibonacci(uint32_t n) {
+	if (n <= 1) {
+		return n;
+	}
+	uint32_t curr = 1;
+	uint32_t prev = 1;
+	for (uint32_t i = 2; i < n; ++i) {
+		uint32_t temp = curr;
+		curr += prev;
+		prev = temp;
+	}
+	return curr;
+}
+
+static double milliseconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The loader as it was before mmap: read into a heap copy, then create the module
+static VkShaderModule loadShaderCopy(const std::string& fileName, VkDevice device) {
+	std::ifstream is(fileName, std::ios::binary | std::ios::in | std::ios::ate);
+	std::vector<char> shaderCode(static_cast<size_t>(is.tellg()));
+	is.seekg(0, std::ios::beg);
+	is.read(shaderCode.data(), shaderCode.size());
+	return createShaderModule(reinterpret_cast<const uint32_t*>(shaderCode.data()), shaderCode.size(), device);
+}
+
+struct StartupRun
+{
+	double instance, selection, device, pools, shaderCopy, shaderMapped, shaderEmbedded, pipeline, firstJob, total;
+	bool cachedSelection;
+	size_t pipelineCacheBytes;
+};
+
+// One job through the stream kernel, checked against the host
+static bool runJob(ComputeManager* manager, ComputeKernel* kernel, const std::vector<uint32_t>& input, uint32_t localSize) {
+	uint32_t elementCount = static_cast<uint32_t>(input.size());
+	DeviceMemoryBlock memory;
+	memory.size = (VkDeviceSize)elementCount * sizeof(uint32_t);
+	manager->createBuffer(SHARED_BUFFER, &memory);
+	manager->blockMemoryCopy(&memory, const_cast<uint32_t*>(input.data()), MEMORY_USER_TO_BLOCK);
+	KernelChain *chain = new KernelChain(manager, 1, 1);
+	chain->dispatch(kernel, { &memory }, (elementCount + localSize - 1) / localSize, 1, 1, &elementCount);
+	chain->run();
+	delete(chain);
+	std::vector<uint32_t> output(elementCount);
+	manager->blockMemoryCopy(&memory, output.data(), MEMORY_BLOCK_TO_USER);
+	manager->clean(&memory);
+	bool correct = true;
+	for (uint32_t i = 0; i < elementCount; i++) {
+		correct = correct && output[i] == fibonacci(input[i]);
+	}
+	return correct;
+}
+
+/*
+	Where the wall clock of a short-lived run goes: every constructor phase, loading SPIR-V with a copy against mmap and the module embedded at build time,
+	pipeline creation and the first job. Runs cold (empty cache directory), warm (device selection and pipeline cache
+	from the first run) and warm with AsyncStartup, where startup overlaps with preparing the input on the main thread.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("cache", { "-c", "--cache" }, true, "Cache directory, cleared before the cold run (default: ./vkhpc_startup_cache)");
+	parser.add("elements", { "-e", "--elements" }, true, "Input elements prepared on the host (default: 16777216)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const std::string cacheDirectory = parser.getValueAsString("cache", "./vkhpc_startup_cache");
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 24);
+	std::filesystem::remove_all(cacheDirectory);
+	std::filesystem::create_directories(cacheDirectory);
+
+	uint32_t localSize = 256;
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	auto prepareInput = [elementCount]() {
+		std::vector<uint32_t> input(elementCount);
+		for (uint32_t i = 0; i < elementCount; i++) {
+			input[i] = (i * 2654435761u) % 48;
+		}
+		return input;
+	};
+
+	bool correct = true;
+	StartupRun runs[2];
+	for (StartupRun& run : runs) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<uint32_t> input = prepareInput();
+		ComputeManager *manager = new ComputeManager(cacheDirectory);
+		run.instance = manager->startupTimes.instance / 1e6;
+		run.selection = manager->startupTimes.deviceSelection / 1e6;
+		run.device = manager->startupTimes.device / 1e6;
+		run.pools = manager->startupTimes.pools / 1e6;
+		run.cachedSelection = manager->startupTimes.cachedSelection;
+		run.pipelineCacheBytes = manager->startupTimes.pipelineCacheBytes;
+
+		std::string shaderPath = std::string(SHADER_PATH) + "stream.comp.spv";
+		auto phaseStart = std::chrono::steady_clock::now();
+		vkDestroyShaderModule(manager->device, loadShaderCopy(shaderPath, manager->device), nullptr);
+		run.shaderCopy = milliseconds(phaseStart);
+		phaseStart = std::chrono::steady_clock::now();
+		VkShaderModule shaderModule = loadShader(shaderPath.c_str(), manager->device);
+		run.shaderMapped = milliseconds(phaseStart);
+		phaseStart = std::chrono::steady_clock::now();
+		const EmbeddedShader* embedded = findEmbeddedShader("stream.comp.spv");
+		if (embedded) {
+			vkDestroyShaderModule(manager->device, createShaderModule(embedded->code, embedded->size, manager->device), nullptr);
+		}
+		run.shaderEmbedded = embedded ? milliseconds(phaseStart) : -1.0;
+
+		phaseStart = std::chrono::steady_clock::now();
+		ComputeKernel kernel;
+		manager->createKernel(shaderModule, 1, &kernel, sizeof(uint32_t), &specializationInfo);
+		run.pipeline = milliseconds(phaseStart);
+
+		phaseStart = std::chrono::steady_clock::now();
+		correct = runJob(manager, &kernel, input, localSize) && correct;
+		run.firstJob = milliseconds(phaseStart);
+		run.total = milliseconds(start);
+		manager->destroyKernel(&kernel);
+		delete(manager);
+	}
+
+	// Startup and the prewarm pipeline on the helper thread while the input is prepared here
+	auto start = std::chrono::steady_clock::now();
+	LazyKernel *kernel = new LazyKernel("stream.comp.spv", 1, sizeof(uint32_t), &specializationInfo);
+	AsyncStartup *startup = new AsyncStartup(cacheDirectory, { kernel });
+	std::vector<uint32_t> input = prepareInput();
+	double prepared = milliseconds(start);
+	ComputeManager *manager = startup->manager();
+	ComputeKernel *streamKernel = startup->kernel(kernel);
+	double waited = milliseconds(start) - prepared;
+	correct = runJob(manager, streamKernel, input, localSize) && correct;
+	double asyncTotal = milliseconds(start);
+	delete(startup);
+	kernel->destroy(manager);
+	delete(kernel);
+	delete(manager);
+
+	printf("phase (ms) \t\tcold \t\twarm\n");
+	printf("instance \t\t%.2f \t\t%.2f\n", runs[0].instance, runs[1].instance);
+	printf("device selection \t%.2f \t\t%.2f (cached %d)\n", runs[0].selection, runs[1].selection, runs[1].cachedSelection);
+	printf("device \t\t\t%.2f \t\t%.2f\n", runs[0].device, runs[1].device);
+	printf("pools and caches \t%.2f \t\t%.2f (%zu bytes of pipeline cache)\n", runs[0].pools, runs[1].pools, runs[1].pipelineCacheBytes);
+	printf("shader, ifstream copy \t%.3f \t\t%.3f\n", runs[0].shaderCopy, runs[1].shaderCopy);
+	printf("shader, mmap \t\t%.3f \t\t%.3f\n", runs[0].shaderMapped, runs[1].shaderMapped);
+	printf("shader, embedded \t%.3f \t\t%.3f (-1: not embedded)\n", runs[0].shaderEmbedded, runs[1].shaderEmbedded);
+	printf("pipeline \t\t%.2f \t\t%.2f\n", runs[0].pipeline, runs[1].pipeline);
+	printf("first job \t\t%.2f \t\t%.2f\n", runs[0].firstJob, runs[1].firstJob);
+	printf("total (serial) \t\t%.2f \t\t%.2f\n", runs[0].total, runs[1].total);
+	printf("total (async, warm) \t\t\t%.2f (input %.2f, then waited %.2f for startup)\n", asyncTotal, prepared, waited);
+	printf("%s\n", correct ? "ok" : "MISMATCH");
+	std::filesystem::remove_all(cacheDirectory);
+	return correct ? 0 : 1;
+}
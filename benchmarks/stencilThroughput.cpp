@@ -0,0 +1,191 @@
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#include <Stencil.hpp>
+
+// Host reference of the boundary modes
+static int boundaryIndex(int i, int n, BoundaryMode boundary) {
+	if (i >= 0 && i < n) {
+		return i;
+	}
+	switch (boundary) {
+	case BOUNDARY_CLAMP:
+		return std::clamp(i, 0, n - 1);
+	case BOUNDARY_WRAP:
+		return ((i % n) + n) % n;
+	case BOUNDARY_ZERO:
+		return -1;
+	default:
+		if (n == 1) {
+			return 0;
+		}
+		int period = 2 * n - 2;
+		int m = ((i % period) + period) % period;
+		return m < n ? m : period - m;
+	}
+}
+
+static float sampleAt(const std::vector<float>& grid, GridExtent extent, int x, int y, int z, BoundaryMode boundary) {
+	x = boundaryIndex(x, extent.width, boundary);
+	y = boundaryIndex(y, extent.height, boundary);
+	z = boundaryIndex(z, extent.depth, boundary);
+	return (x < 0 || y < 0 || z < 0) ? 0.0f : grid[((size_t)z * extent.height + y) * extent.width + x];
+}
+
+static void forEachVoxel(GridExtent extent, const std::function<void(int, int, int, size_t)>& f) {
+	for (uint32_t z = 0; z < extent.depth; z++) {
+		for (uint32_t y = 0; y < extent.height; y++) {
+			for (uint32_t x = 0; x < extent.width; x++) {
+				f(x, y, z, ((size_t)z * extent.height + y) * extent.width + x);
+			}
+		}
+	}
+}
+
+static std::vector<float> referenceStencil(const std::vector<float>& grid, GridExtent extent, const std::vector<float>& weights, BoundaryMode boundary) {
+	std::vector<float> result(grid.size());
+	forEachVoxel(extent, [&](int x, int y, int z, size_t i) {
+		float sum = weights[0] * grid[i];
+		for (int k = 1; k < (int)weights.size(); k++) {
+			float neighbours = sampleAt(grid, extent, x - k, y, z, boundary) + sampleAt(grid, extent, x + k, y, z, boundary);
+			if (extent.height > 1) {
+				neighbours += sampleAt(grid, extent, x, y - k, z, boundary) + sampleAt(grid, extent, x, y + k, z, boundary);
+			}
+			if (extent.depth > 1) {
+				neighbours += sampleAt(grid, extent, x, y, z - k, boundary) + sampleAt(grid, extent, x, y, z + k, boundary);
+			}
+			sum += weights[k] * neighbours;
+		}
+		result[i] = sum;
+	});
+	return result;
+}
+
+static std::vector<float> referenceSeparable(std::vector<float> grid, GridExtent extent, const std::vector<float>& weights, BoundaryMode boundary) {
+	int radius = (int)weights.size() / 2;
+	std::vector<float> result(grid.size());
+	for (int axis = 0; axis < (extent.depth > 1 ? 3 : 2); axis++) {
+		forEachVoxel(extent, [&](int x, int y, int z, size_t i) {
+			float sum = 0.0f;
+			for (int r = -radius; r <= radius; r++) {
+				sum += weights[r + radius] * sampleAt(grid, extent, x + (axis == 0) * r, y + (axis == 1) * r, z + (axis == 2) * r, boundary);
+			}
+			result[i] = sum;
+		});
+		grid.swap(result);
+	}
+	return grid;
+}
+
+static bool matches(const std::vector<float>& result, const std::vector<float>& expected) {
+	for (size_t i = 0; i < result.size(); i++) {
+		if (std::fabs(result[i] - expected[i]) > 1e-4f * (1.0f + std::fabs(expected[i]))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	Voxels per second of the shared memory tiled star stencil, the same stencil on a storage image and a separable
+	convolution on the three axes, on 2D and 3D grids of several sizes. Results are checked against the host.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("iterations", { "-i", "--iterations" }, true, "Runs per kernel and grid (default: 20)");
+	parser.add("radius", { "-r", "--radius" }, true, "Stencil radius, 1 to 4 (default: 1)");
+	parser.add("boundary", { "-b", "--boundary" }, true, "0 clamp, 1 wrap, 2 zero, 3 mirror (default: 0)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const int32_t iterations = parser.getValueAsInt("iterations", 20);
+	const uint32_t radius = std::clamp(parser.getValueAsInt("radius", 1), 1, 4);
+	const BoundaryMode boundary = static_cast<BoundaryMode>(std::clamp(parser.getValueAsInt("boundary", 0), 0, 3));
+
+	// Laplacian-like star weights and a normalized binomial filter of radius 4
+	std::vector<float> stencilWeights(radius + 1, 1.0f / radius);
+	stencilWeights[0] = -6.0f;
+	std::vector<float> filterWeights = { 1, 8, 28, 56, 70, 56, 28, 8, 1 };
+	for (float& w : filterWeights) {
+		w /= 256.0f;
+	}
+
+	ComputeManager *manager = new ComputeManager();
+	GridStencils *stencils = new GridStencils(manager);
+	const std::vector<GridExtent> extents = { { 1024, 1024, 1 }, { 4096, 4096, 1 }, { 64, 64, 64 }, { 128, 128, 128 }, { 256, 256, 256 } };
+	bool correct = true;
+	for (GridExtent extent : extents) {
+		std::vector<float> grid(extent.voxels()), result(extent.voxels());
+		for (size_t i = 0; i < grid.size(); i++) {
+			grid[i] = (float)((i * 2654435761u) % 1000) / 1000.0f;
+		}
+		DeviceMemoryBlock hostMemory, inputMemory, outputMemory, scratchMemory;
+		hostMemory.size = inputMemory.size = outputMemory.size = scratchMemory.size = extent.bytes();
+		manager->createBuffer(CPU_BUFFER, &hostMemory);
+		manager->createBuffer(GPU_BUFFER, &inputMemory);
+		manager->createBuffer(GPU_BUFFER, &outputMemory);
+		manager->createBuffer(GPU_BUFFER, &scratchMemory);
+		manager->blockMemoryCopy(&hostMemory, grid.data(), MEMORY_USER_TO_BLOCK);
+		manager->stageMemorycpy(&hostMemory, &inputMemory);
+		GridImage image;
+		bool imageAvailable = stencils->createImage(extent, &image) == VK_SUCCESS;
+		if (imageAvailable) {
+			stencils->uploadImage(&inputMemory, &image);
+		}
+
+		auto readResult = [&]() {
+			manager->stageMemorycpy(&outputMemory, &hostMemory);
+			manager->blockMemoryCopy(&hostMemory, result.data(), MEMORY_BLOCK_TO_USER);
+			return result;
+		};
+		auto timeRuns = [&](const std::function<void()>& run) {
+			run();
+			auto start = std::chrono::steady_clock::now();
+			for (int32_t j = 0; j < iterations; j++) {
+				run();
+			}
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+		};
+
+		KernelChain stencilChain(manager, 1, 2), separableChain(manager, 3, 2);
+		stencils->stencil(stencilChain, &inputMemory, &outputMemory, extent, stencilWeights, boundary);
+		stencils->separable(separableChain, &inputMemory, &scratchMemory, &outputMemory, extent, filterWeights, boundary);
+
+		std::vector<float> expected = referenceStencil(grid, extent, stencilWeights, boundary);
+		double tiledSeconds = timeRuns([&] { stencilChain.run(); });
+		bool tiledCorrect = matches(readResult(), expected);
+		double imageSeconds = 0.0;
+		bool imageCorrect = true;
+		if (imageAvailable) {
+			imageSeconds = timeRuns([&] { stencils->stencilImage(&image, &outputMemory, stencilWeights, boundary); });
+			imageCorrect = matches(readResult(), expected);
+		}
+		double separableSeconds = timeRuns([&] { separableChain.run(); });
+		bool separableCorrect = matches(readResult(), referenceSeparable(grid, extent, filterWeights, boundary));
+		correct = correct && tiledCorrect && imageCorrect && separableCorrect;
+
+		double voxels = (double)extent.voxels();
+		printf("%ux%ux%u: stencil r%u tiled %.2f Gvox/s%s, image %.2f Gvox/s%s, separable r4 %.2f Gvox/s%s\n",
+			extent.width, extent.height, extent.depth, radius,
+			voxels / tiledSeconds / 1e9, tiledCorrect ? "" : " (MISMATCH)",
+			imageAvailable ? voxels / imageSeconds / 1e9 : 0.0, imageAvailable ? (imageCorrect ? "" : " (MISMATCH)") : " (too large for a 3D image)",
+			voxels / separableSeconds / 1e9, separableCorrect ? "" : " (MISMATCH)");
+
+		if (imageAvailable) {
+			stencils->destroyImage(&image);
+		}
+		manager->clean(&scratchMemory);
+		manager->clean(&outputMemory);
+		manager->clean(&inputMemory);
+		manager->clean(&hostMemory);
+	}
+	printf("%s\n", correct ? "ok" : "MISMATCH");
+
+	delete(stencils);
+	delete(manager);
+	return correct ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+
+#include <TenantScheduler.hpp>
+
+static uint32_t fibonacci(uint32_t n) {
+	if (n <= 1) {
+		return n;
+	}
+	uint32_t curr = 1;
+	uint32_t prev = 1;
+	for (uint32_t i = 2; i < n; ++i) {
+		uint32_t temp = curr;
+		curr += prev;
+		prev = temp;
+	}
+	return curr;
+}
+
+static double percentile(std::vector<double> samples, double fraction) {
+	std::sort(samples.begin(), samples.end());
+	size_t index = std::min(samples.size() - 1, (size_t)(fraction * samples.size()));
+	return samples[index];
+}
+
+/*
+	Latency of small interactive jobs from one tenant while several batch tenants keep the device busy with large jobs,
+	with batch jobs dispatched whole against cut into chunks. Interactive results are checked against the host.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("jobs", { "-j", "--jobs" }, true, "Interactive jobs per configuration (default: 500)");
+	parser.add("batch", { "-b", "--batch" }, true, "Elements per batch job (default: 67108864)");
+	parser.add("tenants", { "-t", "--tenants" }, true, "Batch tenants (default: 3)");
+	parser.add("chunk", { "-c", "--chunk" }, true, "Work groups per batch chunk (default: 256)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const int32_t jobCount = parser.getValueAsInt("jobs", 500);
+	const uint32_t batchElements = parser.getValueAsInt("batch", 1 << 26);
+	const uint32_t batchTenants = parser.getValueAsInt("tenants", 3);
+	const uint32_t interactiveElements = 4096;
+
+	uint32_t localSize = 256;
+	ComputeManager *manager = new ComputeManager();
+	printf("separate priority queue %d (family %u / %u), global priority %d\n",
+		manager->separatePriorityQueue, manager->queueFamilyIndex, manager->priorityQueueFamilyIndex, manager->globalPriorityEnabled);
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("stream.comp.spv", 1, &kernel, sizeof(uint32_t), &specializationInfo);
+
+	std::vector<DeviceMemoryBlock> batchMemory(batchTenants);
+	for (DeviceMemoryBlock& block : batchMemory) {
+		block.size = (VkDeviceSize)batchElements * sizeof(uint32_t);
+		manager->createBuffer(GPU_BUFFER, &block);
+	}
+	DeviceMemoryBlock interactiveMemory;
+	interactiveMemory.size = interactiveElements * sizeof(uint32_t);
+	manager->createBuffer(SHARED_BUFFER, &interactiveMemory);
+	uint32_t* interactiveValues;
+	VK_CHECK_RESULT(vkMapMemory(manager->device, interactiveMemory.memory, 0, VK_WHOLE_SIZE, 0, (void**)&interactiveValues));
+
+	bool correct = true;
+	printf("batch chunk \tp50 (us) \tp99 (us) \tbatch jobs\n");
+	for (uint32_t chunkGroups : { UINT32_MAX, (uint32_t)parser.getValueAsInt("chunk", 256) }) {
+		TenantScheduler *scheduler = new TenantScheduler(manager, chunkGroups);
+		std::atomic<bool> stopping{ false };
+		std::atomic<uint32_t> batchJobs{ 0 };
+
+		// Every batch tenant resubmits from its completion callback, so the batch lane never runs dry
+		std::function<void(uint32_t)> submitBatch = [&](uint32_t tenant) {
+			TenantJob job;
+			job.tenant = tenant + 1;
+			job.jobClass = JOB_BATCH;
+			job.kernel = &kernel;
+			job.bindings = { &batchMemory[tenant] };
+			job.pushConstants.resize(sizeof(uint32_t));
+			memcpy(job.pushConstants.data(), &batchElements, sizeof(uint32_t));
+			job.groupCountX = (batchElements + localSize - 1) / localSize;
+			job.done = [&, tenant](VkResult) {
+				batchJobs++;
+				if (!stopping) {
+					submitBatch(tenant);
+				}
+			};
+			scheduler->submit(std::move(job));
+		};
+		for (uint32_t tenant = 0; tenant < batchTenants; tenant++) {
+			submitBatch(tenant);
+		}
+
+		std::vector<double> latency;
+		for (int32_t i = 0; i < jobCount; i++) {
+			for (uint32_t e = 0; e < interactiveElements; e++) {
+				interactiveValues[e] = (e + i) % 48;
+			}
+			std::promise<VkResult> finished;
+			TenantJob job;
+			job.tenant = 0;
+			job.jobClass = JOB_INTERACTIVE;
+			job.kernel = &kernel;
+			job.bindings = { &interactiveMemory };
+			job.pushConstants.resize(sizeof(uint32_t));
+			memcpy(job.pushConstants.data(), &interactiveElements, sizeof(uint32_t));
+			job.groupCountX = interactiveElements / localSize;
+			job.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+			job.done = [&finished](VkResult result) { finished.set_value(result); };
+			auto start = std::chrono::steady_clock::now();
+			scheduler->submit(std::move(job));
+			VK_CHECK_RESULT(finished.get_future().get());
+			latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+			for (uint32_t e = 0; e < interactiveElements; e++) {
+				correct = correct && interactiveValues[e] == fibonacci((e + i) % 48);
+			}
+			// Think time between requests
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+		}
+		stopping = true;
+		// Waits for the batch jobs still queued
+		delete(scheduler);
+
+		if (chunkGroups == UINT32_MAX) {
+			printf("whole \t\t%.1f \t\t%.1f \t\t%u\n", percentile(latency, 0.50), percentile(latency, 0.99), batchJobs.load());
+		}
+		else {
+			printf("%u groups \t%.1f \t\t%.1f \t\t%u\n", chunkGroups, percentile(latency, 0.50), percentile(latency, 0.99), batchJobs.load());
+		}
+	}
+	printf("%s\n", correct ? "ok" : "MISMATCH");
+
+	vkUnmapMemory(manager->device, interactiveMemory.memory);
+	manager->clean(&interactiveMemory);
+	for (DeviceMemoryBlock& block : batchMemory) {
+		manager->clean(&block);
+	}
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return correct ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#include <chrono>
+#include <thread>
+
+#include <ConcurrentComputeManager.hpp>
+
+#define BUFFER_ELEMENTS 32
+
+/*
+	Submission throughput of ConcurrentComputeManager with 1 to N submitting threads.
+	Every thread runs its own upload -> compute -> readback jobs on private buffers.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("threads", { "-t", "--threads" }, true, "Maximum number of submitting threads (default: hardware concurrency)");
+	parser.add("jobs", { "-j", "--jobs" }, true, "Jobs per thread (default: 1000)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const int32_t maxThreads = parser.getValueAsInt("threads", std::max(1u, std::thread::hardware_concurrency()));
+	const int32_t jobsPerThread = parser.getValueAsInt("jobs", 1000);
+
+	const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
+	ComputeManager *manager = new ComputeManager();
+	ConcurrentComputeManager *frontend = new ConcurrentComputeManager(manager);
+
+	// The pipeline (and its descriptor set layout) is shared by all threads
+	DeviceMemoryBlock pipelineMemory;
+	pipelineMemory.size = bufferSize;
+	manager->createBuffer(GPU_BUFFER, &pipelineMemory);
+	manager->preparePipeline(&pipelineMemory);
+
+	printf("threads \tjobs/s \tspeedup\n");
+	double singleThreadRate = 0.0;
+	for (int32_t threadCount = 1; threadCount <= maxThreads; threadCount = (threadCount < maxThreads && threadCount * 2 > maxThreads) ? maxThreads : threadCount * 2) {
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+		for (int32_t t = 0; t < threadCount; t++) {
+			threads.emplace_back([&] {
+				std::vector<uint32_t> data(BUFFER_ELEMENTS);
+				uint32_t n = 0;
+				std::generate(data.begin(), data.end(), [&n] { return n++; });
+
+				DeviceMemoryBlock hostMemory, deviceMemory;
+				hostMemory.size = bufferSize;
+				deviceMemory.size = bufferSize;
+				frontend->createBuffer(CPU_BUFFER, &hostMemory);
+				frontend->createBuffer(GPU_BUFFER, &deviceMemory);
+				for (int32_t j = 0; j < jobsPerThread; j++) {
+					frontend->blockMemoryCopy(&hostMemory, data.data(), MEMORY_USER_TO_BLOCK);
+					frontend->stageMemorycpy(&hostMemory, &deviceMemory);
+					frontend->compute(&hostMemory, &deviceMemory);
+					frontend->stageMemorycpy(&deviceMemory, &hostMemory);
+					frontend->blockMemoryCopy(&hostMemory, data.data(), MEMORY_BLOCK_TO_USER);
+				}
+				frontend->clean(&deviceMemory);
+				frontend->clean(&hostMemory);
+			});
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double rate = threadCount * jobsPerThread / seconds;
+		if (threadCount == 1) {
+			singleThreadRate = rate;
+		}
+		printf("%d \t%.0f \t%.2fx\n", threadCount, rate, rate / singleThreadRate);
+	}
+
+	delete(frontend);
+	manager->clean(&pipelineMemory);
+	delete(manager);
+	return 0;
+}
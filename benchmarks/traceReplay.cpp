@@ -0,0 +1,434 @@
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#include <KernelChain.hpp>
+
+struct ReplayRecord
+{
+	TraceRecord record;
+	const uint8_t* extra;
+};
+
+// Reads the value at *cursor and advances it
+template<typename T>
+static T take(const uint8_t** cursor){
+	T value;
+	memcpy(&value, *cursor, sizeof(T));
+	*cursor += sizeof(T);
+	return value;
+}
+
+struct ReplayKernel
+{
+	ComputeKernel kernel;
+	bool created = false;
+	uint32_t pushConstantSize;
+	VkPipelineShaderStageCreateFlags stageFlags;
+	uint32_t requiredSubgroupSize;
+	std::vector<VkDescriptorType> bindingTypes;
+	std::vector<uint32_t> descriptorCounts;
+	std::vector<VkSpecializationMapEntry> mapEntries;
+	std::vector<uint8_t> specializationData;
+};
+
+struct EventTotals
+{
+	uint64_t count = 0;
+	uint64_t skipped = 0;
+	uint64_t bytes = 0;
+	uint64_t recordedNanoseconds = 0;
+	uint64_t replayedNanoseconds = 0;
+};
+
+static const char* eventName(uint8_t event){
+	static const char* names[TRACE_EVENT_COUNT] = {
+		"create_buffer", "destroy_buffer", "stage_copy", "host_copy", "create_kernel", "name_kernel", "destroy_kernel",
+		"create_chain", "destroy_chain", "chain_update", "dispatch", "chain_run", "chain_reset", "wait"
+	};
+	return event < TRACE_EVENT_COUNT ? names[event] : "unknown";
+}
+
+// Largest byte any record touches per buffer, buffers that predate the trace are only known from their uses
+static std::map<uint32_t, VkDeviceSize> bufferExtents(const std::vector<ReplayRecord>& records){
+	std::map<uint32_t, VkDeviceSize> extents;
+	auto touch = [&extents](uint32_t id, VkDeviceSize end) {
+		extents[id] = std::max(extents[id], end);
+	};
+	for (const ReplayRecord& entry : records) {
+		const TraceRecord& record = entry.record;
+		const uint8_t* cursor = entry.extra;
+		switch (record.event) {
+		case TRACE_CREATE_BUFFER:
+			touch(record.ids[0], record.size);
+			break;
+		case TRACE_STAGE_COPY:
+			for (uint32_t i = 0; i < record.extraSize / sizeof(VkBufferCopy); i++) {
+				VkBufferCopy region = take<VkBufferCopy>(&cursor);
+				touch(record.ids[0], region.srcOffset + region.size);
+				touch(record.ids[1], region.dstOffset + region.size);
+			}
+			break;
+		case TRACE_HOST_COPY:
+			touch(record.ids[0], take<uint64_t>(&cursor) + record.size);
+			break;
+		case TRACE_CHAIN_UPDATE:
+			touch(record.ids[1], take<uint64_t>(&cursor) + record.size);
+			break;
+		case TRACE_DISPATCH:
+			cursor += 3 * sizeof(uint32_t);
+			for (uint32_t i = 0; i < record.flag; i++) {
+				uint32_t id = take<uint32_t>(&cursor);
+				uint64_t offset = take<uint64_t>(&cursor);
+				touch(id, offset + take<uint64_t>(&cursor));
+			}
+			if (record.size == 1) {
+				uint32_t id = take<uint32_t>(&cursor);
+				touch(id, take<uint64_t>(&cursor) + sizeof(VkDispatchIndirectCommand));
+			}
+			break;
+		}
+	}
+	return extents;
+}
+
+/*
+	Replays a trace written by JobTrace (main --trace, or JobTrace::instance().start()) against this machine: buffers,
+	copies, kernels and chains are recreated with the recorded sizes, shapes and push constants, host payloads are zeros.
+	--mode original issues every call at its recorded offset from the start, fast issues them back to back. The trace is
+	replayed on one thread in the order the calls finished, which serializes traffic that was recorded concurrently.
+	Dispatches recorded outside a KernelChain (compute(), the schedulers and queues) replay as a submission of their own.
+	Prints recorded against replayed time per call type, so a change can be measured on a production traffic shape.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("trace", { "-t", "--trace" }, true, "Trace file to replay (default: vkhpc.trace)");
+	parser.add("mode", { "-m", "--mode" }, true, "original keeps the recorded timing, fast replays back to back (default: original)");
+	parser.add("speed", { "-s", "--speed" }, true, "Playback speed in percent for --mode original (default: 100)");
+	parser.add("dump", { "-d", "--dump" }, false, "Print the records instead of replaying them");
+	parser.add("check", { "--check" }, false, "Fail unless every dispatch, copy and run of the trace replayed (round trip test)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const std::string tracePath = parser.getValueAsString("trace", "vkhpc.trace");
+	const bool originalTiming = parser.getValueAsString("mode", "original") != "fast";
+	const double speed = std::max(parser.getValueAsInt("speed", 100), 1) / 100.0;
+
+	std::ifstream is(tracePath, std::ios::binary | std::ios::ate);
+	if (!is.is_open()) {
+		std::cerr << "Could not open trace " << tracePath << "\n";
+		return 1;
+	}
+	std::vector<uint8_t> bytes(static_cast<size_t>(is.tellg()));
+	is.seekg(0, std::ios::beg);
+	is.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+	TraceHeader header;
+	if (bytes.size() < sizeof(header) || memcmp(bytes.data(), TRACE_MAGIC, sizeof(header.magic)) != 0) {
+		std::cerr << tracePath << " is not a trace\n";
+		return 1;
+	}
+	memcpy(&header, bytes.data(), sizeof(header));
+	if (header.version != TRACE_VERSION) {
+		std::cerr << tracePath << " has trace version " << header.version << ", expected " << TRACE_VERSION << "\n";
+		return 1;
+	}
+	std::vector<ReplayRecord> records;
+	for (size_t offset = sizeof(header); offset + sizeof(TraceRecord) <= bytes.size();) {
+		ReplayRecord entry;
+		memcpy(&entry.record, bytes.data() + offset, sizeof(TraceRecord));
+		offset += sizeof(TraceRecord);
+		if (offset + entry.record.extraSize > bytes.size()) {
+			// Truncated by a process that died while recording
+			break;
+		}
+		entry.extra = bytes.data() + offset;
+		offset += entry.record.extraSize;
+		records.push_back(entry);
+	}
+	uint64_t traceSpan = 0;
+	for (const ReplayRecord& entry : records) {
+		traceSpan = std::max(traceSpan, entry.record.timestamp + entry.record.duration);
+	}
+	printf("%zu records over %.2f ms%s\n", records.size(), traceSpan / 1e6, (header.flags & TRACE_FLAG_HASHES) ? ", with payload hashes" : "");
+
+	if (parser.isSet("dump")) {
+		for (const ReplayRecord& entry : records) {
+			const TraceRecord& record = entry.record;
+			printf("%12.3f ms  thread %-3u %-15s ids %u %u  flag %u  size %llu  took %.3f ms", record.timestamp / 1e6, record.thread, eventName(record.event),
+				record.ids[0], record.ids[1], record.flag, (unsigned long long)record.size, record.duration / 1e6);
+			if (record.hash) {
+				printf("  hash %016llx", (unsigned long long)record.hash);
+			}
+			printf("\n");
+		}
+		return 0;
+	}
+
+	ComputeManager *manager = new ComputeManager();
+	std::map<uint32_t, VkDeviceSize> extents = bufferExtents(records);
+	std::map<uint32_t, DeviceMemoryBlock> buffers;
+	std::map<uint32_t, ReplayKernel> kernels;
+	std::map<uint32_t, KernelChain*> chains;
+	// Dispatches recorded outside a KernelChain (chain id 0) run one at a time on this chain
+	KernelChain* standalone = nullptr;
+	std::vector<uint8_t> scratch;
+	EventTotals totals[TRACE_EVENT_COUNT];
+	bool failed = false;
+
+	// The binding as recorded, or nullptr when the buffer is unknown
+	auto view = [&buffers](uint32_t id, VkDeviceSize offset, VkDeviceSize size) -> std::unique_ptr<DeviceMemoryBlock> {
+		auto it = buffers.find(id);
+		if (it == buffers.end()) {
+			return nullptr;
+		}
+		std::unique_ptr<DeviceMemoryBlock> block = std::make_unique<DeviceMemoryBlock>(it->second);
+		block->offset = offset;
+		block->size = size;
+		return block;
+	};
+
+	auto replayStart = std::chrono::steady_clock::now();
+	for (const ReplayRecord& entry : records) {
+		const TraceRecord& record = entry.record;
+		const uint8_t* cursor = entry.extra;
+		if (record.event >= TRACE_EVENT_COUNT) {
+			continue;
+		}
+		EventTotals& total = totals[record.event];
+		total.count++;
+		total.recordedNanoseconds += record.duration;
+		if (record.event == TRACE_WAIT) {
+			// Part of the call recorded next, replaying that call waits again
+			continue;
+		}
+		if (originalTiming) {
+			std::this_thread::sleep_until(replayStart + std::chrono::nanoseconds((uint64_t)(record.timestamp / speed)));
+		}
+		auto start = std::chrono::steady_clock::now();
+		bool replayed = true;
+		switch (record.event) {
+		case TRACE_CREATE_BUFFER: {
+			DeviceMemoryBlock block;
+			block.size = extents[record.ids[0]];
+			BufferFlag flag = record.flag == TRACE_UNKNOWN_BUFFER ? SHARED_BUFFER : static_cast<BufferFlag>(record.flag);
+			replayed = manager->createBuffer(flag, &block) == VK_SUCCESS;
+			if (replayed) {
+				buffers[record.ids[0]] = block;
+				total.bytes += block.size;
+			}
+			break;
+		}
+		case TRACE_DESTROY_BUFFER: {
+			auto it = buffers.find(record.ids[0]);
+			replayed = it != buffers.end();
+			if (replayed) {
+				manager->clean(&it->second);
+				buffers.erase(it);
+			}
+			break;
+		}
+		case TRACE_STAGE_COPY: {
+			std::vector<VkBufferCopy> regions(record.extraSize / sizeof(VkBufferCopy));
+			memcpy(regions.data(), cursor, regions.size() * sizeof(VkBufferCopy));
+			auto src = buffers.find(record.ids[0]);
+			auto dst = buffers.find(record.ids[1]);
+			replayed = src != buffers.end() && dst != buffers.end();
+			if (replayed) {
+				manager->stageMemoryRegions(&src->second, &dst->second, static_cast<uint32_t>(regions.size()), regions.data());
+				total.bytes += record.size;
+			}
+			break;
+		}
+		case TRACE_HOST_COPY: {
+			uint64_t offset = take<uint64_t>(&cursor);
+			auto it = buffers.find(record.ids[0]);
+			replayed = it != buffers.end();
+			if (replayed) {
+				scratch.resize(std::max<size_t>(scratch.size(), record.size));
+				manager->blockMemoryCopy(&it->second, scratch.data(), static_cast<MemoryCopyFlag>(record.flag), offset, record.size);
+				total.bytes += record.size;
+			}
+			break;
+		}
+		case TRACE_CREATE_KERNEL: {
+			ReplayKernel& kernel = kernels[record.ids[0]];
+			kernel.pushConstantSize = static_cast<uint32_t>(record.size);
+			kernel.stageFlags = take<uint32_t>(&cursor);
+			kernel.requiredSubgroupSize = take<uint32_t>(&cursor);
+			for (uint32_t i = 0; i < record.ids[1]; i++) {
+				kernel.bindingTypes.push_back(static_cast<VkDescriptorType>(take<uint32_t>(&cursor)));
+				kernel.descriptorCounts.push_back(take<uint32_t>(&cursor));
+			}
+			kernel.mapEntries.resize(take<uint32_t>(&cursor));
+			memcpy(kernel.mapEntries.data(), cursor, kernel.mapEntries.size() * sizeof(VkSpecializationMapEntry));
+			cursor += kernel.mapEntries.size() * sizeof(VkSpecializationMapEntry);
+			kernel.specializationData.assign(cursor, entry.extra + record.extraSize);
+			if (std::all_of(kernel.descriptorCounts.begin(), kernel.descriptorCounts.end(), [](uint32_t count) { return count == 1; })) {
+				kernel.descriptorCounts.clear();
+			}
+			// Built once the name is known
+			break;
+		}
+		case TRACE_NAME_KERNEL: {
+			auto it = kernels.find(record.ids[0]);
+			replayed = it != kernels.end();
+			if (replayed) {
+				ReplayKernel& kernel = it->second;
+				std::string shaderName(reinterpret_cast<const char*>(cursor), record.extraSize);
+				VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(kernel.mapEntries.size()), kernel.mapEntries.data(),
+					kernel.specializationData.size(), kernel.specializationData.data());
+				replayed = manager->createKernel(shaderName.c_str(), kernel.bindingTypes, &kernel.kernel, kernel.pushConstantSize, kernel.mapEntries.empty() ? nullptr : &specializationInfo,
+					kernel.stageFlags, kernel.requiredSubgroupSize, kernel.descriptorCounts) == VK_SUCCESS;
+				kernel.created = replayed;
+			}
+			break;
+		}
+		case TRACE_DESTROY_KERNEL: {
+			auto it = kernels.find(record.ids[0]);
+			replayed = it != kernels.end() && it->second.created;
+			if (replayed) {
+				manager->destroyKernel(&it->second.kernel);
+			}
+			if (it != kernels.end()) {
+				kernels.erase(it);
+			}
+			break;
+		}
+		case TRACE_CREATE_CHAIN:
+			chains[record.ids[0]] = new KernelChain(manager, static_cast<uint32_t>(record.size), record.ids[1]);
+			break;
+		case TRACE_DESTROY_CHAIN: {
+			auto it = chains.find(record.ids[0]);
+			replayed = it != chains.end();
+			if (replayed) {
+				delete(it->second);
+				chains.erase(it);
+			}
+			break;
+		}
+		case TRACE_CHAIN_UPDATE: {
+			uint64_t offset = take<uint64_t>(&cursor);
+			auto chain = chains.find(record.ids[0]);
+			auto it = buffers.find(record.ids[1]);
+			replayed = chain != chains.end() && it != buffers.end();
+			if (replayed) {
+				chain->second->update(&it->second, offset, cursor, record.size);
+			}
+			break;
+		}
+		case TRACE_DISPATCH: {
+			uint32_t groupCount[3];
+			for (uint32_t& count : groupCount) {
+				count = take<uint32_t>(&cursor);
+			}
+			std::vector<std::unique_ptr<DeviceMemoryBlock>> views;
+			std::vector<DeviceMemoryBlock*> bindings;
+			for (uint32_t i = 0; i < record.flag; i++) {
+				uint32_t id = take<uint32_t>(&cursor);
+				uint64_t offset = take<uint64_t>(&cursor);
+				views.push_back(view(id, offset, take<uint64_t>(&cursor)));
+				bindings.push_back(views.back().get());
+			}
+			std::unique_ptr<DeviceMemoryBlock> argumentBlock;
+			uint64_t indirectOffset = 0;
+			if (record.size == 1) {
+				uint32_t id = take<uint32_t>(&cursor);
+				indirectOffset = take<uint64_t>(&cursor);
+				argumentBlock = view(id, 0, sizeof(VkDispatchIndirectCommand));
+			}
+			KernelChain* chain = nullptr;
+			if (record.ids[0] == 0) {
+				if (!standalone) {
+					standalone = new KernelChain(manager, 1, UINT8_MAX);
+				}
+				chain = standalone;
+			}
+			else if (chains.count(record.ids[0]) != 0) {
+				chain = chains[record.ids[0]];
+			}
+			auto kernel = kernels.find(record.ids[1]);
+			// Unnamed kernels, SegmentedBuffer bindings and image bindings cannot be rebuilt
+			replayed = chain && kernel != kernels.end() && kernel->second.created
+				&& bindings.size() == kernel->second.bindingTypes.size()
+				&& std::all_of(kernel->second.bindingTypes.begin(), kernel->second.bindingTypes.end(), [](VkDescriptorType type) { return type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; })
+				&& std::none_of(bindings.begin(), bindings.end(), [](DeviceMemoryBlock* binding) { return binding == nullptr; })
+				&& (record.size != 1 || argumentBlock);
+			if (replayed) {
+				const void* pushConstants = kernel->second.pushConstantSize > 0 ? cursor : nullptr;
+				if (record.size == 1) {
+					chain->dispatchIndirect(&kernel->second.kernel, bindings, argumentBlock.get(), indirectOffset, pushConstants);
+				}
+				else {
+					chain->dispatch(&kernel->second.kernel, bindings, groupCount[0], groupCount[1], groupCount[2], pushConstants);
+				}
+				if (chain == standalone) {
+					failed = standalone->run() != VK_SUCCESS || failed;
+					standalone->reset();
+				}
+			}
+			break;
+		}
+		case TRACE_CHAIN_RUN: {
+			auto it = chains.find(record.ids[0]);
+			replayed = it != chains.end();
+			if (replayed) {
+				failed = it->second->run() != VK_SUCCESS || failed;
+			}
+			break;
+		}
+		case TRACE_CHAIN_RESET: {
+			auto it = chains.find(record.ids[0]);
+			replayed = it != chains.end();
+			if (replayed) {
+				it->second->reset();
+			}
+			break;
+		}
+		}
+		total.replayedNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		total.skipped += replayed ? 0 : 1;
+	}
+	double replaySpan = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+
+	printf("call \t\t\tcount \tskipped \tbytes \t\trecorded (ms) \treplayed (ms)\n");
+	for (uint8_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+		const EventTotals& total = totals[event];
+		if (total.count == 0) {
+			continue;
+		}
+		printf("%-15s \t%llu \t%llu \t\t%-12llu \t%.3f \t\t%.3f\n", eventName(event), (unsigned long long)total.count, (unsigned long long)total.skipped,
+			(unsigned long long)total.bytes, total.recordedNanoseconds / 1e6, total.replayedNanoseconds / 1e6);
+	}
+	printf("trace %.2f ms, replay (%s) %.2f ms\n", traceSpan / 1e6, originalTiming ? "original timing" : "fast", replaySpan * 1e3);
+	if (parser.isSet("check")) {
+		if (totals[TRACE_DISPATCH].count == 0) {
+			std::cerr << "Check failed: the trace holds no dispatch\n";
+			failed = true;
+		}
+		for (uint8_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+			if (totals[event].skipped > 0) {
+				std::cerr << "Check failed: " << totals[event].skipped << " " << eventName(event) << " records did not replay\n";
+				failed = true;
+			}
+		}
+	}
+
+	for (auto& [id, chain] : chains) {
+		delete(chain);
+	}
+	delete(standalone);
+	for (auto& [id, kernel] : kernels) {
+		if (kernel.created) {
+			manager->destroyKernel(&kernel.kernel);
+		}
+	}
+	for (auto& [id, block] : buffers) {
+		manager->clean(&block);
+	}
+	delete(manager);
+	return failed ? 1 : 0;
+}
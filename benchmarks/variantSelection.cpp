@@ -0,0 +1,70 @@
+#include <KernelVariants.hpp>
+
+/*
+	Times every legal reduction variant on this device, keeps the fastest one and checks its result.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-e", "--elements" }, true, "Elements to reduce (default: 16777216)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 24);
+
+	ComputeManager *manager = new ComputeManager();
+	manager->profile.print();
+
+	std::vector<uint32_t> input(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		input[i] = i % 7;
+	}
+	uint64_t expected = 0;
+	for (uint32_t v : input) {
+		expected += v;
+	}
+
+	DeviceMemoryBlock hostMemory, inputMemory, resultMemory, resultHostMemory;
+	hostMemory.size = inputMemory.size = (VkDeviceSize)elementCount * sizeof(uint32_t);
+	resultMemory.size = resultHostMemory.size = sizeof(uint32_t);
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &inputMemory);
+	manager->createBuffer(GPU_BUFFER, &resultMemory);
+	manager->createBuffer(CPU_BUFFER, &resultHostMemory);
+	manager->blockMemoryCopy(&hostMemory, input.data(), MEMORY_USER_TO_BLOCK);
+	manager->stageMemorycpy(&hostMemory, &inputMemory);
+
+	KernelVariantSelector selector(manager);
+	selector.verbose = true;
+	std::vector<KernelVariant> variants = reductionVariants();
+	std::vector<DeviceMemoryBlock*> bindings = { &inputMemory, &resultMemory };
+	ComputeKernel kernel;
+	size_t chosen;
+	if (selector.select("reduce", variants, bindings, elementCount, &elementCount, sizeof(uint32_t), &kernel, &chosen) != VK_SUCCESS) {
+		std::cerr << "No legal reduction variant on this device\n";
+		return 1;
+	}
+	printf("selected %s with workgroup size %u\n", variants[chosen].shaderName.c_str(), variants[chosen].localSizeX);
+
+	// Check the chosen variant on a cleared result
+	uint32_t sum = 0;
+	{
+		KernelChain chain(manager, 1, 2);
+		chain.update(&resultMemory, 0, &sum, sizeof(sum));
+		chain.dispatch(&kernel, bindings, (elementCount + variants[chosen].localSizeX - 1) / variants[chosen].localSizeX, 1, 1, &elementCount);
+		chain.run();
+	}
+	manager->stageMemorycpy(&resultMemory, &resultHostMemory);
+	manager->blockMemoryCopy(&resultHostMemory, &sum, MEMORY_BLOCK_TO_USER);
+	printf("sum %u, expected %u: %s\n", sum, (uint32_t)expected, sum == (uint32_t)expected ? "ok" : "MISMATCH");
+
+	manager->destroyKernel(&kernel);
+	manager->clean(&resultHostMemory);
+	manager->clean(&resultMemory);
+	manager->clean(&inputMemory);
+	manager->clean(&hostMemory);
+	delete(manager);
+	return sum == (uint32_t)expected ? 0 : 1;
+}
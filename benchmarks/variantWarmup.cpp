@@ -0,0 +1,117 @@
+#include <chrono>
+
+#include <PipelineVariantCache.hpp>
+#include <ShaderLaunchers.hpp>
+
+static uint32_t fibonacci(uint32_t n){
+	if (n <= 1) {
+		return n;
+	}
+	uint32_t curr = 1, prev = 1;
+	for (uint32_t i = 2; i < n; i++) {
+		uint32_t temp = curr;
+		curr += prev;
+		prev = temp;
+	}
+	return curr;
+}
+
+/*
+	Serves jobs of several sizes while the pipeline variants specialized for them compile in the background.
+	The request loop only calls PipelineVariantCache::resolve(): a job runs on its variant once it is ready
+	and on the generic kernel before that, so it never waits for the compiler.
+*/
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("elements", { "-n", "--elements" }, true, "Elements of the largest job (default: 65536)");
+	parser.add("variants", { "-v", "--variants" }, true, "Job sizes, each with its own variant (default: 16)");
+	parser.add("jobs", { "-j", "--jobs" }, true, "Jobs to serve (default: 2000)");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const uint32_t elementCount = parser.getValueAsInt("elements", 1 << 16);
+	const uint32_t variantCount = std::max(1, parser.getValueAsInt("variants", 16));
+	const uint32_t jobCount = parser.getValueAsInt("jobs", 2000);
+
+	ComputeManager *manager = new ComputeManager();
+
+	// The generic kernel bounds the dispatch by the whole buffer, a variant by its own job size
+	ComputeKernel generic;
+	shaders::headless::Specialization genericSpecialization;
+	genericSpecialization.bufferElements = elementCount;
+	shaders::headless::createKernel(manager, &generic, genericSpecialization);
+
+	std::vector<uint32_t> sizes(variantCount);
+	std::vector<SpecializationConstants> constants(variantCount);
+	std::vector<std::pair<std::string, SpecializationConstants>> warmList;
+	for (uint32_t i = 0; i < variantCount; i++) {
+		sizes[i] = std::max(1u, (uint32_t)((uint64_t)elementCount * (i + 1) / variantCount));
+		constants[i].set<uint32_t>(0, sizes[i]);
+		warmList.emplace_back(shaders::headless::fileName, constants[i]);
+	}
+
+	std::vector<uint32_t> input(elementCount);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		input[i] = i % 24;
+	}
+	DeviceMemoryBlock hostMemory, deviceMemory;
+	hostMemory.size = deviceMemory.size = (VkDeviceSize)elementCount * sizeof(uint32_t);
+	manager->createBuffer(CPU_BUFFER, &hostMemory);
+	manager->createBuffer(GPU_BUFFER, &deviceMemory);
+	manager->blockMemoryCopy(&hostMemory, input.data(), MEMORY_USER_TO_BLOCK);
+
+	MetricSnapshot before = Metrics::instance().snapshot();
+	PipelineVariantCache* cache = new PipelineVariantCache(manager, &generic);
+	auto start = std::chrono::steady_clock::now();
+	cache->warm(warmList);
+
+	KernelChain chain(manager, 1, 1);
+	ComputeKernel kernel;
+	uint32_t specializedJobs = 0;
+	double longestResolve = 0.0;
+	for (uint32_t job = 0; job < jobCount; job++) {
+		uint32_t variant = job % variantCount;
+		auto resolveStart = std::chrono::steady_clock::now();
+		specializedJobs += cache->resolve(shaders::headless::fileName, constants[variant], &kernel) ? 1 : 0;
+		longestResolve = std::max(longestResolve, std::chrono::duration<double>(std::chrono::steady_clock::now() - resolveStart).count());
+		chain.reset();
+		shaders::headless::dispatch(chain, &kernel, { &deviceMemory }, sizes[variant]);
+		chain.run();
+	}
+	double serveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Check the largest variant, waiting for it this time
+	manager->stageMemorycpy(&hostMemory, &deviceMemory);
+	kernel = generic;
+	kernel.pipeline = cache->get(shaders::headless::fileName, constants[variantCount - 1]);
+	bool valid = kernel.pipeline != VK_NULL_HANDLE;
+	if (valid) {
+		chain.reset();
+		shaders::headless::dispatch(chain, &kernel, { &deviceMemory }, elementCount);
+		chain.run();
+		std::vector<uint32_t> output(elementCount);
+		manager->stageMemorycpy(&deviceMemory, &hostMemory);
+		manager->blockMemoryCopy(&hostMemory, output.data(), MEMORY_BLOCK_TO_USER);
+		for (uint32_t i = 0; i < elementCount && valid; i++) {
+			valid = output[i] == fibonacci(input[i]);
+		}
+	}
+	delete(cache);
+	MetricSnapshot after = Metrics::instance().snapshot();
+
+	uint64_t compiles = after.counters[METRIC_PIPELINE_COMPILES] - before.counters[METRIC_PIPELINE_COMPILES];
+	double compileSeconds = (after.sums[METRIC_PIPELINE_COMPILE_TIME] - before.sums[METRIC_PIPELINE_COMPILE_TIME]) / 1e9;
+	printf("%u jobs in %.1f ms, %u on specialized variants, %u on the generic kernel\n", jobCount, serveSeconds * 1000.0, specializedJobs, jobCount - specializedJobs);
+	printf("%llu variants compiled on worker threads in %.1f ms\n", (unsigned long long)compiles, compileSeconds * 1000.0);
+	printf("longest resolve() on the request thread: %.1f us, no job waited on the compiler\n", longestResolve * 1e6);
+	printf("largest variant: %s\n", valid ? "ok" : "MISMATCH");
+
+	manager->clean(&deviceMemory);
+	manager->clean(&hostMemory);
+	manager->destroyKernel(&generic);
+	delete(manager);
+	return valid ? 0 : 1;
+}
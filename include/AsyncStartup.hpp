@@ -0,0 +1,106 @@
+#pragma once
+
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ComputeManager.hpp"
+
+/*
+	Kernel whose pipeline is built on first use, so it can be declared before the manager exists and never costs
+	anything in runs that do not need it. Keeps its own copy of the specialization data; get() is thread safe and
+	compiles at most once.
+*/
+class LazyKernel
+{
+	std::once_flag once;
+	ComputeKernel kernel;
+	bool created = false;
+	std::vector<VkSpecializationMapEntry> mapEntries;
+	std::vector<uint8_t> specializationData;
+	VkSpecializationInfo specializationInfo = {};
+
+public:
+	std::string shaderName;
+	uint32_t bindingCount;
+	uint32_t pushConstantSize;
+
+	ComputeKernel* get(ComputeManager* manager){
+		std::call_once(once, [&] {
+			VK_CHECK_RESULT(manager->createKernel(shaderName.c_str(), bindingCount, &kernel, pushConstantSize, mapEntries.empty() ? nullptr : &specializationInfo));
+			created = true;
+		});
+		return &kernel;
+	}
+
+	// Only destroys what get() created
+	void destroy(ComputeManager* manager){
+		if (created) {
+			manager->destroyKernel(&kernel);
+		}
+	}
+
+	LazyKernel(std::string shaderName, uint32_t bindingCount, uint32_t pushConstantSize = 0, const VkSpecializationInfo* specialization = nullptr)
+		: shaderName(shaderName), bindingCount(bindingCount), pushConstantSize(pushConstantSize)
+	{
+		if (specialization) {
+			mapEntries.assign(specialization->pMapEntries, specialization->pMapEntries + specialization->mapEntryCount);
+			const uint8_t* bytes = static_cast<const uint8_t*>(specialization->pData);
+			specializationData.assign(bytes, bytes + specialization->dataSize);
+			specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(mapEntries.size()), mapEntries.data(), specializationData.size(), specializationData.data());
+		}
+	}
+};
+
+/*
+	Creates the manager on a helper thread, so instance and device creation overlap with whatever the caller does
+	next (reading and preparing input), then builds the prewarm kernels there as well. manager() and kernel() only
+	block when the work they need has not finished yet.
+	The caller owns the manager, but has to destroy the AsyncStartup (which joins the helper) before deleting it.
+*/
+class AsyncStartup
+{
+	std::promise<ComputeManager*> promise;
+	std::shared_future<ComputeManager*> ready;
+	std::vector<LazyKernel*> prewarm;
+	std::thread thread;
+
+public:
+	// Helper thread time spent building the prewarm kernels
+	uint64_t prewarmNanoseconds = 0;
+
+	ComputeManager* manager(){
+		return ready.get();
+	}
+
+	ComputeKernel* kernel(LazyKernel* kernel){
+		return kernel->get(manager());
+	}
+
+	// Waits for the helper thread, including the prewarm kernels
+	void join(){
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	AsyncStartup(const std::string& cacheDirectory = "", std::vector<LazyKernel*> prewarm = {})
+		: ready(promise.get_future().share()), prewarm(prewarm)
+	{
+		thread = std::thread([this, cacheDirectory] {
+			ComputeManager* manager = new ComputeManager(cacheDirectory);
+			promise.set_value(manager);
+			auto start = std::chrono::steady_clock::now();
+			for (LazyKernel* kernel : this->prewarm) {
+				kernel->get(manager);
+			}
+			prewarmNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		});
+	}
+
+	~AsyncStartup()
+	{
+		join();
+	}
+};
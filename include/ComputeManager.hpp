@@ -1,3 +1,5 @@
+#pragma once
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,12 +7,58 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
 
 #include <vulkan/vulkan.h>
 
 #include "CommandLineParser.hpp"
 #include "VulkanInitializers.hpp"
+#include "QueueSubmitter.hpp"
+#include "DeviceProfile.hpp"
 #include "utils.hpp"
+#include "JobTrace.hpp"
+// Generated by the build from shaders/*.comp (see tools/embedShaders.cpp)
+#include "EmbeddedShaders.hpp"
+
+// Wall time of the constructor phases in nanoseconds
+struct StartupTimes
+{
+	uint64_t instance = 0;
+	// Physical device, profile, queue families and extensions
+	uint64_t deviceSelection = 0;
+	uint64_t device = 0;
+	// Command pool and pipeline cache
+	uint64_t pools = 0;
+	// The selection came from the cache directory instead of querying the device
+	bool cachedSelection = false;
+	size_t pipelineCacheBytes = 0;
+};
+
+/*
+	What the constructor decided about a device, stored in the cache directory so the next run skips the queue family,
+	extension and feature queries. Only reused while vendor, device, driver and pipeline cache UUID still match.
+*/
+struct DeviceSelection
+{
+	uint32_t version;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint32_t physicalDeviceIndex;
+	uint32_t queueFamilyIndex;
+	uint32_t priorityQueueFamilyIndex;
+	VkBool32 separatePriorityQueue;
+	VkBool32 memoryBudget;
+	VkBool32 timelineSemaphore;
+	// Empty when there is none or raising the priority was not permitted
+	char globalPriorityExtension[VK_MAX_EXTENSION_NAME_SIZE];
+};
+
+#define DEVICE_SELECTION_VERSION 1
 
 class ComputeManager
 {
@@ -21,16 +69,155 @@ public:
 	uint32_t queueFamilyIndex;
 	VkPipelineCache pipelineCache;
 	VkQueue queue;
+	QueueSubmitter submitter;
 	VkCommandPool commandPool;
-	VkDescriptorPool descriptorPool;
-	VkDescriptorSetLayout descriptorSetLayout;
-	VkDescriptorSet descriptorSet;
-	VkPipelineLayout pipelineLayout;
-	VkPipeline pipeline;
-	VkShaderModule shaderModule;
+	// Objects of the single pipeline built by preparePipeline, left null by programs that only use kernels
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkShaderModule shaderModule = VK_NULL_HANDLE;
 	CommandLineParser commandLineParser;
+	// VK_EXT_memory_budget is enabled on the device
+	bool memoryBudgetSupported = false;
+	// Vulkan 1.2 features enabled on the device (pNext is cleared after device creation)
+	VkPhysicalDeviceVulkan12Features enabledFeatures12 = {};
+	// Limits and optional features of the device, see DeviceProfile
+	DeviceProfile profile;
+	// Queue for latency sensitive work (queue priority 1.0), the same queue as queue when the device has only one compute queue
+	VkQueue priorityQueue;
+	uint32_t priorityQueueFamilyIndex;
+	QueueSubmitter prioritySubmitter;
+	bool separatePriorityQueue = false;
+	// The priority queue's family was created with VK_QUEUE_GLOBAL_PRIORITY_HIGH (VK_KHR / VK_EXT_global_priority)
+	bool globalPriorityEnabled = false;
+	// Device selection and pipeline cache files live here, empty for none
+	std::string cacheDirectory;
+	StartupTimes startupTimes;
+
+private:
+	// Live pinned allocations by mapped address, see allocatePinned
+	std::map<const char*, DeviceMemoryBlock> pinnedBlocks;
+	std::mutex pinnedMutex;
+
+	std::vector<char> readCacheFile(const char* name){
+		std::vector<char> data;
+		if (cacheDirectory.empty()) {
+			return data;
+		}
+		std::ifstream is(cacheDirectory + "/" + name, std::ios::binary | std::ios::in | std::ios::ate);
+		if (is.is_open()) {
+			data.resize(static_cast<size_t>(is.tellg()));
+			is.seekg(0, std::ios::beg);
+			is.read(data.data(), data.size());
+		}
+		return data;
+	}
+
+	// Write and rename, a concurrent run never reads a partial file
+	void writeCacheFile(const char* name, const void* data, size_t size){
+		if (cacheDirectory.empty()) {
+			return;
+		}
+		std::string target = cacheDirectory + "/" + name;
+		std::string temporary = target + ".tmp" + std::to_string(reinterpret_cast<uintptr_t>(this));
+		std::ofstream os(temporary, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!os.is_open()) {
+			return;
+		}
+		os.write(static_cast<const char*>(data), size);
+		os.close();
+		if (std::rename(temporary.c_str(), target.c_str()) != 0) {
+			std::remove(temporary.c_str());
+		}
+	}
+
+	bool loadDeviceSelection(const std::vector<VkPhysicalDevice>& physicalDevices, DeviceSelection* selection){
+		std::vector<char> data = readCacheFile("device.cache");
+		if (data.size() == sizeof(DeviceSelection)) {
+			memcpy(selection, data.data(), sizeof(DeviceSelection));
+			if (selection->version == DEVICE_SELECTION_VERSION && selection->physicalDeviceIndex < physicalDevices.size()) {
+				VkPhysicalDeviceProperties properties;
+				vkGetPhysicalDeviceProperties(physicalDevices[selection->physicalDeviceIndex], &properties);
+				if (properties.vendorID == selection->vendorID && properties.deviceID == selection->deviceID && properties.driverVersion == selection->driverVersion
+					&& memcmp(properties.pipelineCacheUUID, selection->pipelineCacheUUID, VK_UUID_SIZE) == 0) {
+					return true;
+				}
+			}
+		}
+		*selection = {};
+		return false;
+	}
+
+	void saveDeviceSelection(DeviceSelection& selection){
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		selection.version = DEVICE_SELECTION_VERSION;
+		selection.vendorID = properties.vendorID;
+		selection.deviceID = properties.deviceID;
+		selection.driverVersion = properties.driverVersion;
+		memcpy(selection.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+		writeCacheFile("device.cache", &selection, sizeof(DeviceSelection));
+	}
+
+	// Queue families, optional extensions and features of physicalDevice
+	void selectQueuesAndExtensions(DeviceSelection* selection){
+		uint32_t queueFamilyCount;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+		for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
+			if (queueFamilyProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+				selection->queueFamilyIndex = i;
+				break;
+			}
+		}
+		// Prefer a second compute family (async compute) for the priority queue, it can take a global priority of its own
+		selection->priorityQueueFamilyIndex = selection->queueFamilyIndex;
+		for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
+			if (i != selection->queueFamilyIndex && (queueFamilyProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+				selection->priorityQueueFamilyIndex = i;
+				selection->separatePriorityQueue = VK_TRUE;
+				break;
+			}
+		}
+		// Otherwise a second queue of the same family with a higher queue priority
+		if (!selection->separatePriorityQueue && queueFamilyProperties[selection->queueFamilyIndex].queueCount > 1) {
+			selection->separatePriorityQueue = VK_TRUE;
+		}
+
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensionProperties.data());
+		for (const VkExtensionProperties& extension : extensionProperties) {
+			if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+				selection->memoryBudget = VK_TRUE;
+			}
+			if (strcmp(extension.extensionName, VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME) == 0) {
+				strcpy(selection->globalPriorityExtension, VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME);
+			}
+			else if (selection->globalPriorityExtension[0] == '\0' && strcmp(extension.extensionName, VK_EXT_GLOBAL_PRIORITY_EXTENSION_NAME) == 0) {
+				strcpy(selection->globalPriorityExtension, VK_EXT_GLOBAL_PRIORITY_EXTENSION_NAME);
+			}
+		}
 
-	VkResult createBuffer(BufferFlag flag, DeviceMemoryBlock *block){
+		VkPhysicalDeviceVulkan12Features supportedFeatures12 = {};
+		supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		VkPhysicalDeviceFeatures2 supportedFeatures = {};
+		supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		supportedFeatures.pNext = &supportedFeatures12;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+		selection->timelineSemaphore = supportedFeatures12.timelineSemaphore;
+	}
+
+public:
+
+	// excludedHeap keeps the memory out of one heap, e.g. the device heap ResidencyManager evicts from
+	VkResult createBuffer(BufferFlag flag, DeviceMemoryBlock *block, uint32_t excludedHeap = UINT32_MAX){
+		MetricTimer timer(METRIC_BUFFER_CREATE_TIME);
+		uint64_t traceStart = JobTrace::instance().mark();
 		VkBufferUsageFlags usageFlags;
 		VkMemoryPropertyFlags memoryPropertyFlags;
 		switch (flag){
@@ -42,41 +229,100 @@ public:
 			usageFlags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 			memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
 			break;
+		case INDIRECT_BUFFER:
+			// Written by a kernel, consumed as VkDispatchIndirectCommand by the next one
+			usageFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			break;
+		case SHARED_BUFFER:
+			// Host mapped memory that shaders access directly
+			usageFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			break;
+		case PINNED_BUFFER:
+			// Host containers live in it (see allocatePinned), cached where available since the host reads it too
+			usageFlags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			break;
 		}
 		
 		// Create the buffer handle
 		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, block->size);
 		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		// Both compute queues use every buffer, without ownership transfers when they are in different families
+		const uint32_t queueFamilyIndices[2] = { queueFamilyIndex, priorityQueueFamilyIndex };
+		if (priorityQueueFamilyIndex != queueFamilyIndex) {
+			bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferCreateInfo.queueFamilyIndexCount = 2;
+			bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
 		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &block->buffer));
 
 		// Create the memory backing up the buffer handle
-		VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
-		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
 		VkMemoryRequirements memReqs;
 		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 		vkGetBufferMemoryRequirements(device, block->buffer, &memReqs);
 		memAlloc.allocationSize = memReqs.size;
-		// Find a memory type index that fits the properties of the buffer
-		bool memTypeFound = false;
-		for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
-			if ((memReqs.memoryTypeBits & 1) == 1) {
-				if ((deviceMemoryProperties.memoryTypes[i].propertyFlags & memoryPropertyFlags) == memoryPropertyFlags) {
-					memAlloc.memoryTypeIndex = i;
-					memTypeFound = true;
-					break;
-				}
-			}
-			memReqs.memoryTypeBits >>= 1;
+		memAlloc.memoryTypeIndex = UINT32_MAX;
+		if (flag == PINNED_BUFFER) {
+			memAlloc.memoryTypeIndex = memoryTypeIndex(memReqs.memoryTypeBits, memoryPropertyFlags | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, excludedHeap);
+		}
+		if (memAlloc.memoryTypeIndex == UINT32_MAX) {
+			memAlloc.memoryTypeIndex = memoryTypeIndex(memReqs.memoryTypeBits, memoryPropertyFlags, excludedHeap);
+		}
+		if (memAlloc.memoryTypeIndex == UINT32_MAX && excludedHeap != UINT32_MAX) {
+			vkDestroyBuffer(device, block->buffer, nullptr);
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		assert(memAlloc.memoryTypeIndex != UINT32_MAX);
+		VkResult result = vkAllocateMemory(device, &memAlloc, nullptr, &block->memory);
+		if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+			// Left to the caller, ResidencyManager evicts or spills to host memory instead
+			vkDestroyBuffer(device, block->buffer, nullptr);
+			return result;
 		}
-		assert(memTypeFound);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &block->memory));
+		VK_CHECK_RESULT(result);
 
 		VK_CHECK_RESULT(vkBindBufferMemory(device, block->buffer, block->memory, 0));
 
+		Metrics::instance().count(METRIC_BUFFERS_CREATED);
+		Metrics::instance().count(METRIC_BYTES_ALLOCATED, memAlloc.allocationSize);
+		Metrics::instance().gauge(METRIC_BUFFER_BYTES_LIVE, block->size);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().createBuffer(block, flag, traceStart);
+		}
 		return VK_SUCCESS;
 	}
 
+	// First memory type in typeBits with all properties set and outside excludedHeap, UINT32_MAX if there is none
+	uint32_t memoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t excludedHeap = UINT32_MAX){
+		VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+		for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
+			if ((typeBits & (1u << i)) && (deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties
+				&& deviceMemoryProperties.memoryTypes[i].heapIndex != excludedHeap) {
+				return i;
+			}
+		}
+		return UINT32_MAX;
+	}
+
 	VkResult stageMemorycpy(DeviceMemoryBlock* srcBlock, DeviceMemoryBlock* dstBlock){
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = srcBlock->size;
+		return stageMemoryRegions(srcBlock, dstBlock, 1, &copyRegion);
+	}
+
+	// Copies all regions in one command, region offsets are relative to the blocks
+	VkResult stageMemoryRegions(DeviceMemoryBlock* srcBlock, DeviceMemoryBlock* dstBlock, uint32_t regionCount, const VkBufferCopy* regions){
+		MetricTimer timer(METRIC_STAGE_COPY_TIME);
+		uint64_t traceStart = JobTrace::instance().mark();
+		std::vector<VkBufferCopy> copyRegions(regions, regions + regionCount);
+		for (VkBufferCopy& copyRegion : copyRegions) {
+			copyRegion.srcOffset += srcBlock->offset;
+			copyRegion.dstOffset += dstBlock->offset;
+			Metrics::instance().count(METRIC_BYTES_STAGED, copyRegion.size);
+		}
 		// Copy to staging buffer
 		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
 		VkCommandBuffer copyCmd;
@@ -84,9 +330,7 @@ public:
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
 
-		VkBufferCopy copyRegion = {};
-		copyRegion.size = srcBlock->size;
-		vkCmdCopyBuffer(copyCmd, srcBlock->buffer, dstBlock->buffer, 1, &copyRegion);
+		vkCmdCopyBuffer(copyCmd, srcBlock->buffer, dstBlock->buffer, regionCount, copyRegions.data());
 		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
 		
 		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
@@ -97,16 +341,25 @@ public:
 		VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
 
 		// Submit to the queue
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+		VK_CHECK_RESULT(submitter.submit(1, &submitInfo, fence));
+		uint64_t waitStart = JobTrace::instance().mark();
+		{
+			MetricTimer fenceTimer(METRIC_FENCE_WAIT_TIME);
+			VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+		}
 
 		vkDestroyFence(device, fence, nullptr);
 		vkFreeCommandBuffers(device, commandPool, 1, &copyCmd);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().wait(waitStart);
+			JobTrace::instance().stageCopy(srcBlock, dstBlock, copyRegions, traceStart);
+		}
 
 		return VK_SUCCESS;
 	}
 
 	VkResult preparePipeline(DeviceMemoryBlock* deviceMemory){
+		uint64_t traceStart = JobTrace::instance().mark();
 		std::vector<VkDescriptorPoolSize> poolSizes = {
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
 		};
@@ -130,41 +383,174 @@ public:
 			vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
 
-		VkDescriptorBufferInfo bufferDescriptor = { deviceMemory->buffer, 0, VK_WHOLE_SIZE };
+		// Larger blocks are not addressable through one descriptor, see SegmentedBuffer
+		assert(deviceMemory->size <= profile.maxStorageBufferRange);
+		VkDescriptorBufferInfo bufferDescriptor = deviceMemory->descriptor();
 		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = {
 			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferDescriptor),
 		};
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
 
-		VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-		pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-		VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
-
 		// Create pipeline
 		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(pipelineLayout, 0);
 
-		// Pass SSBO size via specialization constant
-		struct SpecializationData {
-			uint32_t BUFFER_ELEMENT_COUNT = 32;
-		} specializationData;
-		VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
-		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(SpecializationData), &specializationData);
+		// Pass SSBO size via specialization constant, layout and ids as reflected from the module at build time
+		static_assert(shaders::headless::bindingCount == 1 && shaders::headless::bindingTypes[0] == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		shaders::headless::Specialization specializationData;
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(shaders::headless::specializationMapEntries.size()),
+			shaders::headless::specializationMapEntries.data(), sizeof(specializationData), &specializationData);
 
 		VkPipelineShaderStageCreateInfo shaderStage = {};
 		shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-		shaderStage.module = loadShader((std::string(SHADER_PATH) + "headless.comp.spv").c_str(), device);
+		shaderModule = loadShaderModule(shaders::headless::fileName);
+		shaderStage.module = shaderModule;
 		shaderStage.pName = "main";
 		shaderStage.pSpecializationInfo = &specializationInfo;
 
 		assert(shaderStage.module != VK_NULL_HANDLE);
 		computePipelineCreateInfo.stage = shaderStage;
-		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline));
+		{
+			MetricTimer timer(METRIC_PIPELINE_COMPILE_TIME);
+			VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline));
+		}
+		Metrics::instance().count(METRIC_PIPELINE_COMPILES);
+		if (JobTrace::instance().enabled()) {
+			// Named like a SHADER_PATH kernel, so replay rebuilds it and compute() replays
+			ComputeKernel kernel = pipelineKernel();
+			JobTrace::instance().createKernel(&kernel, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, &specializationInfo, 0, 0, traceStart);
+			JobTrace::instance().nameKernel(&kernel, shaders::headless::fileName);
+		}
 		
 		return VK_SUCCESS;
 	}
 
+	// The pipeline built by preparePipeline as a kernel, for the trace
+	ComputeKernel pipelineKernel() const {
+		ComputeKernel kernel = {};
+		kernel.shaderModule = shaderModule;
+		kernel.descriptorSetLayout = descriptorSetLayout;
+		kernel.pipelineLayout = pipelineLayout;
+		kernel.pipeline = pipeline;
+		kernel.bindingCount = 1;
+		kernel.pushConstantSize = 0;
+		return kernel;
+	}
+
+	// Module embedded at build time, or read from SHADER_PATH for SPIR-V that was added after the build
+	VkShaderModule loadShaderModule(const char* shaderName){
+		const EmbeddedShader* embedded = findEmbeddedShader(shaderName);
+		if (embedded) {
+			return createShaderModule(embedded->code, embedded->size, device);
+		}
+		return loadShader((std::string(SHADER_PATH) + shaderName).c_str(), device);
+	}
+
+	// Builds a standalone kernel with bindingCount storage buffers at bindings 0..bindingCount-1 and an optional push constant block
+	// stageFlags and requiredSubgroupSize (0 for any) need the subgroup size control features of the profile
+	VkResult createKernel(const char* shaderName, uint32_t bindingCount, ComputeKernel* kernel, uint32_t pushConstantSize = 0, const VkSpecializationInfo* specializationInfo = nullptr,
+		VkPipelineShaderStageCreateFlags stageFlags = 0, uint32_t requiredSubgroupSize = 0){
+		VkShaderModule shaderModule = loadShaderModule(shaderName);
+		assert(shaderModule != VK_NULL_HANDLE);
+		VkResult result = createKernel(shaderModule, bindingCount, kernel, pushConstantSize, specializationInfo, stageFlags, requiredSubgroupSize);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().nameKernel(kernel, shaderName);
+		}
+		return result;
+	}
+
+	// The kernel takes ownership of shaderModule, for SPIR-V that does not come from SHADER_PATH
+	VkResult createKernel(VkShaderModule shaderModule, uint32_t bindingCount, ComputeKernel* kernel, uint32_t pushConstantSize = 0, const VkSpecializationInfo* specializationInfo = nullptr,
+		VkPipelineShaderStageCreateFlags stageFlags = 0, uint32_t requiredSubgroupSize = 0){
+		std::vector<VkDescriptorType> bindingTypes(bindingCount, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		return createKernel(shaderModule, bindingTypes, kernel, pushConstantSize, specializationInfo, stageFlags, requiredSubgroupSize);
+	}
+
+	// Binding i has descriptor type bindingTypes[i], for kernels that take storage images or other non-buffer resources
+	// A binding with descriptorCounts[i] > 1 is an array of buffers, e.g. the segments of a SegmentedBuffer
+	VkResult createKernel(const char* shaderName, const std::vector<VkDescriptorType>& bindingTypes, ComputeKernel* kernel, uint32_t pushConstantSize = 0, const VkSpecializationInfo* specializationInfo = nullptr,
+		VkPipelineShaderStageCreateFlags stageFlags = 0, uint32_t requiredSubgroupSize = 0, const std::vector<uint32_t>& descriptorCounts = {}){
+		VkShaderModule shaderModule = loadShaderModule(shaderName);
+		assert(shaderModule != VK_NULL_HANDLE);
+		VkResult result = createKernel(shaderModule, bindingTypes, kernel, pushConstantSize, specializationInfo, stageFlags, requiredSubgroupSize, descriptorCounts);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().nameKernel(kernel, shaderName);
+		}
+		return result;
+	}
+
+	VkResult createKernel(VkShaderModule shaderModule, const std::vector<VkDescriptorType>& bindingTypes, ComputeKernel* kernel, uint32_t pushConstantSize = 0, const VkSpecializationInfo* specializationInfo = nullptr,
+		VkPipelineShaderStageCreateFlags stageFlags = 0, uint32_t requiredSubgroupSize = 0, const std::vector<uint32_t>& descriptorCounts = {}){
+		assert(descriptorCounts.empty() || descriptorCounts.size() == bindingTypes.size());
+		uint64_t traceStart = JobTrace::instance().mark();
+		kernel->bindingCount = static_cast<uint32_t>(bindingTypes.size());
+		kernel->pushConstantSize = pushConstantSize;
+		kernel->descriptorCounts = descriptorCounts;
+		kernel->stageFlags = stageFlags;
+		kernel->requiredSubgroupSize = requiredSubgroupSize;
+		// Lets schedulers split a dispatch into chunks with vkCmdDispatchBase
+		kernel->pipelineFlags = VK_PIPELINE_CREATE_DISPATCH_BASE_BIT;
+
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings;
+		for (uint32_t i = 0; i < kernel->bindingCount; i++) {
+			setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(bindingTypes[i], VK_SHADER_STAGE_COMPUTE_BIT, i, descriptorCounts.empty() ? 1 : descriptorCounts[i]));
+		}
+		VkDescriptorSetLayoutCreateInfo descriptorLayout =
+			vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &kernel->descriptorSetLayout));
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+			vks::initializers::pipelineLayoutCreateInfo(&kernel->descriptorSetLayout, 1);
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, pushConstantSize, 0);
+		if (pushConstantSize > 0) {
+			pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+			pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		}
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &kernel->pipelineLayout));
+
+		VkPipelineShaderStageCreateInfo shaderStage = {};
+		shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		shaderStage.module = shaderModule;
+		shaderStage.pName = "main";
+		shaderStage.pSpecializationInfo = specializationInfo;
+		shaderStage.flags = stageFlags;
+		VkPipelineShaderStageRequiredSubgroupSizeCreateInfo requiredSubgroupSizeInfo = {};
+		requiredSubgroupSizeInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO;
+		requiredSubgroupSizeInfo.requiredSubgroupSize = requiredSubgroupSize;
+		if (requiredSubgroupSize != 0) {
+			shaderStage.pNext = &requiredSubgroupSizeInfo;
+		}
+		kernel->shaderModule = shaderStage.module;
+
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(kernel->pipelineLayout, kernel->pipelineFlags);
+		computePipelineCreateInfo.stage = shaderStage;
+		{
+			MetricTimer timer(METRIC_PIPELINE_COMPILE_TIME);
+			VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &kernel->pipeline));
+		}
+		Metrics::instance().count(METRIC_PIPELINE_COMPILES);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().createKernel(kernel, bindingTypes, specializationInfo, stageFlags, requiredSubgroupSize, traceStart);
+		}
+
+		return VK_SUCCESS;
+	}
+
+	VkResult destroyKernel(ComputeKernel* kernel){
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().destroyKernel(kernel);
+		}
+		vkDestroyPipeline(device, kernel->pipeline, nullptr);
+		vkDestroyPipelineLayout(device, kernel->pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, kernel->descriptorSetLayout, nullptr);
+		vkDestroyShaderModule(device, kernel->shaderModule, nullptr);
+		return VK_SUCCESS;
+	}
+
 	VkResult compute(DeviceMemoryBlock* hostMemory, DeviceMemoryBlock* deviceMemory){
+		MetricTimer timer(METRIC_COMPUTE_TIME);
+		uint64_t traceStart = JobTrace::instance().mark();
 		// Create a command buffer for compute operations
 		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
 			vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
@@ -179,7 +565,35 @@ public:
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
 		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		recordCompute(commandBuffer, descriptorSet, deviceMemory);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+		// Submit compute work
+		vkResetFences(device, 1, &fence);
+		const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
+		computeSubmitInfo.pWaitDstStageMask = &waitStageMask;
+		computeSubmitInfo.commandBufferCount = 1;
+		computeSubmitInfo.pCommandBuffers = &commandBuffer;
+		VK_CHECK_RESULT(submitter.submit(1, &computeSubmitInfo, fence));
+		uint64_t waitStart = JobTrace::instance().mark();
+		{
+			MetricTimer fenceTimer(METRIC_FENCE_WAIT_TIME);
+			VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+		}
+
+		vkDestroyFence(device, fence, nullptr);
+		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+		if (JobTrace::instance().enabled()) {
+			ComputeKernel kernel = pipelineKernel();
+			JobTrace::instance().wait(waitStart);
+			JobTrace::instance().submit(&kernel, { deviceMemory }, 32, 1, 1, nullptr, 0, traceStart);
+		}
+		return VK_SUCCESS;
+	}
 
+	// Records barrier, dispatch and readback barrier of the compute pipeline into a command buffer in recording state
+	void recordCompute(VkCommandBuffer commandBuffer, VkDescriptorSet set, DeviceMemoryBlock* deviceMemory){
 		// Barrier to ensure that input buffer transfer is finished before compute shader reads from it
 		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
 		bufferBarrier.buffer = deviceMemory->buffer;
@@ -199,9 +613,10 @@ public:
 			0, nullptr);
 
 		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, 0);
 
 		vkCmdDispatch(commandBuffer, 32, 1, 1);
+		Metrics::instance().count(METRIC_DISPATCHES);
 
 		// Barrier to ensure that shader writes are finished before buffer is read back from GPU
 		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
@@ -219,31 +634,100 @@ public:
 			0, nullptr,
 			1, &bufferBarrier,
 			0, nullptr);
-
-		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
-
-		// Submit compute work
-		vkResetFences(device, 1, &fence);
-		const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
-		computeSubmitInfo.pWaitDstStageMask = &waitStageMask;
-		computeSubmitInfo.commandBufferCount = 1;
-		computeSubmitInfo.pCommandBuffers = &commandBuffer;
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &computeSubmitInfo, fence));
-		VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
-
-		vkDestroyFence(device, fence, nullptr);
-		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-		return VK_SUCCESS;
 	}
 
 	VkResult clean(DeviceMemoryBlock *block){
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().destroyBuffer(block);
+		}
+		Metrics::instance().gauge(METRIC_BUFFER_BYTES_LIVE, -(int64_t)block->size);
 		vkDestroyBuffer(device, block->buffer, nullptr);
 		vkFreeMemory(device, block->memory, nullptr);
 		return VK_SUCCESS;
 	}
 
-	VkResult blockMemoryCopy(DeviceMemoryBlock *block, void* data, MemoryCopyFlag flag){
+	/*
+		Host coherent memory that stays mapped until freePinned(), for containers that the host fills and the GPU copies from
+		(see PinnedAllocator). Data written through *mapped needs no blockMemoryCopy, pinnedBlock() gives the block to stage from.
+	*/
+	VkResult allocatePinned(VkDeviceSize size, void** mapped){
+		DeviceMemoryBlock block;
+		block.size = size;
+		VkResult result = createBuffer(PINNED_BUFFER, &block);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		result = vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, mapped);
+		if (result != VK_SUCCESS) {
+			clean(&block);
+			return result;
+		}
+		std::lock_guard<std::mutex> lock(pinnedMutex);
+		pinnedBlocks[static_cast<const char*>(*mapped)] = block;
+		return VK_SUCCESS;
+	}
+
+	VkResult freePinned(void* mapped){
+		DeviceMemoryBlock block;
+		{
+			std::lock_guard<std::mutex> lock(pinnedMutex);
+			auto it = pinnedBlocks.find(static_cast<const char*>(mapped));
+			assert(it != pinnedBlocks.end());
+			block = it->second;
+			pinnedBlocks.erase(it);
+		}
+		vkUnmapMemory(device, block.memory);
+		return clean(&block);
+	}
+
+	// View of size bytes at pointer within a pinned allocation, false if pointer is not pinned memory
+	bool pinnedBlock(const void* pointer, VkDeviceSize size, DeviceMemoryBlock* block){
+		const char* address = static_cast<const char*>(pointer);
+		std::lock_guard<std::mutex> lock(pinnedMutex);
+		auto it = pinnedBlocks.upper_bound(address);
+		if (it == pinnedBlocks.begin()) {
+			return false;
+		}
+		--it;
+		VkDeviceSize offset = static_cast<VkDeviceSize>(address - it->first);
+		if (offset + size > it->second.size) {
+			return false;
+		}
+		*block = it->second;
+		block->offset = offset;
+		block->size = size;
+		return true;
+	}
+
+	// Stores the pipeline cache for the next run, also done by the destructor
+	void savePipelineCache(){
+		if (cacheDirectory.empty()) {
+			return;
+		}
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) {
+			return;
+		}
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) == VK_SUCCESS) {
+			writeCacheFile("pipeline.cache", data.data(), size);
+		}
+	}
+
+	// Submitter of the priority queue or of the normal queue, both serialize on the same queue when there is only one
+	QueueSubmitter& submitterFor(bool highPriority){
+		return highPriority && separatePriorityQueue ? prioritySubmitter : submitter;
+	}
+
+	// Copies size bytes at offset within the block, the whole block by default
+	VkResult blockMemoryCopy(DeviceMemoryBlock *block, void* data, MemoryCopyFlag flag, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE){
+		MetricTimer timer(METRIC_HOST_COPY_TIME);
+		uint64_t traceStart = JobTrace::instance().mark();
+		if (size == VK_WHOLE_SIZE) {
+			size = block->size - offset;
+		}
+		assert(offset + size <= block->size);
+		Metrics::instance().count(METRIC_BYTES_HOST_COPIED, size);
 		// Make device writes visible to the host
 		void *mapped;
 		vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &mapped);
@@ -255,20 +739,32 @@ public:
 
 		switch (flag){
 		case MEMORY_BLOCK_TO_USER:
-			memcpy(data, mapped, block->size);
+			memcpy(data, static_cast<char*>(mapped) + block->offset + offset, size);
 			break;
 		case MEMORY_USER_TO_BLOCK:
-			memcpy(mapped, data, block->size);
+			memcpy(static_cast<char*>(mapped) + block->offset + offset, data, size);
 			break;
 		}
 
 		vkFlushMappedMemoryRanges(device, 1, &mappedRange);
 		vkUnmapMemory(device, block->memory);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().hostCopy(block, data, flag, block->offset + offset, size, traceStart);
+		}
 		return VK_SUCCESS;
 	}
 
-	ComputeManager()
+	// Pass a cache directory to reuse the device selection and pipeline cache of earlier runs (see DeviceSelection)
+	ComputeManager(const std::string& cacheDirectory = "") : cacheDirectory(cacheDirectory)
 	{
+		auto phaseStart = std::chrono::steady_clock::now();
+		auto phase = [&phaseStart]() {
+			auto now = std::chrono::steady_clock::now();
+			uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now - phaseStart).count();
+			phaseStart = now;
+			return nanoseconds;
+		};
+
 		VkApplicationInfo appInfo = {};
 		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
 		appInfo.pApplicationName = "hpc";
@@ -281,6 +777,7 @@ public:
 		instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 		instanceCreateInfo.pApplicationInfo = &appInfo;
 		VK_CHECK_RESULT(vkCreateInstance(&instanceCreateInfo, nullptr, &instance));
+		startupTimes.instance = phase();
 
 		/*
 			Vulkan device creation
@@ -290,37 +787,110 @@ public:
 		VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr));
 		std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
 		VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data()));
-		physicalDevice = physicalDevices[0];
-
-		VkPhysicalDeviceProperties deviceProperties;
-		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		DeviceSelection selection = {};
+		startupTimes.cachedSelection = loadDeviceSelection(physicalDevices, &selection);
+		physicalDevice = physicalDevices[selection.physicalDeviceIndex];
 
-		// Request a single compute queue
-		const float defaultQueuePriority(0.0f);
+		profile.query(physicalDevice);
+		if (!startupTimes.cachedSelection) {
+			selectQueuesAndExtensions(&selection);
+		}
+		queueFamilyIndex = selection.queueFamilyIndex;
+		priorityQueueFamilyIndex = selection.priorityQueueFamilyIndex;
+		separatePriorityQueue = selection.separatePriorityQueue;
+		memoryBudgetSupported = selection.memoryBudget;
+
+		// A compute queue for normal work and, where the device has another compute queue, a high priority one
+		const float queuePriorities[2] = { 0.0f, 1.0f };
+		const float highQueuePriority(1.0f);
+		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		VkDeviceQueueCreateInfo queueCreateInfo = {};
-		uint32_t queueFamilyCount;
-		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
-		std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
-		for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
-			if (queueFamilyProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
-				queueFamilyIndex = i;
-				queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-				queueCreateInfo.queueFamilyIndex = i;
-				queueCreateInfo.queueCount = 1;
-				queueCreateInfo.pQueuePriorities = &defaultQueuePriority;
-				break;
-			}
+		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+		// Two queues when the priority queue shares the family
+		queueCreateInfo.queueCount = separatePriorityQueue && priorityQueueFamilyIndex == queueFamilyIndex ? 2 : 1;
+		queueCreateInfo.pQueuePriorities = queuePriorities;
+		queueCreateInfos.push_back(queueCreateInfo);
+		if (priorityQueueFamilyIndex != queueFamilyIndex) {
+			queueCreateInfo.queueFamilyIndex = priorityQueueFamilyIndex;
+			queueCreateInfo.queueCount = 1;
+			queueCreateInfo.pQueuePriorities = &highQueuePriority;
+			queueCreateInfos.push_back(queueCreateInfo);
+		}
+		// Optional device extensions
+		std::vector<const char*> enabledExtensions;
+		if (memoryBudgetSupported) {
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+		// Only a priority queue in its own family can be raised without raising the normal queue as well
+		VkDeviceQueueGlobalPriorityCreateInfoKHR globalPriorityInfo = {};
+		globalPriorityInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_GLOBAL_PRIORITY_CREATE_INFO_KHR;
+		globalPriorityInfo.globalPriority = VK_QUEUE_GLOBAL_PRIORITY_HIGH_KHR;
+		if (selection.globalPriorityExtension[0] != '\0' && priorityQueueFamilyIndex != queueFamilyIndex) {
+			enabledExtensions.push_back(selection.globalPriorityExtension);
+			queueCreateInfos[1].pNext = &globalPriorityInfo;
+			globalPriorityEnabled = true;
 		}
+		if (profile.subgroupSizeControlExtension) {
+			enabledExtensions.push_back(VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME);
+		}
+		// Optional device features, only what is supported gets enabled
+		enabledFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		enabledFeatures12.timelineSemaphore = selection.timelineSemaphore;
+		enabledFeatures12.storageBuffer8BitAccess = profile.storageBuffer8BitAccess;
+		enabledFeatures12.shaderFloat16 = profile.shaderFloat16;
+		enabledFeatures12.shaderInt8 = profile.shaderInt8;
+		enabledFeatures12.runtimeDescriptorArray = profile.storageBufferArrays;
+		enabledFeatures12.shaderStorageBufferArrayNonUniformIndexing = profile.storageBufferArrays;
+		VkPhysicalDeviceVulkan11Features enabledFeatures11 = {};
+		enabledFeatures11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+		enabledFeatures11.storageBuffer16BitAccess = profile.storageBuffer16BitAccess;
+		enabledFeatures11.pNext = &enabledFeatures12;
+		VkPhysicalDeviceSubgroupSizeControlFeatures enabledSizeControlFeatures = {};
+		enabledSizeControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES;
+		enabledSizeControlFeatures.subgroupSizeControl = profile.subgroupSizeControl;
+		enabledSizeControlFeatures.computeFullSubgroups = profile.computeFullSubgroups;
+		if (profile.subgroupSizeControl || profile.computeFullSubgroups) {
+			enabledFeatures12.pNext = &enabledSizeControlFeatures;
+		}
+		VkPhysicalDeviceFeatures2 enabledFeatures = {};
+		enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		enabledFeatures.pNext = &enabledFeatures11;
+		startupTimes.deviceSelection = phase();
+
 		// Create logical device
 		VkDeviceCreateInfo deviceCreateInfo = {};
 		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		deviceCreateInfo.queueCreateInfoCount = 1;
-		deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-		VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device));
+		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+		deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
+		deviceCreateInfo.pNext = &enabledFeatures;
+		VkResult result = vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device);
+		if (result == VK_ERROR_NOT_PERMITTED_KHR && globalPriorityEnabled) {
+			// Raising the global priority needs privileges the process may not have, fall back to queue priorities
+			queueCreateInfos[1].pNext = nullptr;
+			globalPriorityEnabled = false;
+			result = vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device);
+			// Later runs go straight to the fallback
+			selection.globalPriorityExtension[0] = '\0';
+			startupTimes.cachedSelection = false;
+		}
+		VK_CHECK_RESULT(result);
+		enabledFeatures12.pNext = nullptr;
+		if (!startupTimes.cachedSelection) {
+			saveDeviceSelection(selection);
+		}
 
-		// Get a compute queue
+		// Get the compute queues
 		vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+		submitter.queue = queue;
+		priorityQueue = queue;
+		if (separatePriorityQueue) {
+			vkGetDeviceQueue(device, priorityQueueFamilyIndex, priorityQueueFamilyIndex == queueFamilyIndex ? 1 : 0, &priorityQueue);
+		}
+		prioritySubmitter.queue = priorityQueue;
+		startupTimes.device = phase();
 
 		// Compute command pool
 		VkCommandPoolCreateInfo cmdPoolInfo = {};
@@ -328,10 +898,37 @@ public:
 		cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
 		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+
+		// Shared by every pipeline created through this manager, seeded from the last run when caching
+		std::vector<char> pipelineCacheData = readCacheFile("pipeline.cache");
+		VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+		pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		pipelineCacheCreateInfo.initialDataSize = pipelineCacheData.size();
+		pipelineCacheCreateInfo.pInitialData = pipelineCacheData.data();
+		result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+		if (result != VK_SUCCESS && !pipelineCacheData.empty()) {
+			// Data of another driver version, start empty
+			pipelineCacheCreateInfo.initialDataSize = 0;
+			pipelineCacheCreateInfo.pInitialData = nullptr;
+			result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+		}
+		VK_CHECK_RESULT(result);
+		startupTimes.pipelineCacheBytes = pipelineCacheCreateInfo.initialDataSize;
+		startupTimes.pools = phase();
 	}
 
 	~ComputeManager()
 	{
+		savePipelineCache();
+		// Pinned containers should be gone by now
+		for (auto& pinned : pinnedBlocks) {
+			vkUnmapMemory(device, pinned.second.memory);
+			clean(&pinned.second);
+		}
+		if (JobTrace::instance().enabled() && pipeline != VK_NULL_HANDLE) {
+			ComputeKernel kernel = pipelineKernel();
+			JobTrace::instance().destroyKernel(&kernel);
+		}
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
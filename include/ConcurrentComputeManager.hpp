@@ -0,0 +1,259 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ComputeManager.hpp"
+
+/*
+	Thread-safe front end of ComputeManager.
+	Every calling thread gets its own command pool, descriptor sets and recycled fences / command buffers,
+	submissions are handed to the queue through the manager's lock-free QueueSubmitter.
+	The pipeline must be prepared on the manager (preparePipeline) before compute() is called.
+*/
+class ConcurrentComputeManager
+{
+	struct ThreadContext
+	{
+		VkCommandPool commandPool;
+		VkDescriptorPool descriptorPool;
+		// One set per kernel layout, calls are synchronous so a set is never in flight while being rewritten
+		std::unordered_map<VkDescriptorSetLayout, VkDescriptorSet> descriptorSets;
+		std::vector<VkCommandBuffer> freeCommandBuffers;
+		std::vector<VkFence> freeFences;
+	};
+
+	static inline std::atomic<uint64_t> nextId{ 1 };
+
+	uint64_t id;
+	std::mutex contextsMutex;	// Only taken the first time a thread shows up
+	std::vector<ThreadContext*> contexts;
+
+	ThreadContext* threadContext()
+	{
+		thread_local std::unordered_map<uint64_t, ThreadContext*> threadContexts;
+		auto it = threadContexts.find(id);
+		if (it != threadContexts.end()) {
+			return it->second;
+		}
+
+		ThreadContext* context = new ThreadContext();
+		VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+		cmdPoolInfo.queueFamilyIndex = manager->queueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(manager->device, &cmdPoolInfo, nullptr, &context->commandPool));
+
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxKernelsPerThread * maxBindingsPerKernel),
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, maxKernelsPerThread);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &context->descriptorPool));
+
+		{
+			std::lock_guard<std::mutex> lock(contextsMutex);
+			contexts.push_back(context);
+		}
+		threadContexts[id] = context;
+		return context;
+	}
+
+	VkCommandBuffer acquireCommandBuffer(ThreadContext* context)
+	{
+		VkCommandBuffer commandBuffer;
+		if (!context->freeCommandBuffers.empty()) {
+			commandBuffer = context->freeCommandBuffers.back();
+			context->freeCommandBuffers.pop_back();
+			VK_CHECK_RESULT(vkResetCommandBuffer(commandBuffer, 0));
+			return commandBuffer;
+		}
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+			vks::initializers::commandBufferAllocateInfo(context->commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &commandBuffer));
+		return commandBuffer;
+	}
+
+	VkFence acquireFence(ThreadContext* context)
+	{
+		VkFence fence;
+		if (!context->freeFences.empty()) {
+			fence = context->freeFences.back();
+			context->freeFences.pop_back();
+			VK_CHECK_RESULT(vkResetFences(manager->device, 1, &fence));
+			return fence;
+		}
+		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+		VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &fence));
+		return fence;
+	}
+
+	VkDescriptorSet bindBuffers(ThreadContext* context, VkDescriptorSetLayout layout, const std::vector<DeviceMemoryBlock*>& bindings)
+	{
+		VkDescriptorSet& descriptorSet = context->descriptorSets[layout];
+		if (descriptorSet == VK_NULL_HANDLE) {
+			VkDescriptorSetAllocateInfo allocInfo =
+				vks::initializers::descriptorSetAllocateInfo(context->descriptorPool, &layout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSet));
+		}
+		std::vector<VkDescriptorBufferInfo> bufferDescriptors(bindings.size());
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets(bindings.size());
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bufferDescriptors[i] = bindings[i]->descriptor();
+			writeDescriptorSets[i] = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, i, &bufferDescriptors[i]);
+		}
+		vkUpdateDescriptorSets(manager->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		return descriptorSet;
+	}
+
+	// Submits a recorded command buffer, waits for it and hands command buffer and fence back to the thread's free lists
+	VkResult submitAndWait(ThreadContext* context, VkCommandBuffer commandBuffer)
+	{
+		VkFence fence = acquireFence(context);
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		VkResult result = manager->submitter.submit(1, &submitInfo, fence);
+		if (result == VK_SUCCESS) {
+			MetricTimer timer(METRIC_FENCE_WAIT_TIME);
+			uint64_t waitStart = JobTrace::instance().mark();
+			result = vkWaitForFences(manager->device, 1, &fence, VK_TRUE, UINT64_MAX);
+			if (JobTrace::instance().enabled()) {
+				JobTrace::instance().wait(waitStart);
+			}
+		}
+		context->freeCommandBuffers.push_back(commandBuffer);
+		context->freeFences.push_back(fence);
+		return result;
+	}
+
+public:
+	ComputeManager* manager;
+	// Sizes each thread's descriptor pool
+	uint32_t maxKernelsPerThread = 16;
+	uint32_t maxBindingsPerKernel = 8;
+
+	VkResult createBuffer(BufferFlag flag, DeviceMemoryBlock* block){
+		return manager->createBuffer(flag, block);
+	}
+
+	VkResult blockMemoryCopy(DeviceMemoryBlock* block, void* data, MemoryCopyFlag flag){
+		return manager->blockMemoryCopy(block, data, flag);
+	}
+
+	VkResult clean(DeviceMemoryBlock* block){
+		return manager->clean(block);
+	}
+
+	VkResult stageMemorycpy(DeviceMemoryBlock* srcBlock, DeviceMemoryBlock* dstBlock){
+		uint64_t traceStart = JobTrace::instance().mark();
+		ThreadContext* context = threadContext();
+		VkCommandBuffer copyCmd = acquireCommandBuffer(context);
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = srcBlock->offset;
+		copyRegion.dstOffset = dstBlock->offset;
+		copyRegion.size = srcBlock->size;
+		vkCmdCopyBuffer(copyCmd, srcBlock->buffer, dstBlock->buffer, 1, &copyRegion);
+		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
+		VkResult result = submitAndWait(context, copyCmd);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().stageCopy(srcBlock, dstBlock, { copyRegion }, traceStart);
+		}
+		return result;
+	}
+
+	VkResult compute([[maybe_unused]] DeviceMemoryBlock* hostMemory, DeviceMemoryBlock* deviceMemory){
+		uint64_t traceStart = JobTrace::instance().mark();
+		ThreadContext* context = threadContext();
+		VkDescriptorSet descriptorSet = bindBuffers(context, manager->descriptorSetLayout, { deviceMemory });
+
+		VkCommandBuffer commandBuffer = acquireCommandBuffer(context);
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		manager->recordCompute(commandBuffer, descriptorSet, deviceMemory);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		VkResult result = submitAndWait(context, commandBuffer);
+		if (JobTrace::instance().enabled()) {
+			ComputeKernel kernel = manager->pipelineKernel();
+			JobTrace::instance().submit(&kernel, { deviceMemory }, 32, 1, 1, nullptr, 0, traceStart);
+		}
+		return result;
+	}
+
+	// Upload of size bytes, dispatch of a single-binding kernel and readback, all in one submission
+	VkResult runJob(ComputeKernel* kernel, DeviceMemoryBlock* hostMemory, DeviceMemoryBlock* deviceMemory, VkDeviceSize size, uint32_t groupCountX, const void* pushConstants = nullptr){
+		assert(kernel->bindingCount == 1);
+		uint64_t traceStart = JobTrace::instance().mark();
+		ThreadContext* context = threadContext();
+		VkDescriptorSet descriptorSet = bindBuffers(context, kernel->descriptorSetLayout, { deviceMemory });
+
+		VkCommandBuffer commandBuffer = acquireCommandBuffer(context);
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+
+		VkBufferCopy copyRegion = {};
+		Metrics::instance().count(METRIC_BYTES_STAGED, 2 * size);
+		copyRegion.srcOffset = hostMemory->offset;
+		copyRegion.dstOffset = deviceMemory->offset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, hostMemory->buffer, deviceMemory->buffer, 1, &copyRegion);
+
+		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+		bufferBarrier.buffer = deviceMemory->buffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		if (kernel->pushConstantSize > 0) {
+			vkCmdPushConstants(commandBuffer, kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, kernel->pushConstantSize, pushConstants);
+		}
+		vkCmdDispatch(commandBuffer, groupCountX, 1, 1);
+		Metrics::instance().count(METRIC_DISPATCHES);
+
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+		std::swap(copyRegion.srcOffset, copyRegion.dstOffset);
+		vkCmdCopyBuffer(commandBuffer, deviceMemory->buffer, hostMemory->buffer, 1, &copyRegion);
+
+		// Make the readback visible to the host
+		bufferBarrier.buffer = hostMemory->buffer;
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		VkResult result = submitAndWait(context, commandBuffer);
+		if (JobTrace::instance().enabled()) {
+			// Upload and readback share the submission, the record's duration covers all three
+			JobTrace::instance().submit(kernel, { deviceMemory }, groupCountX, 1, 1, pushConstants, kernel->pushConstantSize, traceStart);
+		}
+		return result;
+	}
+
+	ConcurrentComputeManager(ComputeManager* manager) : id(nextId++), manager(manager)
+	{
+	}
+
+	~ConcurrentComputeManager()
+	{
+		vkDeviceWaitIdle(manager->device);
+		for (ThreadContext* context : contexts) {
+			for (VkFence fence : context->freeFences) {
+				vkDestroyFence(manager->device, fence, nullptr);
+			}
+			// Destroying the pools frees their command buffers and descriptor sets
+			vkDestroyDescriptorPool(manager->device, context->descriptorPool, nullptr);
+			vkDestroyCommandPool(manager->device, context->commandPool, nullptr);
+			delete context;
+		}
+	}
+};
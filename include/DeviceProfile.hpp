@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+/*
+	Capabilities of the physical device that kernels are specialized for, queried once before device creation.
+	Feature flags are the ones ComputeManager enables on the device, so they can be relied upon.
+*/
+struct DeviceProfile
+{
+	std::string deviceName;
+	uint32_t vendorID;
+	uint32_t apiVersion;
+	uint32_t driverVersion;
+
+	// Subgroups
+	uint32_t subgroupSize;
+	VkShaderStageFlags subgroupSupportedStages;
+	VkSubgroupFeatureFlags subgroupSupportedOperations;
+	// VK_EXT_subgroup_size_control, core in Vulkan 1.3
+	bool subgroupSizeControl;
+	bool computeFullSubgroups;
+	// Needs the extension enabled on a Vulkan 1.2 device
+	bool subgroupSizeControlExtension;
+	uint32_t minSubgroupSize;
+	uint32_t maxSubgroupSize;
+	uint32_t maxComputeWorkgroupSubgroups;
+	VkShaderStageFlags requiredSubgroupSizeStages;
+
+	// Compute limits
+	uint32_t maxComputeSharedMemorySize;
+	uint32_t maxComputeWorkGroupInvocations;
+	uint32_t maxComputeWorkGroupSize[3];
+	uint32_t maxStorageBufferRange;
+	VkDeviceSize minStorageBufferOffsetAlignment;
+	VkDeviceSize maxMemoryAllocationSize;
+	uint32_t maxPerStageDescriptorStorageBuffers;
+	// Granularity of flushes and invalidations of non-coherent mapped memory
+	VkDeviceSize nonCoherentAtomSize;
+	float timestampPeriod;
+
+	// 8 / 16 bit storage and arithmetic
+	bool storageBuffer16BitAccess;
+	bool storageBuffer8BitAccess;
+	bool shaderFloat16;
+	bool shaderInt8;
+
+	// Runtime sized storage buffer arrays indexed with nonuniformEXT, needed by SegmentedBuffer kernels
+	bool storageBufferArrays;
+
+	void query(VkPhysicalDevice physicalDevice){
+		VkPhysicalDeviceProperties baseProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &baseProperties);
+		bool vulkan13 = baseProperties.apiVersion >= VK_API_VERSION_1_3;
+
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensionProperties.data());
+		subgroupSizeControlExtension = false;
+		for (const VkExtensionProperties& extension : extensionProperties) {
+			if (!vulkan13 && strcmp(extension.extensionName, VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME) == 0) {
+				subgroupSizeControlExtension = true;
+			}
+		}
+		bool sizeControlAvailable = vulkan13 || subgroupSizeControlExtension;
+
+		VkPhysicalDeviceSubgroupSizeControlProperties sizeControlProperties = {};
+		sizeControlProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES;
+		VkPhysicalDeviceMaintenance3Properties maintenance3Properties = {};
+		maintenance3Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_3_PROPERTIES;
+		maintenance3Properties.pNext = sizeControlAvailable ? &sizeControlProperties : nullptr;
+		VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+		subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+		subgroupProperties.pNext = &maintenance3Properties;
+		VkPhysicalDeviceProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &subgroupProperties;
+		vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+		VkPhysicalDeviceSubgroupSizeControlFeatures sizeControlFeatures = {};
+		sizeControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES;
+		VkPhysicalDeviceVulkan12Features features12 = {};
+		features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		features12.pNext = sizeControlAvailable ? &sizeControlFeatures : nullptr;
+		VkPhysicalDeviceVulkan11Features features11 = {};
+		features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+		features11.pNext = &features12;
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &features11;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+		const VkPhysicalDeviceLimits& limits = properties.properties.limits;
+		deviceName = properties.properties.deviceName;
+		vendorID = properties.properties.vendorID;
+		apiVersion = properties.properties.apiVersion;
+		driverVersion = properties.properties.driverVersion;
+
+		subgroupSize = subgroupProperties.subgroupSize;
+		subgroupSupportedStages = subgroupProperties.supportedStages;
+		subgroupSupportedOperations = subgroupProperties.supportedOperations;
+		subgroupSizeControl = sizeControlFeatures.subgroupSizeControl;
+		computeFullSubgroups = sizeControlFeatures.computeFullSubgroups;
+		// Without size control the size is fixed
+		minSubgroupSize = sizeControlAvailable ? sizeControlProperties.minSubgroupSize : subgroupSize;
+		maxSubgroupSize = sizeControlAvailable ? sizeControlProperties.maxSubgroupSize : subgroupSize;
+		maxComputeWorkgroupSubgroups = sizeControlAvailable ? sizeControlProperties.maxComputeWorkgroupSubgroups : limits.maxComputeWorkGroupInvocations / subgroupSize;
+		requiredSubgroupSizeStages = sizeControlAvailable ? sizeControlProperties.requiredSubgroupSizeStages : 0;
+
+		maxComputeSharedMemorySize = limits.maxComputeSharedMemorySize;
+		maxComputeWorkGroupInvocations = limits.maxComputeWorkGroupInvocations;
+		for (int i = 0; i < 3; i++) {
+			maxComputeWorkGroupSize[i] = limits.maxComputeWorkGroupSize[i];
+		}
+		maxStorageBufferRange = limits.maxStorageBufferRange;
+		minStorageBufferOffsetAlignment = limits.minStorageBufferOffsetAlignment;
+		maxMemoryAllocationSize = maintenance3Properties.maxMemoryAllocationSize;
+		maxPerStageDescriptorStorageBuffers = limits.maxPerStageDescriptorStorageBuffers;
+		nonCoherentAtomSize = limits.nonCoherentAtomSize;
+		timestampPeriod = limits.timestampPeriod;
+
+		storageBuffer16BitAccess = features11.storageBuffer16BitAccess;
+		storageBuffer8BitAccess = features12.storageBuffer8BitAccess;
+		shaderFloat16 = features12.shaderFloat16;
+		shaderInt8 = features12.shaderInt8;
+		storageBufferArrays = features12.runtimeDescriptorArray && features12.shaderStorageBufferArrayNonUniformIndexing;
+	}
+
+	void print(){
+		std::cout << "Device: " << deviceName << " (vendor 0x" << std::hex << vendorID << std::dec << ")\n";
+		std::cout << " subgroup size " << subgroupSize << " [" << minSubgroupSize << ", " << maxSubgroupSize << "]"
+			<< ", size control " << subgroupSizeControl << ", full subgroups " << computeFullSubgroups << "\n";
+		std::cout << " shared memory " << maxComputeSharedMemorySize << " bytes, max invocations " << maxComputeWorkGroupInvocations << "\n";
+		std::cout << " 16 bit storage " << storageBuffer16BitAccess << ", 8 bit storage " << storageBuffer8BitAccess
+			<< ", float16 " << shaderFloat16 << ", int8 " << shaderInt8 << "\n";
+		std::cout << " storage buffer range " << maxStorageBufferRange << " bytes, allocation " << maxMemoryAllocationSize
+			<< " bytes, buffer arrays " << storageBufferArrays << "\n";
+	}
+};
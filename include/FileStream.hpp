@@ -0,0 +1,405 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef VKHPC_LIBURING
+#include <liburing.h>
+#endif
+
+#include "ComputeManager.hpp"
+
+struct StreamStats
+{
+	uint64_t bytes = 0;
+	uint32_t chunks = 0;
+	double seconds = 0.0;
+	// Time the pipeline stages were busy, they overlap so the sum exceeds seconds
+	double readSeconds = 0.0;
+	double gpuSeconds = 0.0;
+	double writeSeconds = 0.0;
+	// Input and output both bypass the page cache
+	bool directIO = false;
+	bool ioUring = false;
+
+	double gigabytesPerSecond() const {
+		return seconds > 0.0 ? bytes / seconds / 1e9 : 0.0;
+	}
+};
+
+/*
+	Streams a binary file through a kernel in fixed size chunks and writes the results to another file.
+	A reader thread fills the mapped staging buffer of a slot straight from disk (O_DIRECT when the file system
+	allows it, io_uring when built with liburing), the calling thread records upload, dispatch and readback for it,
+	and a writer thread waits for the slot's fence and writes it out, so disk reads, PCIe transfers, compute
+	and disk writes of different chunks run at the same time.
+	The kernel has one binding updated in place, a push constant of at least 4 bytes receives the chunk's element count.
+*/
+class FileStream
+{
+	enum SlotState{
+		SLOT_FREE,
+		SLOT_READY,
+		SLOT_SUBMITTED
+	};
+
+	struct Slot
+	{
+		DeviceMemoryBlock hostMemory, deviceMemory;
+		char* mapped;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		SlotState state = SLOT_FREE;
+		// Valid bytes of the current chunk
+		size_t bytes;
+		uint64_t chunk;
+	};
+
+	ComputeManager* manager;
+	ComputeKernel* kernel;
+	VkCommandPool commandPool;
+	VkDescriptorPool descriptorPool;
+	std::vector<Slot> slots;
+	std::vector<VkDescriptorSet> descriptorSets;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::atomic<bool> failed{ false };
+
+#ifdef VKHPC_LIBURING
+	struct io_uring readRing, writeRing;
+	bool ringsReady = false;
+#endif
+
+	static double since(std::chrono::steady_clock::time_point start){
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void waitFor(Slot& slot, SlotState state){
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [&] { return slot.state == state || failed; });
+	}
+
+	void setState(Slot& slot, SlotState state){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slot.state = state;
+		}
+		condition.notify_all();
+	}
+
+	void fail(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			failed = true;
+		}
+		condition.notify_all();
+	}
+
+	// Full transfer of size bytes at offset, short only at the end of the file
+	ssize_t transfer(int fd, char* data, size_t size, off_t offset, bool write){
+		size_t done = 0;
+		while (done < size) {
+			ssize_t result;
+#ifdef VKHPC_LIBURING
+			if (ringsReady) {
+				struct io_uring* ring = write ? &writeRing : &readRing;
+				struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+				if (write) {
+					io_uring_prep_write(sqe, fd, data + done, size - done, offset + done);
+				}
+				else {
+					io_uring_prep_read(sqe, fd, data + done, size - done, offset + done);
+				}
+				io_uring_submit(ring);
+				struct io_uring_cqe* cqe;
+				io_uring_wait_cqe(ring, &cqe);
+				result = cqe->res < 0 ? (errno = -cqe->res, -1) : cqe->res;
+				io_uring_cqe_seen(ring, cqe);
+			}
+			else
+#endif
+			{
+				result = write ? pwrite(fd, data + done, size - done, offset + done) : pread(fd, data + done, size - done, offset + done);
+			}
+			if (result < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			bool shortRead = !write && static_cast<size_t>(result) < size - done;
+			done += result;
+			// End of file, reading on would also leave the O_DIRECT alignment
+			if (result == 0 || shortRead) {
+				break;
+			}
+		}
+		return static_cast<ssize_t>(done);
+	}
+
+	void readerLoop(int fd, uint64_t chunkCount, StreamStats* stats){
+		for (uint64_t c = 0; c < chunkCount; c++) {
+			Slot& slot = slots[c % slots.size()];
+			waitFor(slot, SLOT_FREE);
+			if (failed) {
+				return;
+			}
+			auto start = std::chrono::steady_clock::now();
+			// O_DIRECT needs aligned sizes, the chunk size is aligned and the file end reads short
+			ssize_t bytes = transfer(fd, slot.mapped, chunkSize, static_cast<off_t>(c * chunkSize), false);
+			stats->readSeconds += since(start);
+			if (bytes <= 0) {
+				std::cerr << "Error: could not read input chunk " << c << "\n";
+				fail();
+				return;
+			}
+			VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+			mappedRange.memory = slot.hostMemory.memory;
+			mappedRange.size = VK_WHOLE_SIZE;
+			vkFlushMappedMemoryRanges(manager->device, 1, &mappedRange);
+			slot.bytes = static_cast<size_t>(bytes);
+			slot.chunk = c;
+			setState(slot, SLOT_READY);
+		}
+	}
+
+	// direct: fd was opened with O_DIRECT
+	void writerLoop(int fd, bool direct, uint64_t chunkCount, StreamStats* stats){
+		for (uint64_t c = 0; c < chunkCount; c++) {
+			Slot& slot = slots[c % slots.size()];
+			waitFor(slot, SLOT_SUBMITTED);
+			if (failed) {
+				return;
+			}
+			{
+				MetricTimer timer(METRIC_FENCE_WAIT_TIME);
+				uint64_t waitStart = JobTrace::instance().mark();
+				VK_CHECK_RESULT(vkWaitForFences(manager->device, 1, &slot.fence, VK_TRUE, UINT64_MAX));
+				if (JobTrace::instance().enabled()) {
+					JobTrace::instance().wait(waitStart);
+				}
+			}
+			VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+			mappedRange.memory = slot.hostMemory.memory;
+			mappedRange.size = VK_WHOLE_SIZE;
+			vkInvalidateMappedMemoryRanges(manager->device, 1, &mappedRange);
+			auto start = std::chrono::steady_clock::now();
+			// Whole aligned chunks for O_DIRECT, the file is truncated to the input size afterwards
+			size_t bytes = direct ? (slot.bytes + alignment - 1) / alignment * alignment : slot.bytes;
+			if (transfer(fd, slot.mapped, bytes, static_cast<off_t>(slot.chunk * chunkSize), true) != static_cast<ssize_t>(bytes)) {
+				std::cerr << "Error: could not write output chunk " << c << "\n";
+				fail();
+				return;
+			}
+			stats->writeSeconds += since(start);
+			setState(slot, SLOT_FREE);
+		}
+	}
+
+	void record(Slot& slot, VkDescriptorSet descriptorSet){
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(slot.commandBuffer, &cmdBufInfo));
+		// Rounded up to whole elements, the bytes past the chunk are never written out
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = (slot.bytes + 3) & ~size_t(3);
+		vkCmdCopyBuffer(slot.commandBuffer, slot.hostMemory.buffer, slot.deviceMemory.buffer, 1, &copyRegion);
+
+		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+		bufferBarrier.buffer = slot.deviceMemory.buffer;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+		uint32_t elementCount = static_cast<uint32_t>(copyRegion.size / sizeof(uint32_t));
+		vkCmdBindPipeline(slot.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+		vkCmdBindDescriptorSets(slot.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		if (kernel->pushConstantSize >= sizeof(uint32_t)) {
+			vkCmdPushConstants(slot.commandBuffer, kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &elementCount);
+		}
+		vkCmdDispatch(slot.commandBuffer, (elementCount + localSizeX - 1) / localSizeX, 1, 1);
+		Metrics::instance().count(METRIC_DISPATCHES);
+
+		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+		vkCmdCopyBuffer(slot.commandBuffer, slot.deviceMemory.buffer, slot.hostMemory.buffer, 1, &copyRegion);
+
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		VK_CHECK_RESULT(vkEndCommandBuffer(slot.commandBuffer));
+		Metrics::instance().count(METRIC_BYTES_STAGED, 2 * copyRegion.size);
+	}
+
+	// O_DIRECT needs every mapped staging pointer aligned to the I/O alignment
+	bool directIOPossible() const {
+		for (const Slot& slot : slots) {
+			if (reinterpret_cast<uintptr_t>(slot.mapped) % alignment != 0) {
+				return false;
+			}
+		}
+		return chunkSize % alignment == 0;
+	}
+
+	int openFile(const std::string& path, int flags, bool* direct){
+		if (*direct) {
+			int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+			if (fd >= 0) {
+				return fd;
+			}
+			// tmpfs and some network file systems refuse O_DIRECT
+			*direct = false;
+		}
+		return open(path.c_str(), flags, 0644);
+	}
+
+public:
+	size_t chunkSize;
+	uint32_t localSizeX;
+	// Try O_DIRECT, falls back to the page cache if the file system or the mapping alignment do not allow it
+	bool directIO = true;
+	size_t alignment = 4096;
+
+	VkResult run(const std::string& inputPath, const std::string& outputPath, StreamStats* stats){
+		*stats = StreamStats();
+		failed = false;
+		for (Slot& slot : slots) {
+			slot.state = SLOT_FREE;
+		}
+		bool direct = directIO && directIOPossible();
+		bool outputDirect = direct;
+		int input = openFile(inputPath, O_RDONLY, &direct);
+		if (input < 0) {
+			std::cerr << "Error: could not open " << inputPath << "\n";
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+		int output = openFile(outputPath, O_WRONLY | O_CREAT | O_TRUNC, &outputDirect);
+		if (output < 0) {
+			std::cerr << "Error: could not open " << outputPath << "\n";
+			close(input);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+		// Each side falls back on its own, only an O_DIRECT output pads its writes and is truncated afterwards
+		struct stat inputStat;
+		fstat(input, &inputStat);
+		uint64_t fileSize = static_cast<uint64_t>(inputStat.st_size);
+		uint64_t chunkCount = (fileSize + chunkSize - 1) / chunkSize;
+		stats->directIO = direct && outputDirect;
+#ifdef VKHPC_LIBURING
+		stats->ioUring = ringsReady;
+#endif
+
+		auto start = std::chrono::steady_clock::now();
+		std::thread reader(&FileStream::readerLoop, this, input, chunkCount, stats);
+		std::thread writer(&FileStream::writerLoop, this, output, outputDirect, chunkCount, stats);
+		for (uint64_t c = 0; c < chunkCount; c++) {
+			size_t index = c % slots.size();
+			Slot& slot = slots[index];
+			waitFor(slot, SLOT_READY);
+			if (failed) {
+				break;
+			}
+			auto gpuStart = std::chrono::steady_clock::now();
+			uint64_t traceStart = JobTrace::instance().mark();
+			VK_CHECK_RESULT(vkResetFences(manager->device, 1, &slot.fence));
+			record(slot, descriptorSets[index]);
+			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &slot.commandBuffer;
+			VK_CHECK_RESULT(manager->submitter.submit(1, &submitInfo, slot.fence));
+			stats->gpuSeconds += since(gpuStart);
+			if (JobTrace::instance().enabled()) {
+				// The writer thread records the wait, the upload and readback in the submission are not recorded separately
+				uint32_t elementCount = static_cast<uint32_t>(((slot.bytes + 3) & ~size_t(3)) / sizeof(uint32_t));
+				JobTrace::instance().submit(kernel, { &slot.deviceMemory }, (elementCount + localSizeX - 1) / localSizeX, 1, 1, &elementCount, sizeof(elementCount), traceStart);
+			}
+			setState(slot, SLOT_SUBMITTED);
+		}
+		reader.join();
+		writer.join();
+		if (!failed && outputDirect && ftruncate(output, static_cast<off_t>(fileSize)) != 0) {
+			fail();
+		}
+		close(input);
+		close(output);
+		stats->seconds = since(start);
+		stats->bytes = fileSize;
+		stats->chunks = static_cast<uint32_t>(chunkCount);
+		return failed ? VK_ERROR_UNKNOWN : VK_SUCCESS;
+	}
+
+	FileStream(ComputeManager* manager, ComputeKernel* kernel, size_t chunkSize, uint32_t slotCount = 3, uint32_t localSizeX = 1)
+		: manager(manager), kernel(kernel), slots(slotCount), chunkSize(chunkSize), localSizeX(localSizeX)
+	{
+		assert(kernel->bindingCount == 1 && chunkSize % sizeof(uint32_t) == 0);
+		VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+		cmdPoolInfo.queueFamilyIndex = manager->queueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(manager->device, &cmdPoolInfo, nullptr, &commandPool));
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, slotCount),
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, slotCount);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &descriptorPool));
+
+		descriptorSets.resize(slotCount);
+		for (uint32_t i = 0; i < slotCount; i++) {
+			Slot& slot = slots[i];
+			slot.hostMemory.size = chunkSize;
+			slot.deviceMemory.size = chunkSize;
+			VK_CHECK_RESULT(manager->createBuffer(CPU_BUFFER, &slot.hostMemory));
+			VK_CHECK_RESULT(manager->createBuffer(GPU_BUFFER, &slot.deviceMemory));
+			void* mapped;
+			VK_CHECK_RESULT(vkMapMemory(manager->device, slot.hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+			slot.mapped = static_cast<char*>(mapped);
+
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &slot.commandBuffer));
+			VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+			VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &slot.fence));
+
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &kernel->descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSets[i]));
+			VkDescriptorBufferInfo bufferDescriptor = slot.deviceMemory.descriptor();
+			VkWriteDescriptorSet writeDescriptorSet = vks::initializers::writeDescriptorSet(descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferDescriptor);
+			vkUpdateDescriptorSets(manager->device, 1, &writeDescriptorSet, 0, nullptr);
+		}
+#ifdef VKHPC_LIBURING
+		ringsReady = io_uring_queue_init(4, &readRing, 0) == 0;
+		if (ringsReady && io_uring_queue_init(4, &writeRing, 0) != 0) {
+			io_uring_queue_exit(&readRing);
+			ringsReady = false;
+		}
+#endif
+	}
+
+	~FileStream()
+	{
+#ifdef VKHPC_LIBURING
+		if (ringsReady) {
+			io_uring_queue_exit(&readRing);
+			io_uring_queue_exit(&writeRing);
+		}
+#endif
+		for (Slot& slot : slots) {
+			vkDestroyFence(manager->device, slot.fence, nullptr);
+			vkUnmapMemory(manager->device, slot.hostMemory.memory);
+			manager->clean(&slot.deviceMemory);
+			manager->clean(&slot.hostMemory);
+		}
+		vkDestroyDescriptorPool(manager->device, descriptorPool, nullptr);
+		vkDestroyCommandPool(manager->device, commandPool, nullptr);
+	}
+};
@@ -0,0 +1,491 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "KernelChain.hpp"
+
+#ifndef GLSLANG_VALIDATOR
+#define GLSLANG_VALIDATOR "glslangValidator"
+#endif
+
+/*
+	Elementwise expressions over float buffers, e.g. fused::where(a > b, a * b + c, fused::map(c, "exp")).
+	Building an expression only records its structure, FusedKernels turns it into one compute kernel
+	so intermediates stay in registers and the whole expression is a single dispatch.
+*/
+namespace fused {
+
+// Collects bindings, push constant scalars and helper functions while an expression emits GLSL
+struct EmitContext
+{
+	std::vector<DeviceMemoryBlock*> buffers;
+	std::vector<float> scalars;
+	std::vector<std::string> functions;
+
+	uint32_t binding(DeviceMemoryBlock* block){
+		for (uint32_t i = 0; i < buffers.size(); i++) {
+			if (buffers[i] == block) {
+				return i;
+			}
+		}
+		buffers.push_back(block);
+		return static_cast<uint32_t>(buffers.size() - 1);
+	}
+
+	uint32_t scalar(float value){
+		scalars.push_back(value);
+		return static_cast<uint32_t>(scalars.size() - 1);
+	}
+
+	void function(const std::string& definition){
+		for (const std::string& existing : functions) {
+			if (existing == definition) {
+				return;
+			}
+		}
+		functions.push_back(definition);
+	}
+};
+
+// Base of all expression nodes, Derived::emit appends GLSL for element i
+template<typename Derived>
+struct Expression
+{
+	const Derived& self() const {
+		return static_cast<const Derived&>(*this);
+	}
+};
+
+template<typename T>
+constexpr bool isExpression = std::is_base_of_v<Expression<T>, T>;
+
+// Element i of a float buffer
+struct Buffer : Expression<Buffer>
+{
+	DeviceMemoryBlock* block;
+
+	explicit Buffer(DeviceMemoryBlock* block) : block(block) {}
+
+	void emit(EmitContext& context, std::string& out) const {
+		out += "b" + std::to_string(context.binding(block)) + ".v[i]";
+	}
+};
+
+// Scalars are push constants, so expressions that only differ in constants share a kernel
+struct Scalar : Expression<Scalar>
+{
+	float value;
+
+	explicit Scalar(float value) : value(value) {}
+
+	void emit(EmitContext& context, std::string& out) const {
+		out += "s[" + std::to_string(context.scalar(value)) + "]";
+	}
+};
+
+// Infix operators and comparisons, op is the GLSL token
+template<typename L, typename R>
+struct Binary : Expression<Binary<L, R>>
+{
+	const char* op;
+	L left;
+	R right;
+
+	Binary(const char* op, const L& left, const R& right) : op(op), left(left), right(right) {}
+
+	void emit(EmitContext& context, std::string& out) const {
+		out += "(";
+		left.emit(context, out);
+		out += " ";
+		out += op;
+		out += " ";
+		right.emit(context, out);
+		out += ")";
+	}
+};
+
+// GLSL functions of two arguments (min, max, pow, ...)
+template<typename L, typename R>
+struct Call2 : Expression<Call2<L, R>>
+{
+	std::string name;
+	L left;
+	R right;
+
+	Call2(const std::string& name, const L& left, const R& right) : name(name), left(left), right(right) {}
+
+	void emit(EmitContext& context, std::string& out) const {
+		out += name + "(";
+		left.emit(context, out);
+		out += ", ";
+		right.emit(context, out);
+		out += ")";
+	}
+};
+
+// A GLSL built-in of one float, or a user function float name(float x) { body }
+template<typename E>
+struct Map : Expression<Map<E>>
+{
+	std::string name;
+	std::string body;
+	E argument;
+
+	Map(const std::string& name, const std::string& body, const E& argument) : name(name), body(body), argument(argument) {}
+
+	void emit(EmitContext& context, std::string& out) const {
+		if (!body.empty()) {
+			context.function("float " + name + "(float x)\n{\n\t" + body + "\n}\n");
+		}
+		out += name + "(";
+		argument.emit(context, out);
+		out += ")";
+	}
+};
+
+template<typename C, typename T, typename F>
+struct Where : Expression<Where<C, T, F>>
+{
+	C condition;
+	T whenTrue;
+	F whenFalse;
+
+	Where(const C& condition, const T& whenTrue, const F& whenFalse) : condition(condition), whenTrue(whenTrue), whenFalse(whenFalse) {}
+
+	void emit(EmitContext& context, std::string& out) const {
+		out += "(";
+		condition.emit(context, out);
+		out += " ? ";
+		whenTrue.emit(context, out);
+		out += " : ";
+		whenFalse.emit(context, out);
+		out += ")";
+	}
+};
+
+// Lets float literals appear on either side of an operator
+template<typename T>
+auto operand(const T& value){
+	if constexpr (isExpression<T>) {
+		return value;
+	}
+	else {
+		return Scalar(static_cast<float>(value));
+	}
+}
+
+template<typename L, typename R>
+constexpr bool isOperandPair = (isExpression<L> && (isExpression<R> || std::is_arithmetic_v<R>)) || (std::is_arithmetic_v<L> && isExpression<R>);
+
+#define FUSED_BINARY_OPERATOR(symbol)																	\
+template<typename L, typename R, std::enable_if_t<isOperandPair<L, R>, int> = 0>						\
+auto operator symbol(const L& left, const R& right){													\
+	return Binary<decltype(operand(left)), decltype(operand(right))>(#symbol, operand(left), operand(right));	\
+}
+
+FUSED_BINARY_OPERATOR(+)
+FUSED_BINARY_OPERATOR(-)
+FUSED_BINARY_OPERATOR(*)
+FUSED_BINARY_OPERATOR(/)
+FUSED_BINARY_OPERATOR(<)
+FUSED_BINARY_OPERATOR(>)
+FUSED_BINARY_OPERATOR(<=)
+FUSED_BINARY_OPERATOR(>=)
+FUSED_BINARY_OPERATOR(==)
+FUSED_BINARY_OPERATOR(!=)
+FUSED_BINARY_OPERATOR(&&)
+FUSED_BINARY_OPERATOR(||)
+
+#undef FUSED_BINARY_OPERATOR
+
+template<typename E, std::enable_if_t<isExpression<E>, int> = 0>
+auto operator-(const E& argument){
+	return Map<E>("-", "", argument);
+}
+
+template<typename L, typename R, std::enable_if_t<isOperandPair<L, R>, int> = 0>
+auto min(const L& left, const R& right){
+	return Call2<decltype(operand(left)), decltype(operand(right))>("min", operand(left), operand(right));
+}
+
+template<typename L, typename R, std::enable_if_t<isOperandPair<L, R>, int> = 0>
+auto max(const L& left, const R& right){
+	return Call2<decltype(operand(left)), decltype(operand(right))>("max", operand(left), operand(right));
+}
+
+template<typename L, typename R, std::enable_if_t<isOperandPair<L, R>, int> = 0>
+auto pow(const L& left, const R& right){
+	return Call2<decltype(operand(left)), decltype(operand(right))>("pow", operand(left), operand(right));
+}
+
+// map(x, "exp") applies a GLSL built-in, map(x, "relu", "return max(x, 0.0);") defines a helper
+template<typename E>
+auto map(const E& argument, const std::string& name, const std::string& body = ""){
+	return Map<decltype(operand(argument))>(name, body, operand(argument));
+}
+
+template<typename C, typename T, typename F>
+auto where(const C& condition, const T& whenTrue, const F& whenFalse){
+	return Where<decltype(operand(condition)), decltype(operand(whenTrue)), decltype(operand(whenFalse))>(operand(condition), operand(whenTrue), operand(whenFalse));
+}
+
+}
+
+/*
+	Compiles fused expressions to kernels and evaluates them into an output buffer.
+	Kernels are cached by the generated source in memory and by its hash as SPIR-V files in cacheDirectory,
+	so only the first evaluation of an expression shape pays for glslangValidator.
+	The cached SPIR-V is loaded as is, so the directory has to be private to the user.
+*/
+class FusedKernels
+{
+	ComputeManager* manager;
+	std::mutex mutex;
+	std::condition_variable compiled;
+	// Keyed by the full source, entries are never replaced so handed out kernels stay valid
+	std::unordered_map<std::string, ComputeKernel> kernels;
+	// Sources a thread is compiling right now, others asking for them wait instead of compiling twice
+	std::unordered_set<std::string> compiling;
+
+	// FNV-1a, stable across runs so it can name files
+	static uint64_t hash(const std::string& text){
+		uint64_t value = 14695981039346656037ull;
+		for (unsigned char c : text) {
+			value = (value ^ c) * 1099511628211ull;
+		}
+		return value;
+	}
+
+	// $XDG_CACHE_HOME/vkhpc-fused, ~/.cache/vkhpc-fused without it, %LOCALAPPDATA%\vkhpc-fused on Windows
+	static std::string defaultCacheDirectory(){
+#ifdef _WIN32
+		const char* base = getenv("LOCALAPPDATA");
+		if (base && *base) {
+			return (std::filesystem::path(base) / "vkhpc-fused").string();
+		}
+		return (std::filesystem::temp_directory_path() / "vkhpc-fused").string();
+#else
+		const char* base = getenv("XDG_CACHE_HOME");
+		if (base && base[0] == '/') {
+			return (std::filesystem::path(base) / "vkhpc-fused").string();
+		}
+		const char* home = getenv("HOME");
+		if (home && home[0] == '/') {
+			return (std::filesystem::path(home) / ".cache" / "vkhpc-fused").string();
+		}
+		return (std::filesystem::temp_directory_path() / ("vkhpc-fused-" + std::to_string(geteuid()))).string();
+#endif
+	}
+
+	// Creates the cache directory with mode 0700, refuses one that is a symlink, owned by another user or writable by others
+	static bool privateDirectory(const std::filesystem::path& directory){
+		std::error_code error;
+		std::filesystem::create_directories(directory.parent_path(), error);
+#ifdef _WIN32
+		std::filesystem::create_directories(directory, error);
+		return std::filesystem::is_directory(directory, error);
+#else
+		mkdir(directory.c_str(), 0700);
+		struct stat status;
+		if (lstat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)
+			|| status.st_uid != geteuid() || (status.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+			std::cerr << "Error: fused kernel cache " << directory << " is not a directory private to this user\n";
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	std::string generate(const std::string& expression, const fused::EmitContext& context){
+		std::ostringstream source;
+		source << "#version 450\n\n";
+		source << "layout (local_size_x = " << localSizeX << ", local_size_y = 1, local_size_z = 1) in;\n\n";
+		source << "layout(binding = 0) buffer B0 {\n\tfloat v[ ];\n} b0;\n";
+		for (size_t i = 1; i < context.buffers.size(); i++) {
+			source << "layout(binding = " << i << ") readonly buffer B" << i << " {\n\tfloat v[ ];\n} b" << i << ";\n";
+		}
+		source << "\nlayout(push_constant) uniform PushConstants {\n\tuint elementCount;\n";
+		if (!context.scalars.empty()) {
+			source << "\tfloat s[" << context.scalars.size() << "];\n";
+		}
+		source << "};\n\n";
+		for (const std::string& function : context.functions) {
+			source << function << "\n";
+		}
+		source << "void main()\n{\n\tuint i = gl_GlobalInvocationID.x;\n\tif (i >= elementCount)\n\t\treturn;\n";
+		source << "\tb0.v[i] = " << expression << ";\n}\n";
+		return source.str();
+	}
+
+	// Reads <hash>.spv from the cache directory, running the compiler first if it is missing
+	VkResult compile(const std::string& source, uint64_t key, std::vector<uint32_t>& code){
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+		std::filesystem::path directory(cacheDirectory);
+		if (!privateDirectory(directory)) {
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+		std::error_code error;
+		std::filesystem::path sourcePath = directory / (std::string(name) + ".comp");
+		std::filesystem::path spirvPath = directory / (std::string(name) + ".spv");
+
+		// The source next to the SPIR-V guards against hash collisions
+		std::ifstream cachedSource(sourcePath, std::ios::binary);
+		std::string cached((std::istreambuf_iterator<char>(cachedSource)), std::istreambuf_iterator<char>());
+		if (cached != source || !std::filesystem::exists(spirvPath)) {
+			// Other processes may compile the same shape, both files appear under their names only once complete,
+			// the SPIR-V first so a matching source always comes with a whole module
+#ifdef _WIN32
+			std::string suffix = ".tmp" + std::to_string(_getpid());
+#else
+			std::string suffix = ".tmp" + std::to_string(getpid());
+#endif
+			std::filesystem::path temporarySource = sourcePath.string() + suffix;
+			std::filesystem::path temporarySpirv = spirvPath.string() + suffix;
+			std::ofstream(temporarySource, std::ios::binary) << source;
+			std::string command = std::string("\"") + compilerPath + "\" -V --target-env vulkan1.3 \"" + temporarySource.string() + "\" -o \"" + temporarySpirv.string() + "\"";
+			if (!verbose) {
+#ifdef _WIN32
+				command += " > NUL";
+#else
+				command += " > /dev/null";
+#endif
+			}
+			MetricTimer timer(METRIC_PIPELINE_COMPILE_TIME);
+			if (std::system(command.c_str()) != 0) {
+				std::cerr << "Error: could not compile fused kernel " << sourcePath << "\n";
+				std::filesystem::remove(temporarySource, error);
+				std::filesystem::remove(temporarySpirv, error);
+				return VK_ERROR_INITIALIZATION_FAILED;
+			}
+			std::filesystem::rename(temporarySpirv, spirvPath, error);
+			if (!error) {
+				std::filesystem::rename(temporarySource, sourcePath, error);
+			}
+			if (error) {
+				std::cerr << "Error: could not store fused kernel " << spirvPath << ": " << error.message() << "\n";
+				std::filesystem::remove(temporarySource, error);
+				std::filesystem::remove(temporarySpirv, error);
+				return VK_ERROR_INITIALIZATION_FAILED;
+			}
+		}
+
+		std::ifstream spirv(spirvPath, std::ios::binary | std::ios::ate);
+		size_t size = spirv.tellg();
+		if (!spirv.is_open() || size == 0 || size % 4 != 0) {
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+		code.resize(size / 4);
+		spirv.seekg(0, std::ios::beg);
+		spirv.read(reinterpret_cast<char*>(code.data()), size);
+		return VK_SUCCESS;
+	}
+
+	template<typename E>
+	VkResult prepare(DeviceMemoryBlock* output, const fused::Expression<E>& expression, ComputeKernel** kernel, fused::EmitContext& context){
+		// The output is binding 0, inputs that alias it read from the same binding
+		context.binding(output);
+		std::string text;
+		expression.self().emit(context, text);
+		// Push constants are limited to 128 bytes on many devices
+		assert(1 + context.scalars.size() <= 32 && context.buffers.size() <= maxBindings);
+		std::string source = generate(text, context);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			auto it = kernels.find(source);
+			if (it != kernels.end()) {
+				*kernel = &it->second;
+				return VK_SUCCESS;
+			}
+			if (compiling.count(source) == 0) {
+				break;
+			}
+			compiled.wait(lock);
+		}
+		compiling.insert(source);
+		lock.unlock();
+
+		// The compiler runs outside the lock, lookups of other shapes go on meanwhile
+		std::vector<uint32_t> code;
+		ComputeKernel compiledKernel;
+		VkResult result = compile(source, hash(source), code);
+		if (result == VK_SUCCESS) {
+			VkShaderModule shaderModule = createShaderModule(code.data(), code.size() * sizeof(uint32_t), manager->device);
+			uint32_t pushConstantSize = static_cast<uint32_t>((1 + context.scalars.size()) * sizeof(uint32_t));
+			result = manager->createKernel(shaderModule, static_cast<uint32_t>(context.buffers.size()), &compiledKernel, pushConstantSize);
+		}
+
+		lock.lock();
+		compiling.erase(source);
+		if (result == VK_SUCCESS) {
+			*kernel = &kernels.emplace(source, compiledKernel).first->second;
+		}
+		compiled.notify_all();
+		return result;
+	}
+
+public:
+	std::string compilerPath = GLSLANG_VALIDATOR;
+	std::string cacheDirectory = defaultCacheDirectory();
+	uint32_t localSizeX = 256;
+	// Distinct buffers one expression may reference, output included
+	uint32_t maxBindings = 16;
+	bool verbose = false;
+
+	// Records output[i] = expression(i) for i < elementCount into chain, expression buffers must hold elementCount floats
+	template<typename E>
+	VkResult enqueue(KernelChain& chain, DeviceMemoryBlock* output, uint32_t elementCount, const fused::Expression<E>& expression){
+		fused::EmitContext context;
+		ComputeKernel* kernel;
+		VkResult result = prepare(output, expression, &kernel, context);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		std::vector<uint32_t> pushConstants(1 + context.scalars.size());
+		pushConstants[0] = elementCount;
+		memcpy(pushConstants.data() + 1, context.scalars.data(), context.scalars.size() * sizeof(float));
+		chain.dispatch(kernel, context.buffers, (elementCount + localSizeX - 1) / localSizeX, 1, 1, pushConstants.data());
+		return VK_SUCCESS;
+	}
+
+	// One submission computing output[i] = expression(i), waits for completion
+	template<typename E>
+	VkResult evaluate(DeviceMemoryBlock* output, uint32_t elementCount, const fused::Expression<E>& expression){
+		KernelChain chain(manager, 1, maxBindings);
+		VkResult result = enqueue(chain, output, elementCount, expression);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		return chain.run();
+	}
+
+	size_t cachedKernelCount(){
+		std::lock_guard<std::mutex> lock(mutex);
+		return kernels.size();
+	}
+
+	FusedKernels(ComputeManager* manager) : manager(manager) {}
+
+	~FusedKernels()
+	{
+		for (auto& entry : kernels) {
+			manager->destroyKernel(&entry.second);
+		}
+	}
+};
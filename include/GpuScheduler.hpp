@@ -0,0 +1,476 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "ComputeManager.hpp"
+
+class GpuScheduler;
+
+/*
+	Coroutine run by a GpuScheduler. Started with GpuScheduler::spawn(), the frame frees itself when the body returns.
+*/
+class GpuTask
+{
+public:
+	struct promise_type
+	{
+		GpuScheduler* scheduler = nullptr;
+
+		GpuTask get_return_object() { return GpuTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept;
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+/*
+	Result of an upload, dispatch or readback. The work is already submitted when the awaiter is returned,
+	so several operations can be issued before awaiting; co_await yields the VkResult of the submission.
+*/
+class GpuAwaiter
+{
+	friend class GpuScheduler;
+
+	GpuScheduler* scheduler;
+	uint64_t value;
+	VkResult result;
+	// Readbacks copy into user memory on resumption
+	DeviceMemoryBlock* hostMemory = nullptr;
+	void* data = nullptr;
+	VkDeviceSize readSize = 0;
+
+public:
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> handle);
+	VkResult await_resume();
+};
+
+/*
+	Runs GpuTask coroutines on a few worker threads. GPU operations signal one timeline semaphore,
+	a completion thread waits on it with vkWaitSemaphores and hands coroutines whose value is reached back to the workers,
+	so thousands of jobs can interleave their CPU stages with GPU work without a thread each.
+	Requires the timelineSemaphore feature, awaitables may only be created from inside a task.
+*/
+class GpuScheduler
+{
+	friend class GpuTask;
+	friend class GpuAwaiter;
+
+	struct InFlight
+	{
+		uint64_t value;
+		VkCommandBuffer commandBuffer;
+		VkDescriptorSet descriptorSet;
+	};
+
+	// Command buffers and descriptor sets of one worker, recycled once their value is reached
+	struct WorkerContext
+	{
+		VkCommandPool commandPool;
+		VkDescriptorPool descriptorPool;
+		std::deque<InFlight> inFlight;
+		std::vector<VkCommandBuffer> freeCommandBuffers;
+	};
+
+	struct Parked
+	{
+		uint64_t value;
+		std::coroutine_handle<> handle;
+		bool operator>(const Parked& other) const { return value > other.value; }
+	};
+
+	static inline thread_local WorkerContext* currentContext = nullptr;
+
+	ComputeManager* manager;
+	VkSemaphore timeline;
+	std::atomic<uint64_t> completedValue{ 0 };
+	// Values must reach the queue in increasing order, so allocation and submission happen under one lock
+	std::mutex submitMutex;
+	uint64_t lastValue = 0;
+
+	std::mutex parkedMutex;
+	std::condition_variable parkedCondition;
+	std::priority_queue<Parked, std::vector<Parked>, std::greater<Parked>> parked;
+	std::thread completionThread;
+
+	std::mutex readyMutex;
+	std::condition_variable readyCondition;
+	std::deque<std::coroutine_handle<>> ready;
+	std::vector<std::thread> workers;
+	std::vector<WorkerContext*> contexts;
+
+	std::atomic<uint32_t> activeTasks{ 0 };
+	std::mutex idleMutex;
+	std::condition_variable idleCondition;
+	bool stopping = false;
+
+	void makeReady(std::coroutine_handle<> handle){
+		{
+			std::lock_guard<std::mutex> lock(readyMutex);
+			ready.push_back(handle);
+		}
+		readyCondition.notify_one();
+	}
+
+	void park(uint64_t value, std::coroutine_handle<> handle){
+		{
+			std::lock_guard<std::mutex> lock(parkedMutex);
+			parked.push({ value, handle });
+		}
+		parkedCondition.notify_one();
+	}
+
+	void finished(){
+		if (activeTasks.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> lock(idleMutex);
+			idleCondition.notify_all();
+		}
+	}
+
+	void completionLoop(){
+		while (true) {
+			uint64_t target;
+			{
+				std::unique_lock<std::mutex> lock(parkedMutex);
+				parkedCondition.wait(lock, [this] { return stopping || !parked.empty(); });
+				if (parked.empty()) {
+					return;
+				}
+				target = parked.top().value;
+			}
+			// Short timeout, a coroutine waiting for an earlier value may be parked meanwhile
+			VkSemaphoreWaitInfo waitInfo = {};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &timeline;
+			waitInfo.pValues = &target;
+			vkWaitSemaphores(manager->device, &waitInfo, 1000000);
+			uint64_t value;
+			VK_CHECK_RESULT(vkGetSemaphoreCounterValue(manager->device, timeline, &value));
+			completedValue.store(value, std::memory_order_release);
+
+			std::lock_guard<std::mutex> lock(parkedMutex);
+			while (!parked.empty() && parked.top().value <= value) {
+				makeReady(parked.top().handle);
+				parked.pop();
+			}
+		}
+	}
+
+	void workerLoop(WorkerContext* context){
+		currentContext = context;
+		while (true) {
+			std::coroutine_handle<> handle;
+			{
+				std::unique_lock<std::mutex> lock(readyMutex);
+				readyCondition.wait(lock, [this] { return stopping || !ready.empty(); });
+				if (ready.empty()) {
+					break;
+				}
+				handle = ready.front();
+				ready.pop_front();
+			}
+			handle.resume();
+		}
+		currentContext = nullptr;
+	}
+
+	// Recycles everything of the worker the GPU is done with, waits for the oldest submission when block is set
+	void retire(WorkerContext* context, bool block){
+		if (block && !context->inFlight.empty()) {
+			uint64_t value = context->inFlight.front().value;
+			VkSemaphoreWaitInfo waitInfo = {};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &timeline;
+			waitInfo.pValues = &value;
+			uint64_t waitStart = JobTrace::instance().mark();
+			VK_CHECK_RESULT(vkWaitSemaphores(manager->device, &waitInfo, UINT64_MAX));
+			if (JobTrace::instance().enabled()) {
+				JobTrace::instance().wait(waitStart);
+			}
+		}
+		uint64_t value;
+		VK_CHECK_RESULT(vkGetSemaphoreCounterValue(manager->device, timeline, &value));
+		while (!context->inFlight.empty() && context->inFlight.front().value <= value) {
+			InFlight& done = context->inFlight.front();
+			context->freeCommandBuffers.push_back(done.commandBuffer);
+			if (done.descriptorSet != VK_NULL_HANDLE) {
+				vkFreeDescriptorSets(manager->device, context->descriptorPool, 1, &done.descriptorSet);
+			}
+			context->inFlight.pop_front();
+		}
+	}
+
+	VkCommandBuffer begin(WorkerContext* context){
+		if (context->freeCommandBuffers.empty()) {
+			retire(context, context->inFlight.size() >= maxInFlightPerWorker);
+		}
+		VkCommandBuffer commandBuffer;
+		if (!context->freeCommandBuffers.empty()) {
+			commandBuffer = context->freeCommandBuffers.back();
+			context->freeCommandBuffers.pop_back();
+			VK_CHECK_RESULT(vkResetCommandBuffer(commandBuffer, 0));
+		}
+		else {
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+				vks::initializers::commandBufferAllocateInfo(context->commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &commandBuffer));
+		}
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+
+		// Earlier submissions of any task may have written what this one reads
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_FLAGS_NONE,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+		return commandBuffer;
+	}
+
+	GpuAwaiter submit(WorkerContext* context, VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet){
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		GpuAwaiter awaiter;
+		awaiter.scheduler = this;
+		std::lock_guard<std::mutex> lock(submitMutex);
+		awaiter.value = lastValue + 1;
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &awaiter.value;
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &timeline;
+		awaiter.result = manager->submitter.submit(1, &submitInfo, VK_NULL_HANDLE);
+		if (awaiter.result == VK_SUCCESS) {
+			lastValue = awaiter.value;
+			context->inFlight.push_back({ awaiter.value, commandBuffer, descriptorSet });
+		}
+		else {
+			context->freeCommandBuffers.push_back(commandBuffer);
+			if (descriptorSet != VK_NULL_HANDLE) {
+				vkFreeDescriptorSets(manager->device, context->descriptorPool, 1, &descriptorSet);
+			}
+		}
+		return awaiter;
+	}
+
+	WorkerContext* context(){
+		// Awaitables record into per-worker pools, so they only work inside a task
+		assert(currentContext != nullptr);
+		return currentContext;
+	}
+
+public:
+	// Submissions a worker keeps in flight before it waits for the oldest one, also sizes its descriptor pool
+	uint32_t maxInFlightPerWorker = 256;
+	uint32_t maxBindingsPerKernel = 8;
+
+	// Starts a task, its body runs on a worker thread
+	void spawn(GpuTask task){
+		task.handle.promise().scheduler = this;
+		activeTasks.fetch_add(1);
+		makeReady(task.handle);
+	}
+
+	// Blocks until every spawned task has returned
+	void waitIdle(){
+		std::unique_lock<std::mutex> lock(idleMutex);
+		idleCondition.wait(lock, [this] { return activeTasks.load() == 0; });
+	}
+
+	// Copies size bytes of data through the host visible hostMemory into deviceMemory
+	GpuAwaiter upload(const void* data, VkDeviceSize size, DeviceMemoryBlock* hostMemory, DeviceMemoryBlock* deviceMemory){
+		WorkerContext* worker = context();
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory->memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		memcpy(static_cast<char*>(mapped) + hostMemory->offset, data, size);
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory->memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(manager->device, 1, &mappedRange);
+		vkUnmapMemory(manager->device, hostMemory->memory);
+		Metrics::instance().count(METRIC_BYTES_STAGED, size);
+
+		VkCommandBuffer commandBuffer = begin(worker);
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = hostMemory->offset;
+		copyRegion.dstOffset = deviceMemory->offset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, hostMemory->buffer, deviceMemory->buffer, 1, &copyRegion);
+		return submit(worker, commandBuffer, VK_NULL_HANDLE);
+	}
+
+	GpuAwaiter dispatch(ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1, const void* pushConstants = nullptr){
+		assert(bindings.size() == kernel->bindingCount);
+		uint64_t traceStart = JobTrace::instance().mark();
+		WorkerContext* worker = context();
+		VkCommandBuffer commandBuffer = begin(worker);
+
+		VkDescriptorSetAllocateInfo allocInfo =
+			vks::initializers::descriptorSetAllocateInfo(worker->descriptorPool, &kernel->descriptorSetLayout, 1);
+		VkDescriptorSet descriptorSet;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSet));
+		std::vector<VkDescriptorBufferInfo> bufferDescriptors(bindings.size());
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets(bindings.size());
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bufferDescriptors[i] = bindings[i]->descriptor();
+			writeDescriptorSets[i] = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, i, &bufferDescriptors[i]);
+		}
+		vkUpdateDescriptorSets(manager->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		if (kernel->pushConstantSize > 0) {
+			vkCmdPushConstants(commandBuffer, kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, kernel->pushConstantSize, pushConstants);
+		}
+		vkCmdDispatch(commandBuffer, groupCountX, groupCountY, groupCountZ);
+		Metrics::instance().count(METRIC_DISPATCHES);
+		GpuAwaiter awaiter = submit(worker, commandBuffer, descriptorSet);
+		// Asynchronous, the record covers recording and submission, the coroutine's await is not a blocking wait
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().submit(kernel, bindings, groupCountX, groupCountY, groupCountZ, pushConstants, kernel->pushConstantSize, traceStart);
+		}
+		return awaiter;
+	}
+
+	// Copies size bytes of deviceMemory through hostMemory into data, data is written when the await resumes
+	GpuAwaiter readback(DeviceMemoryBlock* deviceMemory, DeviceMemoryBlock* hostMemory, void* data, VkDeviceSize size){
+		WorkerContext* worker = context();
+		VkCommandBuffer commandBuffer = begin(worker);
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = deviceMemory->offset;
+		copyRegion.dstOffset = hostMemory->offset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, deviceMemory->buffer, hostMemory->buffer, 1, &copyRegion);
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		Metrics::instance().count(METRIC_BYTES_STAGED, size);
+
+		GpuAwaiter awaiter = submit(worker, commandBuffer, VK_NULL_HANDLE);
+		awaiter.hostMemory = hostMemory;
+		awaiter.data = data;
+		awaiter.readSize = size;
+		return awaiter;
+	}
+
+	GpuScheduler(ComputeManager* manager, uint32_t threadCount = 0) : manager(manager)
+	{
+		if (!manager->enabledFeatures12.timelineSemaphore) {
+			std::cerr << "Error: GpuScheduler needs timeline semaphores\n";
+		}
+		assert(manager->enabledFeatures12.timelineSemaphore);
+		VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {};
+		semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		semaphoreTypeInfo.initialValue = 0;
+		VkSemaphoreCreateInfo semaphoreInfo = vks::initializers::semaphoreCreateInfo();
+		semaphoreInfo.pNext = &semaphoreTypeInfo;
+		VK_CHECK_RESULT(vkCreateSemaphore(manager->device, &semaphoreInfo, nullptr, &timeline));
+
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+		}
+		for (uint32_t i = 0; i < threadCount; i++) {
+			WorkerContext* context = new WorkerContext();
+			VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+			cmdPoolInfo.queueFamilyIndex = manager->queueFamilyIndex;
+			cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			VK_CHECK_RESULT(vkCreateCommandPool(manager->device, &cmdPoolInfo, nullptr, &context->commandPool));
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxInFlightPerWorker * maxBindingsPerKernel),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, maxInFlightPerWorker);
+			descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+			VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &context->descriptorPool));
+			contexts.push_back(context);
+		}
+		for (WorkerContext* context : contexts) {
+			workers.emplace_back(&GpuScheduler::workerLoop, this, context);
+		}
+		completionThread = std::thread(&GpuScheduler::completionLoop, this);
+	}
+
+	~GpuScheduler()
+	{
+		waitIdle();
+		{
+			std::lock_guard<std::mutex> readyLock(readyMutex);
+			std::lock_guard<std::mutex> parkedLock(parkedMutex);
+			stopping = true;
+		}
+		readyCondition.notify_all();
+		parkedCondition.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		completionThread.join();
+
+		VkSemaphoreWaitInfo waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &timeline;
+		waitInfo.pValues = &lastValue;
+		vkWaitSemaphores(manager->device, &waitInfo, UINT64_MAX);
+		for (WorkerContext* context : contexts) {
+			vkDestroyDescriptorPool(manager->device, context->descriptorPool, nullptr);
+			vkDestroyCommandPool(manager->device, context->commandPool, nullptr);
+			delete context;
+		}
+		vkDestroySemaphore(manager->device, timeline, nullptr);
+	}
+};
+
+inline std::suspend_never GpuTask::promise_type::final_suspend() noexcept
+{
+	scheduler->finished();
+	return {};
+}
+
+inline bool GpuAwaiter::await_ready()
+{
+	return result != VK_SUCCESS || value <= scheduler->completedValue.load(std::memory_order_acquire);
+}
+
+inline void GpuAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	scheduler->park(value, handle);
+}
+
+inline VkResult GpuAwaiter::await_resume()
+{
+	if (result == VK_SUCCESS && data != nullptr) {
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(scheduler->manager->device, hostMemory->memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory->memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(scheduler->manager->device, 1, &mappedRange);
+		memcpy(data, static_cast<char*>(mapped) + hostMemory->offset, readSize);
+		vkUnmapMemory(scheduler->manager->device, hostMemory->memory);
+	}
+	return result;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "ComputeManager.hpp"
+
+/*
+	A kernel that also has a host implementation. The kernel updates binding 0 in place and reads its element count
+	from a uint push constant, cpu(data, begin, end) does the same for [begin, end) of the mapped host data.
+*/
+struct HeterogeneousKernel
+{
+	ComputeKernel* kernel;
+	uint32_t localSizeX;
+	std::function<void(uint32_t* data, uint32_t begin, uint32_t end)> cpu;
+};
+
+/*
+	Splits one job's index range between the GPU and a host thread pool.
+	The GPU takes [0, split), uploading and reading back only that range, while the pool works on [split, n)
+	directly in the same mapped host buffer, so both halves land in place and nothing is stitched afterwards.
+	The split follows the measured throughput of both sides (elements per second, smoothed over runs),
+	so the two halves finish at about the same time.
+*/
+class HeterogeneousScheduler
+{
+	ComputeManager* manager;
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+	VkFence fence;
+	VkDescriptorPool descriptorPool;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable workCondition, doneCondition;
+	uint64_t generation = 0;
+	uint32_t busyWorkers = 0;
+	bool stopping = false;
+	// Current host job, blocks are claimed through nextBlock
+	const HeterogeneousKernel* cpuKernel;
+	uint32_t* cpuData;
+	uint32_t cpuEnd;
+	std::atomic<uint32_t> nextBlock;
+	// Set by the last worker to finish the current host job
+	std::chrono::steady_clock::time_point cpuFinished;
+
+	void workerLoop(){
+		uint64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				workCondition.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping) {
+					return;
+				}
+				seen = generation;
+			}
+			while (true) {
+				uint32_t begin = nextBlock.fetch_add(cpuBlockSize, std::memory_order_relaxed);
+				if (begin >= cpuEnd) {
+					break;
+				}
+				cpuKernel->cpu(cpuData, begin, std::min(cpuEnd, begin + cpuBlockSize));
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--busyWorkers == 0) {
+					cpuFinished = std::chrono::steady_clock::now();
+				}
+			}
+			doneCondition.notify_all();
+		}
+	}
+
+	// Upload, dispatch and readback of [0, count) in one submission
+	VkResult submitGpu(const HeterogeneousKernel& job, DeviceMemoryBlock* hostMemory, DeviceMemoryBlock* deviceMemory, uint32_t count){
+		VK_CHECK_RESULT(vkResetDescriptorPool(manager->device, descriptorPool, 0));
+		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &job.kernel->descriptorSetLayout, 1);
+		VkDescriptorSet descriptorSet;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSet));
+		VkDescriptorBufferInfo bufferDescriptor = deviceMemory->descriptor();
+		VkWriteDescriptorSet writeDescriptorSet = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferDescriptor);
+		vkUpdateDescriptorSets(manager->device, 1, &writeDescriptorSet, 0, nullptr);
+
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = hostMemory->offset;
+		copyRegion.dstOffset = deviceMemory->offset;
+		copyRegion.size = (VkDeviceSize)count * sizeof(uint32_t);
+		vkCmdCopyBuffer(commandBuffer, hostMemory->buffer, deviceMemory->buffer, 1, &copyRegion);
+
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, job.kernel->pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, job.kernel->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		vkCmdPushConstants(commandBuffer, job.kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &count);
+		vkCmdDispatch(commandBuffer, (count + job.localSizeX - 1) / job.localSizeX, 1, 1);
+		Metrics::instance().count(METRIC_DISPATCHES);
+
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		std::swap(copyRegion.srcOffset, copyRegion.dstOffset);
+		vkCmdCopyBuffer(commandBuffer, deviceMemory->buffer, hostMemory->buffer, 1, &copyRegion);
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+		Metrics::instance().count(METRIC_BYTES_STAGED, 2 * copyRegion.size);
+
+		VK_CHECK_RESULT(vkResetFences(manager->device, 1, &fence));
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		return manager->submitter.submit(1, &submitInfo, fence);
+	}
+
+	static double since(std::chrono::steady_clock::time_point start){
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Exponentially smoothed, the first measurement is taken as is
+	void updateRate(double* rate, uint32_t elements, double seconds){
+		if (elements == 0 || seconds <= 0.0) {
+			return;
+		}
+		double measured = elements / seconds;
+		*rate = *rate == 0.0 ? measured : smoothing * measured + (1.0 - smoothing) * *rate;
+	}
+
+public:
+	// Share of the range the GPU takes in the next run
+	double gpuFraction = 0.5;
+	// Elements per second, 0 until measured
+	double gpuRate = 0.0;
+	double cpuRate = 0.0;
+	// Weight of the newest measurement
+	double smoothing = 0.5;
+	// Neither side drops below this share, so both rates keep being measured
+	double minimumShare = 0.01;
+	// Elements a pool thread claims at a time
+	uint32_t cpuBlockSize = 16384;
+	// Fixes the split, adapt = false with gpuFraction 1 or 0 runs on one side only
+	bool adapt = true;
+
+	uint32_t threadCount() const {
+		return static_cast<uint32_t>(workers.size());
+	}
+
+	/*
+		Runs job on elementCount uint32 values of hostMemory (host visible, holding input and receiving output).
+		deviceMemory must hold elementCount values, only the GPU share is copied.
+	*/
+	VkResult run(const HeterogeneousKernel& job, DeviceMemoryBlock* hostMemory, DeviceMemoryBlock* deviceMemory, uint32_t elementCount){
+		double fraction = std::clamp(gpuFraction, 0.0, 1.0);
+		uint32_t split = static_cast<uint32_t>(elementCount * fraction);
+		// Whole workgroups on the GPU side
+		split = std::min(elementCount, (split + job.localSizeX - 1) / job.localSizeX * job.localSizeX);
+
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory->memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		uint32_t* data = reinterpret_cast<uint32_t*>(static_cast<char*>(mapped) + hostMemory->offset);
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t traceStart = JobTrace::instance().mark();
+		if (split > 0) {
+			VK_CHECK_RESULT(submitGpu(job, hostMemory, deviceMemory, split));
+		}
+		if (split < elementCount) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				cpuKernel = &job;
+				cpuData = data;
+				cpuEnd = elementCount;
+				nextBlock.store(split, std::memory_order_relaxed);
+				busyWorkers = static_cast<uint32_t>(workers.size());
+				generation++;
+			}
+			workCondition.notify_all();
+		}
+		// Both sides are timed on their own: this thread waits for the fence while the pool works, the last worker stamps the host side
+		double gpuSeconds = 0.0;
+		if (split > 0) {
+			MetricTimer timer(METRIC_FENCE_WAIT_TIME);
+			uint64_t waitStart = JobTrace::instance().mark();
+			VK_CHECK_RESULT(vkWaitForFences(manager->device, 1, &fence, VK_TRUE, UINT64_MAX));
+			gpuSeconds = since(start);
+			if (JobTrace::instance().enabled()) {
+				// The GPU share only, the host share never touches the device
+				JobTrace::instance().wait(waitStart);
+				JobTrace::instance().submit(job.kernel, { deviceMemory }, (split + job.localSizeX - 1) / job.localSizeX, 1, 1, &split, sizeof(split), traceStart);
+			}
+		}
+		double cpuSeconds = 0.0;
+		if (split < elementCount) {
+			std::unique_lock<std::mutex> lock(mutex);
+			doneCondition.wait(lock, [&] { return busyWorkers == 0; });
+			cpuSeconds = std::chrono::duration<double>(cpuFinished - start).count();
+		}
+
+		// Host writes of the CPU share are flushed before anyone invalidates the mapping
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory->memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(manager->device, 1, &mappedRange);
+		vkUnmapMemory(manager->device, hostMemory->memory);
+
+		updateRate(&gpuRate, split, gpuSeconds);
+		updateRate(&cpuRate, elementCount - split, cpuSeconds);
+		if (adapt && gpuRate > 0.0 && cpuRate > 0.0) {
+			gpuFraction = std::clamp(gpuRate / (gpuRate + cpuRate), minimumShare, 1.0 - minimumShare);
+		}
+		else if (adapt) {
+			// Only one side measured so far, give the other one a share to measure
+			gpuFraction = gpuRate > 0.0 ? 1.0 - minimumShare * 10 : minimumShare * 10;
+		}
+		return VK_SUCCESS;
+	}
+
+	HeterogeneousScheduler(ComputeManager* manager, uint32_t cpuThreads = 0) : manager(manager)
+	{
+		VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+		cmdPoolInfo.queueFamilyIndex = manager->queueFamilyIndex;
+		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		VK_CHECK_RESULT(vkCreateCommandPool(manager->device, &cmdPoolInfo, nullptr, &commandPool));
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &commandBuffer));
+		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+		VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &fence));
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &descriptorPool));
+
+		// One core stays with the thread that drives the GPU
+		if (cpuThreads == 0) {
+			cpuThreads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		}
+		for (uint32_t i = 0; i < cpuThreads; i++) {
+			workers.emplace_back(&HeterogeneousScheduler::workerLoop, this);
+		}
+	}
+
+	~HeterogeneousScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		workCondition.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		vkDestroyDescriptorPool(manager->device, descriptorPool, nullptr);
+		vkDestroyFence(manager->device, fence, nullptr);
+		vkDestroyCommandPool(manager->device, commandPool, nullptr);
+	}
+};
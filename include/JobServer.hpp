@@ -0,0 +1,354 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ConcurrentComputeManager.hpp"
+
+/*
+	Wire format of the job server. Every request carries the payload as a shared memory file descriptor
+	(SCM_RIGHTS), the server computes in place and answers with a JobReply once the payload holds the result.
+*/
+struct JobRequest
+{
+	uint32_t id;
+	uint32_t elementCount;
+};
+
+struct JobReply
+{
+	uint32_t id;
+	int32_t result;
+	uint64_t elapsedNanoseconds;
+};
+
+inline bool sendJobRequest(int socket, const JobRequest* request, int payloadFd)
+{
+	struct iovec iov = { const_cast<JobRequest*>(request), sizeof(JobRequest) };
+	char control[CMSG_SPACE(sizeof(int))] = {};
+	struct msghdr message = {};
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &payloadFd, sizeof(int));
+	return sendmsg(socket, &message, MSG_NOSIGNAL) == sizeof(JobRequest);
+}
+
+inline bool receiveJobRequest(int socket, JobRequest* request, int* payloadFd)
+{
+	struct iovec iov = { request, sizeof(JobRequest) };
+	char control[CMSG_SPACE(sizeof(int))] = {};
+	struct msghdr message = {};
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	*payloadFd = -1;
+	ssize_t received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+	// A descriptor can arrive with a short or truncated message, take it first so no error path leaks it
+	if (received >= 0) {
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+			memcpy(payloadFd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	if (received != sizeof(JobRequest) || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		if (*payloadFd >= 0) {
+			close(*payloadFd);
+			*payloadFd = -1;
+		}
+		return false;
+	}
+	return *payloadFd >= 0;
+}
+
+/*
+	Long-lived job server: keeps the manager, the kernel and one warm set of staging / device buffers per
+	queue slot alive across jobs, so clients only pay for the job itself instead of Vulkan startup.
+	Clients connect over a SOCK_SEQPACKET Unix domain socket.
+*/
+class JobServer
+{
+	// Owns the client socket, shared by the jobs still to reply on it
+	struct Connection
+	{
+		int fd;
+		explicit Connection(int fd) : fd(fd) {}
+		Connection(const Connection&) = delete;
+		Connection& operator=(const Connection&) = delete;
+		~Connection() { close(fd); }
+	};
+
+	struct PendingJob
+	{
+		std::shared_ptr<Connection> connection;
+		JobRequest request;
+		int payloadFd;
+	};
+
+	struct Slot
+	{
+		DeviceMemoryBlock hostMemory, deviceMemory;
+		void* mapped;
+	};
+
+	ComputeManager* manager;
+	ConcurrentComputeManager frontend;
+	ComputeKernel* kernel;
+
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<PendingJob> pendingJobs;
+	std::vector<std::thread> workers;
+	bool stopping = false;
+
+	static void handleSignal(int){
+		interrupted = true;
+	}
+
+	void process(PendingJob& job, Slot& slot){
+		auto start = std::chrono::steady_clock::now();
+		JobReply reply = { job.request.id, VK_SUCCESS, 0 };
+		VkDeviceSize size = (VkDeviceSize)job.request.elementCount * sizeof(uint32_t);
+		struct stat payloadStat;
+		void* payload = MAP_FAILED;
+		if (job.request.elementCount > maxElements) {
+			reply.result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		else if (fstat(job.payloadFd, &payloadStat) != 0 || (VkDeviceSize)payloadStat.st_size < size) {
+			reply.result = VK_ERROR_MEMORY_MAP_FAILED;
+		}
+		else if (size > 0 && (payload = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, job.payloadFd, 0)) == MAP_FAILED) {
+			reply.result = VK_ERROR_MEMORY_MAP_FAILED;
+		}
+		if (reply.result == VK_SUCCESS && size > 0) {
+			VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+			mappedRange.memory = slot.hostMemory.memory;
+			mappedRange.offset = 0;
+			mappedRange.size = VK_WHOLE_SIZE;
+			memcpy(slot.mapped, payload, size);
+			vkFlushMappedMemoryRanges(manager->device, 1, &mappedRange);
+			uint32_t groupCount = (job.request.elementCount + localSize - 1) / localSize;
+			reply.result = frontend.runJob(kernel, &slot.hostMemory, &slot.deviceMemory, size, groupCount);
+			vkInvalidateMappedMemoryRanges(manager->device, 1, &mappedRange);
+			memcpy(payload, slot.mapped, size);
+		}
+		if (payload != MAP_FAILED) {
+			munmap(payload, size);
+		}
+		close(job.payloadFd);
+		reply.elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		send(job.connection->fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+	}
+
+	void workerLoop(){
+		Slot slot;
+		slot.hostMemory.size = (VkDeviceSize)maxElements * sizeof(uint32_t);
+		slot.deviceMemory.size = slot.hostMemory.size;
+		frontend.createBuffer(CPU_BUFFER, &slot.hostMemory);
+		frontend.createBuffer(GPU_BUFFER, &slot.deviceMemory);
+		VK_CHECK_RESULT(vkMapMemory(manager->device, slot.hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped));
+		while (true) {
+			PendingJob job;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this] { return stopping || !pendingJobs.empty(); });
+				if (pendingJobs.empty()) {
+					break;
+				}
+				job = std::move(pendingJobs.front());
+				pendingJobs.pop_front();
+			}
+			process(job, slot);
+		}
+		vkUnmapMemory(manager->device, slot.hostMemory.memory);
+		frontend.clean(&slot.deviceMemory);
+		frontend.clean(&slot.hostMemory);
+	}
+
+public:
+	static inline std::atomic<bool> interrupted{ false };
+
+	std::string socketPath;
+	uint32_t maxElements;
+	uint32_t queueDepth;
+	uint32_t localSize;
+	// Exported once per second when set, see Metrics::exportTo
+	std::string metricsTarget;
+	MetricFormat metricsFormat = METRIC_FORMAT_PROMETHEUS;
+
+	// Serves until SIGINT / SIGTERM, jobs already received are finished before returning
+	int run(){
+		signal(SIGINT, handleSignal);
+		signal(SIGTERM, handleSignal);
+
+		int listenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		struct sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (listenSocket < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+			std::cerr << "Error: Could not create socket \"" << socketPath << "\"\n";
+			return 1;
+		}
+		strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+		unlink(socketPath.c_str());
+		if (bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenSocket, 64) != 0) {
+			std::cerr << "Error: Could not listen on \"" << socketPath << "\"\n";
+			close(listenSocket);
+			return 1;
+		}
+
+		for (uint32_t i = 0; i < queueDepth; i++) {
+			workers.emplace_back(&JobServer::workerLoop, this);
+		}
+		std::cout << "Serving " << maxElements << " elements per job with queue depth " << queueDepth << " on " << socketPath << "\n";
+
+		std::unordered_map<int, std::shared_ptr<Connection>> connections;
+		auto lastExport = std::chrono::steady_clock::now();
+		while (!interrupted) {
+			if (!metricsTarget.empty() && std::chrono::steady_clock::now() - lastExport >= std::chrono::seconds(1)) {
+				Metrics::instance().exportTo(metricsTarget, metricsFormat);
+				lastExport = std::chrono::steady_clock::now();
+			}
+			std::vector<struct pollfd> pollFds = { { listenSocket, POLLIN, 0 } };
+			for (auto& connection : connections) {
+				pollFds.push_back({ connection.first, POLLIN, 0 });
+			}
+			if (poll(pollFds.data(), pollFds.size(), 100) <= 0) {
+				continue;
+			}
+			if (pollFds[0].revents & POLLIN) {
+				int client = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+				if (client >= 0) {
+					connections[client] = std::make_shared<Connection>(client);
+				}
+			}
+			for (size_t i = 1; i < pollFds.size(); i++) {
+				if (pollFds[i].revents == 0) {
+					continue;
+				}
+				PendingJob job;
+				job.connection = connections[pollFds[i].fd];
+				if ((pollFds[i].revents & POLLIN) && receiveJobRequest(pollFds[i].fd, &job.request, &job.payloadFd)) {
+					{
+						std::lock_guard<std::mutex> lock(queueMutex);
+						pendingJobs.push_back(std::move(job));
+					}
+					queueCondition.notify_one();
+				}
+				else {
+					// Hang-up or malformed request, the socket closes once its pending jobs have replied
+					connections.erase(pollFds[i].fd);
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCondition.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+		connections.clear();
+		if (!metricsTarget.empty()) {
+			Metrics::instance().exportTo(metricsTarget, metricsFormat);
+		}
+		close(listenSocket);
+		unlink(socketPath.c_str());
+		return 0;
+	}
+
+	JobServer(ComputeManager* manager, ComputeKernel* kernel, std::string socketPath, uint32_t maxElements, uint32_t queueDepth, uint32_t localSize = 1)
+		: manager(manager), frontend(manager), kernel(kernel), socketPath(socketPath), maxElements(maxElements), queueDepth(queueDepth), localSize(localSize)
+	{
+	}
+};
+
+/*
+	Client side: owns a shared memory payload of capacity elements that is handed to the server with every job.
+*/
+class JobClient
+{
+	int socketFd = -1;
+	int payloadFd = -1;
+	uint32_t* mapped = nullptr;
+	uint32_t nextId = 0;
+
+public:
+	uint32_t capacity;
+
+	bool connected(){
+		return socketFd >= 0 && mapped != nullptr;
+	}
+
+	// Write the job input here, the result replaces it once submit() returns
+	uint32_t* payload(){
+		return mapped;
+	}
+
+	VkResult submit(uint32_t elementCount, JobReply* reply){
+		assert(elementCount <= capacity);
+		JobRequest request = { nextId++, elementCount };
+		if (!sendJobRequest(socketFd, &request, payloadFd)) {
+			return VK_ERROR_DEVICE_LOST;
+		}
+		if (recv(socketFd, reply, sizeof(JobReply), 0) != sizeof(JobReply)) {
+			return VK_ERROR_DEVICE_LOST;
+		}
+		return (VkResult)reply->result;
+	}
+
+	JobClient(std::string socketPath, uint32_t capacity) : capacity(capacity)
+	{
+		struct sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+		socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (socketFd < 0 || connect(socketFd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+			std::cerr << "Error: Could not connect to \"" << socketPath << "\"\n";
+			return;
+		}
+		size_t size = (size_t)capacity * sizeof(uint32_t);
+		payloadFd = memfd_create("vkhpc-payload", MFD_CLOEXEC);
+		if (payloadFd < 0 || ftruncate(payloadFd, size) != 0) {
+			return;
+		}
+		void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, payloadFd, 0);
+		mapped = (memory == MAP_FAILED) ? nullptr : static_cast<uint32_t*>(memory);
+	}
+
+	~JobClient()
+	{
+		if (mapped) {
+			munmap(mapped, (size_t)capacity * sizeof(uint32_t));
+		}
+		if (payloadFd >= 0) {
+			close(payloadFd);
+		}
+		if (socketFd >= 0) {
+			close(socketFd);
+		}
+	}
+};
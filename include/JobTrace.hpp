@@ -0,0 +1,446 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "utils.hpp"
+
+enum TraceEvent{
+	TRACE_CREATE_BUFFER,
+	TRACE_DESTROY_BUFFER,
+	TRACE_STAGE_COPY,
+	TRACE_HOST_COPY,
+	TRACE_CREATE_KERNEL,
+	TRACE_NAME_KERNEL,
+	TRACE_DESTROY_KERNEL,
+	TRACE_CREATE_CHAIN,
+	TRACE_DESTROY_CHAIN,
+	TRACE_CHAIN_UPDATE,
+	TRACE_DISPATCH,
+	TRACE_CHAIN_RUN,
+	TRACE_CHAIN_RESET,
+	TRACE_WAIT,
+	TRACE_EVENT_COUNT
+};
+
+// Buffers that existed before recording started, replayed as SHARED_BUFFER
+#define TRACE_UNKNOWN_BUFFER 0xff
+#define TRACE_MAGIC "VKHPCTRC"
+#define TRACE_VERSION 1
+#define TRACE_FLAG_HASHES 1
+
+struct TraceHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	// Wall clock at start() in nanoseconds since the epoch, record timestamps are relative to it
+	uint64_t startTime;
+};
+
+/*
+	Fixed part of every record, followed by extraSize bytes of event specific data:
+	TRACE_STAGE_COPY     VkBufferCopy regions, offsets absolute within the buffers
+	TRACE_HOST_COPY      uint64 offset absolute within the buffer
+	TRACE_CREATE_KERNEL  uint32 stageFlags, uint32 requiredSubgroupSize, then per binding uint32 type and uint32 descriptor count,
+	                     then uint32 map entry count, the VkSpecializationMapEntry array and the specialization data
+	TRACE_NAME_KERNEL    shader name below SHADER_PATH
+	TRACE_CHAIN_UPDATE   uint64 offset absolute within the buffer, then the data
+	TRACE_DISPATCH       uint32 group counts x, y, z, per binding uint32 buffer id, uint64 offset and uint64 size,
+	                     for indirect dispatches uint32 argument buffer id and uint64 offset, then the kernel's push constants.
+	                     Chain id 0 marks a dispatch submitted on its own rather than through a KernelChain
+*/
+struct TraceRecord
+{
+	uint8_t event;
+	// BufferFlag, MemoryCopyFlag or the binding count of a dispatch
+	uint8_t flag;
+	// Small id of the recording thread
+	uint16_t thread;
+	uint32_t extraSize;
+	// Nanoseconds since start() when the call began, and how long it took
+	uint64_t timestamp;
+	uint64_t duration;
+	// Bytes moved or allocated, the stage count of a run, 1 for an indirect dispatch
+	uint64_t size;
+	// Buffer, kernel or chain ids, 0 is never used
+	uint32_t ids[2];
+	// FNV-1a of the host side payload with TRACE_FLAG_HASHES, 0 otherwise
+	uint64_t hash;
+};
+
+static_assert(sizeof(TraceRecord) == 48, "TraceRecord is part of the file format");
+
+/*
+	Opt-in recorder of the buffer, copy, dispatch and wait traffic that goes through ComputeManager, KernelChain and the
+	schedulers and queues that submit dispatches of their own, for replaying production traffic shapes offline (see benchmarks/traceReplay.cpp). Payloads are not stored, only
+	their sizes and optionally hashes, except for the small KernelChain::update data and push constants replay needs.
+	Handles become small ids, so a trace is independent of the process that wrote it. When not recording every hook
+	costs one acquire load, which also makes the start time and hash setting of start() visible to the hook.
+*/
+class JobTrace
+{
+	std::atomic<bool> recording = false;
+	// Read by hooks without the lock, atomic so a restart cannot race with a hook that is still running
+	std::atomic<bool> hashes = false;
+	std::mutex mutex;
+	FILE* file = nullptr;
+	std::vector<uint8_t> pending;
+	// steady_clock nanoseconds at start()
+	std::atomic<int64_t> origin = 0;
+	uint32_t nextId = 1;
+	std::map<uint64_t, uint32_t> bufferIds;
+	std::map<uint64_t, uint32_t> kernelIds;
+	std::map<const void*, uint32_t> chainIds;
+
+	// Writes are batched, a record costs a memcpy under the lock
+	static constexpr size_t flushSize = 1 << 20;
+
+	JobTrace() = default;
+
+	static uint16_t threadId(){
+		static std::atomic<uint16_t> next = 0;
+		thread_local uint16_t id = next.fetch_add(1, std::memory_order_relaxed);
+		return id;
+	}
+
+	template<typename T>
+	static void put(std::vector<uint8_t>& extra, const T& value){
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		extra.insert(extra.end(), bytes, bytes + sizeof(T));
+	}
+
+	static void putBytes(std::vector<uint8_t>& extra, const void* data, size_t size){
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		extra.insert(extra.end(), bytes, bytes + size);
+	}
+
+	// Caller holds the lock. Buffers created before start() get an id and a TRACE_UNKNOWN_BUFFER create record on first use
+	uint32_t bufferId(const DeviceMemoryBlock* block){
+		auto it = bufferIds.find((uint64_t)block->buffer);
+		if (it != bufferIds.end()) {
+			return it->second;
+		}
+		uint32_t id = nextId++;
+		bufferIds[(uint64_t)block->buffer] = id;
+		TraceRecord record = {};
+		record.event = TRACE_CREATE_BUFFER;
+		record.flag = TRACE_UNKNOWN_BUFFER;
+		record.thread = threadId();
+		record.timestamp = now();
+		record.size = block->offset + block->size;
+		record.ids[0] = id;
+		write(record, nullptr);
+		return id;
+	}
+
+	// Caller holds the lock, record carries the chain id
+	void writeDispatch(TraceRecord& record, const ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, const uint32_t groupCount[3],
+		const DeviceMemoryBlock* argumentBlock, VkDeviceSize indirectOffset, const void* pushConstants, uint32_t pushConstantSize){
+		record.flag = static_cast<uint8_t>(bindings.size());
+		auto it = kernelIds.find((uint64_t)kernel->pipeline);
+		record.ids[1] = it != kernelIds.end() ? it->second : 0;
+		std::vector<uint8_t> extra;
+		putBytes(extra, groupCount, 3 * sizeof(uint32_t));
+		for (const DeviceMemoryBlock* binding : bindings) {
+			put(extra, binding->segments ? 0u : bufferId(binding));
+			put(extra, (uint64_t)binding->offset);
+			put(extra, (uint64_t)binding->size);
+		}
+		if (argumentBlock) {
+			put(extra, bufferId(argumentBlock));
+			put(extra, (uint64_t)(argumentBlock->offset + indirectOffset));
+			record.size = 1;
+		}
+		// Replay reads exactly the kernel's push constant size
+		pushConstantSize = pushConstants ? std::min(pushConstantSize, kernel->pushConstantSize) : 0;
+		putBytes(extra, pushConstants, pushConstantSize);
+		extra.resize(extra.size() + kernel->pushConstantSize - pushConstantSize, 0);
+		record.hash = hashes.load(std::memory_order_relaxed) && pushConstantSize > 0 ? hash(pushConstants, pushConstantSize) : 0;
+		write(record, &extra);
+	}
+
+	// Caller holds the lock
+	// Records of hooks that were still running when stop() closed the file are dropped
+	void write(TraceRecord& record, const std::vector<uint8_t>* extra){
+		if (!file) {
+			return;
+		}
+		record.extraSize = extra ? static_cast<uint32_t>(extra->size()) : 0;
+		putBytes(pending, &record, sizeof(record));
+		if (extra) {
+			pending.insert(pending.end(), extra->begin(), extra->end());
+		}
+		if (pending.size() >= flushSize) {
+			flush();
+		}
+	}
+
+	void flush(){
+		if (file && !pending.empty()) {
+			fwrite(pending.data(), 1, pending.size(), file);
+		}
+		pending.clear();
+	}
+
+	TraceRecord begin(TraceEvent event, uint64_t startTime){
+		TraceRecord record = {};
+		record.event = event;
+		record.thread = threadId();
+		record.timestamp = startTime;
+		record.duration = now() - startTime;
+		return record;
+	}
+
+public:
+	static JobTrace& instance(){
+		// Never destroyed, like Metrics, recording threads may outlive static destruction
+		static JobTrace* trace = new JobTrace();
+		return *trace;
+	}
+
+	static uint64_t hash(const void* data, size_t size){
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		uint64_t value = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++) {
+			value = (value ^ bytes[i]) * 1099511628211ull;
+		}
+		return value;
+	}
+
+	bool enabled() const {
+		return recording.load(std::memory_order_acquire);
+	}
+
+	// Nanoseconds since start(), the begin timestamp passed to the hooks
+	uint64_t now() const {
+		int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		return time - origin.load(std::memory_order_relaxed);
+	}
+
+	// Begin timestamp for the hooks, 0 when not recording so callers pay no clock read
+	uint64_t mark() const {
+		return enabled() ? now() : 0;
+	}
+
+	// Records into path until stop() or process exit, hashing host payloads costs a pass over every host copy
+	bool start(const std::string& path, bool hashPayloads = false){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (file) {
+			return false;
+		}
+		file = fopen(path.c_str(), "wb");
+		if (!file) {
+			std::cerr << "Error: Could not open trace file \"" << path << "\"\n";
+			return false;
+		}
+		static std::once_flag registered;
+		std::call_once(registered, [] { std::atexit([] { JobTrace::instance().stop(); }); });
+		hashes.store(hashPayloads, std::memory_order_relaxed);
+		origin.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+		TraceHeader header = {};
+		memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+		header.version = TRACE_VERSION;
+		header.flags = hashPayloads ? TRACE_FLAG_HASHES : 0;
+		header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		fwrite(&header, sizeof(header), 1, file);
+		nextId = 1;
+		bufferIds.clear();
+		kernelIds.clear();
+		chainIds.clear();
+		pending.clear();
+		// Release pairs with the acquire in enabled(), hooks that see recording also see origin and hashes
+		recording.store(true, std::memory_order_release);
+		return true;
+	}
+
+	void stop(){
+		std::lock_guard<std::mutex> lock(mutex);
+		recording.store(false, std::memory_order_release);
+		flush();
+		if (file) {
+			fclose(file);
+			file = nullptr;
+		}
+	}
+
+	void createBuffer(const DeviceMemoryBlock* block, BufferFlag flag, uint64_t startTime){
+		TraceRecord record = begin(TRACE_CREATE_BUFFER, startTime);
+		record.flag = flag;
+		record.size = block->size;
+		std::lock_guard<std::mutex> lock(mutex);
+		record.ids[0] = nextId++;
+		bufferIds[(uint64_t)block->buffer] = record.ids[0];
+		write(record, nullptr);
+	}
+
+	void destroyBuffer(const DeviceMemoryBlock* block){
+		TraceRecord record = begin(TRACE_DESTROY_BUFFER, now());
+		record.size = block->size;
+		std::lock_guard<std::mutex> lock(mutex);
+		record.ids[0] = bufferId(block);
+		bufferIds.erase((uint64_t)block->buffer);
+		write(record, nullptr);
+	}
+
+	void stageCopy(const DeviceMemoryBlock* srcBlock, const DeviceMemoryBlock* dstBlock, const std::vector<VkBufferCopy>& regions, uint64_t startTime){
+		TraceRecord record = begin(TRACE_STAGE_COPY, startTime);
+		std::vector<uint8_t> extra;
+		for (const VkBufferCopy& region : regions) {
+			record.size += region.size;
+			put(extra, region);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		record.ids[0] = bufferId(srcBlock);
+		record.ids[1] = bufferId(dstBlock);
+		write(record, &extra);
+	}
+
+	// offset is absolute within the buffer, data the user side of the copy
+	void hostCopy(const DeviceMemoryBlock* block, const void* data, MemoryCopyFlag flag, VkDeviceSize offset, VkDeviceSize size, uint64_t startTime){
+		TraceRecord record = begin(TRACE_HOST_COPY, startTime);
+		record.flag = flag;
+		record.size = size;
+		record.hash = hashes.load(std::memory_order_relaxed) ? hash(data, size) : 0;
+		std::vector<uint8_t> extra;
+		put(extra, (uint64_t)offset);
+		std::lock_guard<std::mutex> lock(mutex);
+		record.ids[0] = bufferId(block);
+		write(record, &extra);
+	}
+
+	void createKernel(const ComputeKernel* kernel, const std::vector<VkDescriptorType>& bindingTypes, const VkSpecializationInfo* specializationInfo,
+		VkPipelineShaderStageCreateFlags stageFlags, uint32_t requiredSubgroupSize, uint64_t startTime){
+		TraceRecord record = begin(TRACE_CREATE_KERNEL, startTime);
+		record.size = kernel->pushConstantSize;
+		std::vector<uint8_t> extra;
+		put(extra, (uint32_t)stageFlags);
+		put(extra, requiredSubgroupSize);
+		for (size_t i = 0; i < bindingTypes.size(); i++) {
+			put(extra, (uint32_t)bindingTypes[i]);
+			put(extra, kernel->descriptorCounts.empty() ? 1u : kernel->descriptorCounts[i]);
+		}
+		put(extra, specializationInfo ? specializationInfo->mapEntryCount : 0u);
+		if (specializationInfo) {
+			putBytes(extra, specializationInfo->pMapEntries, specializationInfo->mapEntryCount * sizeof(VkSpecializationMapEntry));
+			putBytes(extra, specializationInfo->pData, specializationInfo->dataSize);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		record.ids[0] = nextId++;
+		record.ids[1] = kernel->bindingCount;
+		kernelIds[(uint64_t)kernel->pipeline] = record.ids[0];
+		write(record, &extra);
+	}
+
+	// Kernels from SHADER_PATH, replay can only rebuild named kernels
+	void nameKernel(const ComputeKernel* kernel, const char* shaderName){
+		TraceRecord record = begin(TRACE_NAME_KERNEL, now());
+		std::vector<uint8_t> extra;
+		putBytes(extra, shaderName, strlen(shaderName));
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = kernelIds.find((uint64_t)kernel->pipeline);
+		if (it != kernelIds.end()) {
+			record.ids[0] = it->second;
+			write(record, &extra);
+		}
+	}
+
+	void destroyKernel(const ComputeKernel* kernel){
+		TraceRecord record = begin(TRACE_DESTROY_KERNEL, now());
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = kernelIds.find((uint64_t)kernel->pipeline);
+		if (it != kernelIds.end()) {
+			record.ids[0] = it->second;
+			kernelIds.erase(it);
+			write(record, nullptr);
+		}
+	}
+
+	void createChain(const void* chain, uint32_t maxStages, uint32_t maxBindingsPerStage){
+		TraceRecord record = begin(TRACE_CREATE_CHAIN, now());
+		record.size = maxStages;
+		record.ids[1] = maxBindingsPerStage;
+		std::lock_guard<std::mutex> lock(mutex);
+		record.ids[0] = nextId++;
+		chainIds[chain] = record.ids[0];
+		write(record, nullptr);
+	}
+
+	// Chains created before start() are not recorded, neither is anything done with them
+	void chainEvent(TraceEvent event, const void* chain, uint64_t startTime, uint64_t size = 0){
+		TraceRecord record = begin(event, startTime);
+		record.size = size;
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = chainIds.find(chain);
+		if (it == chainIds.end()) {
+			return;
+		}
+		record.ids[0] = it->second;
+		if (event == TRACE_DESTROY_CHAIN) {
+			chainIds.erase(it);
+		}
+		write(record, nullptr);
+	}
+
+	// offset is absolute within the buffer
+	void chainUpdate(const void* chain, const DeviceMemoryBlock* block, VkDeviceSize offset, const void* data, VkDeviceSize size){
+		TraceRecord record = begin(TRACE_CHAIN_UPDATE, now());
+		record.size = size;
+		record.hash = hashes.load(std::memory_order_relaxed) ? hash(data, size) : 0;
+		std::vector<uint8_t> extra;
+		put(extra, (uint64_t)offset);
+		putBytes(extra, data, size);
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = chainIds.find(chain);
+		if (it == chainIds.end()) {
+			return;
+		}
+		record.ids[0] = it->second;
+		record.ids[1] = bufferId(block);
+		write(record, &extra);
+	}
+
+	// Bindings standing for a SegmentedBuffer are recorded with buffer id 0, replay skips those dispatches
+	void dispatch(const void* chain, const ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, const uint32_t groupCount[3],
+		const DeviceMemoryBlock* argumentBlock, VkDeviceSize indirectOffset, const void* pushConstants){
+		TraceRecord record = begin(TRACE_DISPATCH, now());
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = chainIds.find(chain);
+		if (it == chainIds.end()) {
+			return;
+		}
+		record.ids[0] = it->second;
+		writeDispatch(record, kernel, bindings, groupCount, argumentBlock, indirectOffset, pushConstants, kernel->pushConstantSize);
+	}
+
+	/*
+		A dispatch submitted on its own (ComputeManager::compute, the schedulers, PersistentKernelQueue, FileStream),
+		startTime is where the submission began, so for callers that block the duration includes the wait.
+		pushConstantSize bytes are recorded, zero padded to the kernel's push constant size.
+	*/
+	void submit(const ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+		const void* pushConstants, uint32_t pushConstantSize, uint64_t startTime){
+		TraceRecord record = begin(TRACE_DISPATCH, startTime);
+		const uint32_t groupCount[3] = { groupCountX, groupCountY, groupCountZ };
+		std::lock_guard<std::mutex> lock(mutex);
+		writeDispatch(record, kernel, bindings, groupCount, nullptr, 0, pushConstants, pushConstantSize);
+	}
+
+	// Time spent blocked on a fence inside the call recorded next
+	void wait(uint64_t startTime){
+		TraceRecord record = begin(TRACE_WAIT, startTime);
+		std::lock_guard<std::mutex> lock(mutex);
+		write(record, nullptr);
+	}
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <vector>
+
+#include "ComputeManager.hpp"
+
+/*
+	Records several kernels into one command buffer and submits them together.
+	A stage may take its group counts from a VkDispatchIndirectCommand that an earlier stage wrote,
+	so data-dependent work sizes never need a readback to the host between stages.
+*/
+class KernelChain
+{
+	// Buffer update recorded before a stage, used to reset counters and indirect arguments
+	struct BufferUpdate
+	{
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		std::vector<uint8_t> data;
+	};
+
+	struct Stage
+	{
+		ComputeKernel* kernel;
+		VkDescriptorSet descriptorSet;
+		std::vector<uint8_t> pushConstants;
+		uint32_t groupCount[3];
+		// Indirect dispatch source, VK_NULL_HANDLE for a direct dispatch
+		VkBuffer indirectBuffer;
+		VkDeviceSize indirectOffset;
+		std::vector<BufferUpdate> updates;
+	};
+
+	ComputeManager* manager;
+	VkDescriptorPool descriptorPool;
+	std::vector<Stage> stages;
+	std::vector<BufferUpdate> pendingUpdates;
+
+	Stage& addStage(ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, const void* pushConstants){
+		assert(bindings.size() == kernel->bindingCount);
+		assert(stages.size() < maxStages);
+		Stage stage = {};
+		stage.kernel = kernel;
+		stage.updates = std::move(pendingUpdates);
+		pendingUpdates.clear();
+		if (kernel->pushConstantSize > 0) {
+			assert(pushConstants != nullptr);
+			const uint8_t* bytes = static_cast<const uint8_t*>(pushConstants);
+			stage.pushConstants.assign(bytes, bytes + kernel->pushConstantSize);
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo =
+			vks::initializers::descriptorSetAllocateInfo(descriptorPool, &kernel->descriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &stage.descriptorSet));
+		std::vector<std::vector<VkDescriptorBufferInfo>> bufferDescriptors(bindings.size());
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets(bindings.size());
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			uint32_t descriptorCount = kernel->descriptorCounts.empty() ? 1 : kernel->descriptorCounts[i];
+			if (descriptorCount > 1) {
+				// Array bindings take the segments of a SegmentedBuffer, the last one repeats so every element is valid
+				assert(bindings[i]->segments && bindings[i]->segments->size() <= descriptorCount);
+				const std::vector<DeviceMemoryBlock>& segments = *bindings[i]->segments;
+				for (uint32_t j = 0; j < descriptorCount; j++) {
+					bufferDescriptors[i].push_back(segments[std::min<size_t>(j, segments.size() - 1)].descriptor());
+				}
+			}
+			else {
+				// Larger blocks are not addressable through one descriptor, see SegmentedBuffer
+				assert(bindings[i]->size <= manager->profile.maxStorageBufferRange);
+				bufferDescriptors[i].push_back(bindings[i]->descriptor());
+			}
+			writeDescriptorSets[i] = vks::initializers::writeDescriptorSet(stage.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, i, bufferDescriptors[i].data(), descriptorCount);
+		}
+		vkUpdateDescriptorSets(manager->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		stages.push_back(stage);
+		return stages.back();
+	}
+
+public:
+	uint32_t maxStages;
+	// Descriptors, an array binding counts once per element
+	uint32_t maxBindingsPerStage;
+
+	// Writes data into block at offset (relative to the block) on the device timeline before the next stage runs (max 65536 bytes)
+	KernelChain& update(DeviceMemoryBlock* block, VkDeviceSize offset, const void* data, VkDeviceSize size){
+		assert(offset % 4 == 0 && size % 4 == 0 && size <= 65536);
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		pendingUpdates.push_back({ block->buffer, block->offset + offset, std::vector<uint8_t>(bytes, bytes + size) });
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().chainUpdate(this, block, block->offset + offset, data, size);
+		}
+		return *this;
+	}
+
+	KernelChain& dispatch(ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1, const void* pushConstants = nullptr){
+		Stage& stage = addStage(kernel, bindings, pushConstants);
+		stage.groupCount[0] = groupCountX;
+		stage.groupCount[1] = groupCountY;
+		stage.groupCount[2] = groupCountZ;
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().dispatch(this, kernel, bindings, stage.groupCount, nullptr, 0, pushConstants);
+		}
+		return *this;
+	}
+
+	// Group counts are read on the device from a VkDispatchIndirectCommand at indirectOffset in argumentBlock
+	KernelChain& dispatchIndirect(ComputeKernel* kernel, const std::vector<DeviceMemoryBlock*>& bindings, DeviceMemoryBlock* argumentBlock, VkDeviceSize indirectOffset = 0, const void* pushConstants = nullptr){
+		Stage& stage = addStage(kernel, bindings, pushConstants);
+		stage.indirectBuffer = argumentBlock->buffer;
+		stage.indirectOffset = argumentBlock->offset + indirectOffset;
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().dispatch(this, kernel, bindings, stage.groupCount, argumentBlock, indirectOffset, pushConstants);
+		}
+		return *this;
+	}
+
+	// Records all stages into a command buffer in recording state
+	void record(VkCommandBuffer commandBuffer){
+		// Uploads and host writes have to land before the first stage reads
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_FLAGS_NONE,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+
+		for (Stage& stage : stages) {
+			for (BufferUpdate& update : stage.updates) {
+				vkCmdUpdateBuffer(commandBuffer, update.buffer, update.offset, update.data.size(), update.data.data());
+			}
+			if (!stage.updates.empty()) {
+				memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+				vkCmdPipelineBarrier(
+					commandBuffer,
+					VK_PIPELINE_STAGE_TRANSFER_BIT,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+					VK_FLAGS_NONE,
+					1, &memoryBarrier,
+					0, nullptr,
+					0, nullptr);
+			}
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, stage.kernel->pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, stage.kernel->pipelineLayout, 0, 1, &stage.descriptorSet, 0, 0);
+			if (!stage.pushConstants.empty()) {
+				vkCmdPushConstants(commandBuffer, stage.kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, static_cast<uint32_t>(stage.pushConstants.size()), stage.pushConstants.data());
+			}
+			if (stage.indirectBuffer != VK_NULL_HANDLE) {
+				vkCmdDispatchIndirect(commandBuffer, stage.indirectBuffer, stage.indirectOffset);
+			}
+			else {
+				vkCmdDispatch(commandBuffer, stage.groupCount[0], stage.groupCount[1], stage.groupCount[2]);
+			}
+			Metrics::instance().count(METRIC_DISPATCHES);
+
+			// Shader writes of this stage feed the next one, either as data or as indirect arguments
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_FLAGS_NONE,
+				1, &memoryBarrier,
+				0, nullptr,
+				0, nullptr);
+		}
+
+		// Results in host visible memory (see ResultArena) are read right after the fence
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT,
+			VK_FLAGS_NONE,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	// Runs the whole chain as a single submission and waits for it
+	VkResult run(){
+		uint64_t traceStart = JobTrace::instance().mark();
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+			vks::initializers::commandBufferAllocateInfo(manager->commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VkCommandBuffer commandBuffer;
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &commandBuffer));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		record(commandBuffer);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+		VkFence fence;
+		VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &fence));
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		VK_CHECK_RESULT(manager->submitter.submit(1, &submitInfo, fence));
+		uint64_t waitStart = JobTrace::instance().mark();
+		VK_CHECK_RESULT(vkWaitForFences(manager->device, 1, &fence, VK_TRUE, UINT64_MAX));
+
+		vkDestroyFence(manager->device, fence, nullptr);
+		vkFreeCommandBuffers(manager->device, manager->commandPool, 1, &commandBuffer);
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().wait(waitStart);
+			JobTrace::instance().chainEvent(TRACE_CHAIN_RUN, this, traceStart, stages.size());
+		}
+		return VK_SUCCESS;
+	}
+
+	// Drops all stages so the chain can be rebuilt with other buffers
+	VkResult reset(){
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().chainEvent(TRACE_CHAIN_RESET, this, JobTrace::instance().now());
+		}
+		stages.clear();
+		pendingUpdates.clear();
+		return vkResetDescriptorPool(manager->device, descriptorPool, 0);
+	}
+
+	KernelChain(ComputeManager* manager, uint32_t maxStages = 16, uint32_t maxBindingsPerStage = 8)
+		: manager(manager), maxStages(maxStages), maxBindingsPerStage(maxBindingsPerStage)
+	{
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxStages * maxBindingsPerStage),
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, maxStages);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &descriptorPool));
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().createChain(this, maxStages, maxBindingsPerStage);
+		}
+	}
+
+	~KernelChain()
+	{
+		if (JobTrace::instance().enabled()) {
+			JobTrace::instance().chainEvent(TRACE_DESTROY_CHAIN, this, JobTrace::instance().now());
+		}
+		vkDestroyDescriptorPool(manager->device, descriptorPool, nullptr);
+	}
+};
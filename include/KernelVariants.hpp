@@ -0,0 +1,186 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "KernelChain.hpp"
+
+// One build of a kernel, its workgroup size is passed as specialization constant 0 (local_size_x_id = 0)
+struct KernelVariant
+{
+	std::string shaderName;
+	uint32_t localSizeX;
+	// Shared memory the kernel declares for this workgroup size
+	uint32_t sharedMemoryBytes = 0;
+	// Subgroup operations used in the compute stage, 0 for none
+	VkSubgroupFeatureFlags subgroupOperations = 0;
+	// For kernels that derive subgroup indices from the local index
+	bool requireFullSubgroups = false;
+	// 0 leaves the subgroup size to the driver
+	uint32_t requiredSubgroupSize = 0;
+	bool needs16BitStorage = false;
+	bool needs8BitStorage = false;
+	bool needsFloat16 = false;
+	bool needsInt8 = false;
+	// Anything the fields above can not express
+	std::function<bool(const DeviceProfile&)> requirement;
+
+	// Subgroup size the kernel runs with in the worst case
+	uint32_t effectiveSubgroupSize(const DeviceProfile& profile) const {
+		return requiredSubgroupSize != 0 ? requiredSubgroupSize : profile.maxSubgroupSize;
+	}
+
+	bool legal(const DeviceProfile& profile) const {
+		if (localSizeX == 0 || localSizeX > profile.maxComputeWorkGroupInvocations || localSizeX > profile.maxComputeWorkGroupSize[0]) {
+			return false;
+		}
+		if (sharedMemoryBytes > profile.maxComputeSharedMemorySize) {
+			return false;
+		}
+		if (subgroupOperations != 0 && (!(profile.subgroupSupportedStages & VK_SHADER_STAGE_COMPUTE_BIT)
+			|| (profile.subgroupSupportedOperations & subgroupOperations) != subgroupOperations)) {
+			return false;
+		}
+		if (requireFullSubgroups && (!profile.computeFullSubgroups || localSizeX % effectiveSubgroupSize(profile) != 0)) {
+			return false;
+		}
+		if (requiredSubgroupSize != 0) {
+			if (!profile.subgroupSizeControl || !(profile.requiredSubgroupSizeStages & VK_SHADER_STAGE_COMPUTE_BIT)
+				|| requiredSubgroupSize < profile.minSubgroupSize || requiredSubgroupSize > profile.maxSubgroupSize
+				|| localSizeX > requiredSubgroupSize * profile.maxComputeWorkgroupSubgroups) {
+				return false;
+			}
+		}
+		if ((needs16BitStorage && !profile.storageBuffer16BitAccess) || (needs8BitStorage && !profile.storageBuffer8BitAccess)
+			|| (needsFloat16 && !profile.shaderFloat16) || (needsInt8 && !profile.shaderInt8)) {
+			return false;
+		}
+		return !requirement || requirement(profile);
+	}
+
+	VkResult create(ComputeManager* manager, uint32_t bindingCount, uint32_t pushConstantSize, ComputeKernel* kernel) const {
+		VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSizeX);
+		VkPipelineShaderStageCreateFlags stageFlags = requireFullSubgroups ? VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT : 0;
+		return manager->createKernel(shaderName.c_str(), bindingCount, kernel, pushConstantSize, &specializationInfo, stageFlags, requiredSubgroupSize);
+	}
+};
+
+/*
+	Picks the fastest legal variant of a kernel family on this device by timing each one on device local copies of the
+	caller supplied buffers, so kernels that accumulate into their outputs leave the caller's data untouched.
+	The choice is remembered per family, later selections only build the chosen variant.
+*/
+class KernelVariantSelector
+{
+	ComputeManager* manager;
+	std::unordered_map<std::string, size_t> selections;
+
+	// Seconds for repetitions dispatches of an already created kernel, in one submission
+	double measure(ComputeKernel* kernel, const KernelVariant& variant, const std::vector<DeviceMemoryBlock*>& bindings, uint32_t elementCount, const void* pushConstants){
+		uint32_t groupCount = (elementCount + variant.localSizeX - 1) / variant.localSizeX;
+		KernelChain chain(manager, repetitions, static_cast<uint32_t>(bindings.size()));
+		for (uint32_t i = 0; i < repetitions; i++) {
+			chain.dispatch(kernel, bindings, groupCount, 1, 1, pushConstants);
+		}
+		// Warm-up, the first submission pays for lazy driver work
+		chain.run();
+		auto start = std::chrono::steady_clock::now();
+		chain.run();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+public:
+	uint32_t repetitions = 16;
+	bool verbose = false;
+
+	// Builds the selected variant of family into kernel and returns its index through chosen, VK_ERROR_FEATURE_NOT_PRESENT if no variant is legal
+	VkResult select(const std::string& family, const std::vector<KernelVariant>& variants, const std::vector<DeviceMemoryBlock*>& bindings,
+		uint32_t elementCount, const void* pushConstants, uint32_t pushConstantSize, ComputeKernel* kernel, size_t* chosen){
+		uint32_t bindingCount = static_cast<uint32_t>(bindings.size());
+		auto it = selections.find(family);
+		if (it != selections.end()) {
+			*chosen = it->second;
+			return variants[*chosen].create(manager, bindingCount, pushConstantSize, kernel);
+		}
+
+		// Repeated dispatches would accumulate into the caller's outputs, time the variants on scratch copies
+		std::vector<DeviceMemoryBlock> scratch(bindings.size());
+		std::vector<DeviceMemoryBlock*> scratchBindings;
+		for (size_t i = 0; i < bindings.size(); i++) {
+			assert(bindings[i]->segments == nullptr);
+			scratch[i].size = bindings[i]->size;
+			VK_CHECK_RESULT(manager->createBuffer(GPU_BUFFER, &scratch[i]));
+			VK_CHECK_RESULT(manager->stageMemorycpy(bindings[i], &scratch[i]));
+			scratchBindings.push_back(&scratch[i]);
+		}
+
+		double bestTime = 0.0;
+		bool found = false;
+		for (size_t i = 0; i < variants.size(); i++) {
+			if (!variants[i].legal(manager->profile)) {
+				if (verbose) {
+					std::cout << family << ": " << variants[i].shaderName << " x" << variants[i].localSizeX << " not legal on this device\n";
+				}
+				continue;
+			}
+			ComputeKernel candidate;
+			VK_CHECK_RESULT(variants[i].create(manager, bindingCount, pushConstantSize, &candidate));
+			double time = measure(&candidate, variants[i], scratchBindings, elementCount, pushConstants);
+			if (verbose) {
+				std::cout << family << ": " << variants[i].shaderName << " x" << variants[i].localSizeX << " " << time * 1e3 << " ms\n";
+			}
+			if (!found || time < bestTime) {
+				if (found) {
+					manager->destroyKernel(kernel);
+				}
+				*kernel = candidate;
+				*chosen = i;
+				bestTime = time;
+				found = true;
+			}
+			else {
+				manager->destroyKernel(&candidate);
+			}
+		}
+		for (DeviceMemoryBlock& block : scratch) {
+			manager->clean(&block);
+		}
+		if (!found) {
+			return VK_ERROR_FEATURE_NOT_PRESENT;
+		}
+		selections[family] = *chosen;
+		return VK_SUCCESS;
+	}
+
+	KernelVariantSelector(ComputeManager* manager) : manager(manager) {}
+};
+
+// Sum reduction into a single uint, bindings { values, result } and push constant { elementCount }
+inline std::vector<KernelVariant> reductionVariants()
+{
+	std::vector<KernelVariant> variants;
+	for (uint32_t localSize : { 64u, 128u, 256u, 512u }) {
+		KernelVariant variant;
+		variant.shaderName = "reduce.comp.spv";
+		variant.localSizeX = localSize;
+		variant.sharedMemoryBytes = localSize * sizeof(uint32_t);
+		variants.push_back(variant);
+	}
+	for (uint32_t localSize : { 64u, 256u, 1024u }) {
+		KernelVariant variant;
+		variant.shaderName = "reduce_subgroup.comp.spv";
+		variant.localSizeX = localSize;
+		variant.sharedMemoryBytes = localSize / 4 * sizeof(uint32_t);
+		variant.subgroupOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+		variant.requireFullSubgroups = true;
+		// The second level reduces one value per subgroup inside a single subgroup
+		variant.requirement = [localSize](const DeviceProfile& profile) {
+			return localSize <= profile.minSubgroupSize * profile.minSubgroupSize;
+		};
+		variants.push_back(variant);
+	}
+	return variants;
+}
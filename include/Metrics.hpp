@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+enum MetricCounter{
+	METRIC_BUFFERS_CREATED,
+	METRIC_BYTES_ALLOCATED,
+	METRIC_BYTES_STAGED,
+	METRIC_BYTES_HOST_COPIED,
+	METRIC_SUBMITS,
+	METRIC_DISPATCHES,
+	METRIC_PIPELINE_COMPILES,
+	METRIC_VK_ERRORS,
+	METRIC_EVICTIONS,
+	METRIC_RESTORES,
+	METRIC_HOST_SPILLS,
+	METRIC_COUNTER_COUNT
+};
+
+// Gauges are kept as per-thread deltas, so increment and decrement may happen on different threads
+enum MetricGauge{
+	METRIC_BUFFER_BYTES_LIVE,
+	METRIC_QUEUE_DEPTH,
+	METRIC_DEVICE_BYTES_RESIDENT,
+	METRIC_GAUGE_COUNT
+};
+
+enum MetricHistogram{
+	METRIC_BUFFER_CREATE_TIME,
+	METRIC_STAGE_COPY_TIME,
+	METRIC_HOST_COPY_TIME,
+	METRIC_COMPUTE_TIME,
+	METRIC_FENCE_WAIT_TIME,
+	METRIC_PIPELINE_COMPILE_TIME,
+	// Submission to completion of a TenantScheduler job, queueing included
+	METRIC_JOB_LATENCY,
+	METRIC_HISTOGRAM_COUNT
+};
+
+enum MetricFormat{
+	METRIC_FORMAT_JSON,
+	METRIC_FORMAT_PROMETHEUS
+};
+
+// Bucket b holds durations below 2^b nanoseconds
+#define METRIC_BUCKET_COUNT 65
+
+struct MetricSnapshot
+{
+	uint64_t counters[METRIC_COUNTER_COUNT] = {};
+	int64_t gauges[METRIC_GAUGE_COUNT] = {};
+	uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKET_COUNT] = {};
+	uint64_t sums[METRIC_HISTOGRAM_COUNT] = {};
+	uint64_t counts[METRIC_HISTOGRAM_COUNT] = {};
+};
+
+/*
+	Process wide metrics. Every thread writes only its own slot (plain relaxed load / store, no locked
+	instructions and no shared cache lines), snapshot() sums all slots on demand.
+	Slots of exited threads are folded into a retired slot so nothing is lost.
+*/
+class Metrics
+{
+	struct alignas(64) ThreadSlot
+	{
+		std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT] = {};
+		std::atomic<int64_t> gauges[METRIC_GAUGE_COUNT] = {};
+		std::atomic<uint64_t> buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKET_COUNT] = {};
+		std::atomic<uint64_t> sums[METRIC_HISTOGRAM_COUNT] = {};
+	};
+
+	// Unregisters the slot of this thread on thread exit
+	struct ThreadRegistration
+	{
+		ThreadSlot* slot = nullptr;
+		~ThreadRegistration() {
+			if (slot) {
+				instance().retire(slot);
+			}
+		}
+	};
+
+	std::mutex mutex;
+	std::vector<ThreadSlot*> slots;
+	MetricSnapshot retired;
+
+	static void add(MetricSnapshot& snapshot, const ThreadSlot* slot){
+		for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+			snapshot.counters[i] += slot->counters[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+			snapshot.gauges[i] += slot->gauges[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+			for (int b = 0; b < METRIC_BUCKET_COUNT; b++) {
+				uint64_t count = slot->buckets[i][b].load(std::memory_order_relaxed);
+				snapshot.buckets[i][b] += count;
+				snapshot.counts[i] += count;
+			}
+			snapshot.sums[i] += slot->sums[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	void retire(ThreadSlot* slot){
+		std::lock_guard<std::mutex> lock(mutex);
+		add(retired, slot);
+		slots.erase(std::find(slots.begin(), slots.end(), slot));
+		delete slot;
+	}
+
+	ThreadSlot* threadSlot(){
+		thread_local ThreadRegistration registration;
+		if (!registration.slot) {
+			registration.slot = new ThreadSlot();
+			std::lock_guard<std::mutex> lock(mutex);
+			slots.push_back(registration.slot);
+		}
+		return registration.slot;
+	}
+
+	template<typename T>
+	static void bump(std::atomic<T>& value, T delta){
+		value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	static const char* counterName(int counter){
+		static const char* names[METRIC_COUNTER_COUNT] = {
+			"buffers_created", "bytes_allocated", "bytes_staged", "bytes_host_copied",
+			"submits", "dispatches", "pipeline_compiles", "vk_errors",
+			"evictions", "restores", "host_spills"
+		};
+		return names[counter];
+	}
+
+	static const char* gaugeName(int gauge){
+		static const char* names[METRIC_GAUGE_COUNT] = { "buffer_bytes_live", "queue_depth", "device_bytes_resident" };
+		return names[gauge];
+	}
+
+	static const char* histogramName(int histogram){
+		static const char* names[METRIC_HISTOGRAM_COUNT] = {
+			"buffer_create", "stage_copy", "host_copy", "compute", "fence_wait", "pipeline_compile", "job_latency"
+		};
+		return names[histogram];
+	}
+
+	// Highest non-empty bucket, so exports stay short
+	static int lastBucket(const MetricSnapshot& snapshot, int histogram){
+		int last = 0;
+		for (int b = 0; b < METRIC_BUCKET_COUNT; b++) {
+			if (snapshot.buckets[histogram][b] != 0) {
+				last = b;
+			}
+		}
+		return last;
+	}
+
+	Metrics() = default;
+
+public:
+	static Metrics& instance(){
+		// Never destroyed, threads may retire their slot during static destruction
+		static Metrics* metrics = new Metrics();
+		return *metrics;
+	}
+
+	void count(MetricCounter counter, uint64_t value = 1){
+		bump(threadSlot()->counters[counter], value);
+	}
+
+	void gauge(MetricGauge gauge, int64_t delta){
+		bump(threadSlot()->gauges[gauge], delta);
+	}
+
+	void record(MetricHistogram histogram, uint64_t nanoseconds){
+		ThreadSlot* slot = threadSlot();
+		bump(slot->buckets[histogram][std::bit_width(nanoseconds)], uint64_t(1));
+		bump(slot->sums[histogram], nanoseconds);
+	}
+
+	MetricSnapshot snapshot(){
+		std::lock_guard<std::mutex> lock(mutex);
+		MetricSnapshot snapshot = retired;
+		for (const ThreadSlot* slot : slots) {
+			add(snapshot, slot);
+		}
+		return snapshot;
+	}
+
+	static std::string toJson(const MetricSnapshot& snapshot){
+		std::ostringstream out;
+		out << "{\n\t\"counters\": {";
+		for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+			out << (i ? ", " : "") << "\"" << counterName(i) << "\": " << snapshot.counters[i];
+		}
+		out << "},\n\t\"gauges\": {";
+		for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+			out << (i ? ", " : "") << "\"" << gaugeName(i) << "\": " << snapshot.gauges[i];
+		}
+		out << "},\n\t\"histograms\": {";
+		for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+			out << (i ? "," : "") << "\n\t\t\"" << histogramName(i) << "\": {\"count\": " << snapshot.counts[i]
+				<< ", \"sum_ns\": " << snapshot.sums[i] << ", \"buckets\": [";
+			// [upper bound in ns, count], the last bucket is unbounded
+			for (int b = 0, last = lastBucket(snapshot, i); b <= last; b++) {
+				out << (b ? ", " : "") << "[";
+				if (b < 64) {
+					out << (uint64_t(1) << b);
+				}
+				else {
+					out << "null";
+				}
+				out << ", " << snapshot.buckets[i][b] << "]";
+			}
+			out << "]}";
+		}
+		out << "\n\t}\n}\n";
+		return out.str();
+	}
+
+	static std::string toPrometheus(const MetricSnapshot& snapshot){
+		std::ostringstream out;
+		for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+			out << "# TYPE vkhpc_" << counterName(i) << "_total counter\n";
+			out << "vkhpc_" << counterName(i) << "_total " << snapshot.counters[i] << "\n";
+		}
+		for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+			out << "# TYPE vkhpc_" << gaugeName(i) << " gauge\n";
+			out << "vkhpc_" << gaugeName(i) << " " << snapshot.gauges[i] << "\n";
+		}
+		for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+			std::string name = std::string("vkhpc_") + histogramName(i) + "_seconds";
+			out << "# TYPE " << name << " histogram\n";
+			uint64_t cumulative = 0;
+			for (int b = 0, last = lastBucket(snapshot, i); b <= last && b < 64; b++) {
+				cumulative += snapshot.buckets[i][b];
+				out << name << "_bucket{le=\"" << (double)(uint64_t(1) << b) * 1e-9 << "\"} " << cumulative << "\n";
+			}
+			out << name << "_bucket{le=\"+Inf\"} " << snapshot.counts[i] << "\n";
+			out << name << "_sum " << snapshot.sums[i] * 1e-9 << "\n";
+			out << name << "_count " << snapshot.counts[i] << "\n";
+		}
+		return out.str();
+	}
+
+	// Target is a file path (replaced atomically) or "unix:<path>" for a listening stream socket
+	bool exportTo(const std::string& target, MetricFormat format){
+		MetricSnapshot current = snapshot();
+		std::string text = (format == METRIC_FORMAT_JSON) ? toJson(current) : toPrometheus(current);
+		if (target.rfind("unix:", 0) == 0) {
+#ifndef _WIN32
+			std::string path = target.substr(5);
+			struct sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+			int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			bool written = fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+			for (size_t offset = 0; written && offset < text.size();) {
+				ssize_t count = send(fd, text.data() + offset, text.size() - offset, MSG_NOSIGNAL);
+				written = count > 0;
+				offset += written ? count : 0;
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+			if (!written) {
+				std::cerr << "Error: Could not write metrics to \"" << path << "\"\n";
+			}
+			return written;
+#else
+			std::cerr << "Error: Metrics sockets are not supported on this platform\n";
+			return false;
+#endif
+		}
+		// Write and rename, scrapers never see a partial file
+		std::string temporary = target + ".tmp";
+		{
+			std::ofstream os(temporary, std::ios::out | std::ios::trunc);
+			os << text;
+			if (!os) {
+				std::cerr << "Error: Could not write metrics file \"" << temporary << "\"\n";
+				return false;
+			}
+		}
+		return std::rename(temporary.c_str(), target.c_str()) == 0;
+	}
+};
+
+// Records the lifetime of the scope into a histogram
+class MetricTimer
+{
+	MetricHistogram histogram;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	MetricTimer(MetricHistogram histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+	~MetricTimer()
+	{
+		Metrics::instance().record(histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+};
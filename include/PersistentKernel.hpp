@@ -0,0 +1,281 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "ComputeManager.hpp"
+
+/*
+	Low-latency job queue backed by a long-running compute dispatch (shaders/persistent.comp).
+	Job descriptors, payloads and completion flags live in host-visible coherent memory that stays mapped,
+	so submitting and completing a job touches no Vulkan API at all.
+	The kernel returns after maxJobsPerLaunch jobs or maxIdlePolls empty polls to stay clear of GPU watchdogs,
+	a supervisor thread relaunches it until stop() is requested.
+	The dispatch owns its queue while it runs, work submitted to the same queue waits for the time slice to end.
+	It is launched on the priority queue when the device has a separate one (ComputeManager::submitterFor),
+	so stageMemorycpy, KernelChain and batch jobs keep the normal queue; otherwise they share the only queue
+	and each wait is bounded by maxIdlePolls once the ring runs empty.
+	Note: visibility of host writes to an already running dispatch is not guaranteed by the Vulkan spec,
+	it relies on coherent memory behaving as it does on current desktop drivers.
+*/
+class PersistentKernelQueue
+{
+	struct JobDescriptor
+	{
+		uint32_t sequence;
+		uint32_t offset;
+		uint32_t count;
+		uint32_t padding;
+	};
+
+	struct RingHeader
+	{
+		uint32_t head;
+		uint32_t stop;
+		uint32_t padding[2];
+	};
+
+	struct CompletionHeader
+	{
+		uint32_t tail;
+		uint32_t exitReason;
+		uint32_t launches;
+		uint32_t padding;
+	};
+
+	struct PushConstants
+	{
+		uint32_t ringSize;
+		uint32_t maxJobsPerLaunch;
+		uint32_t maxIdlePolls;
+	} pushConstants;
+
+	// Matches COMMAND_STOP in persistent.comp
+	static constexpr uint32_t EXIT_STOP = 3;
+
+	ComputeManager* manager;
+	ComputeKernel kernel;
+	DeviceMemoryBlock ringMemory, completionMemory, dataMemory;
+	RingHeader* ringHeader;
+	JobDescriptor* jobs;
+	CompletionHeader* completion;
+	uint32_t* done;
+	uint32_t* data;
+
+	VkCommandPool commandPool;
+	VkCommandBuffer commandBuffer;
+	VkDescriptorPool descriptorPool;
+	VkDescriptorSet descriptorSet;
+	VkFence fence;
+
+	std::mutex producerMutex;
+	uint32_t nextJob = 0;
+	std::atomic<bool> running{ false };
+	std::atomic<VkResult> launchResult{ VK_SUCCESS };
+	std::thread supervisor;
+
+	static uint32_t load(uint32_t& value){
+		return std::atomic_ref<uint32_t>(value).load(std::memory_order_acquire);
+	}
+
+	static void store(uint32_t& value, uint32_t desired){
+		std::atomic_ref<uint32_t>(value).store(desired, std::memory_order_release);
+	}
+
+	static void *mapBlock(ComputeManager* manager, DeviceMemoryBlock* block){
+		void *mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, block->memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		memset(mapped, 0, block->size);
+		return mapped;
+	}
+
+	void supervise(){
+		while (true) {
+			uint64_t traceStart = JobTrace::instance().mark();
+			vkResetFences(manager->device, 1, &fence);
+			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &commandBuffer;
+			VkResult result = manager->submitterFor(true).submit(1, &submitInfo, fence);
+			uint64_t waitStart = JobTrace::instance().mark();
+			if (result == VK_SUCCESS) {
+				result = vkWaitForFences(manager->device, 1, &fence, VK_TRUE, UINT64_MAX);
+			}
+			if (JobTrace::instance().enabled()) {
+				// One record per time slice, the jobs inside it go through mapped memory and are not traced
+				JobTrace::instance().wait(waitStart);
+				JobTrace::instance().submit(&kernel, { &ringMemory, &completionMemory, &dataMemory }, 1, 1, 1, &pushConstants, sizeof(pushConstants), traceStart);
+			}
+			if (result != VK_SUCCESS) {
+				launchResult = result;
+				break;
+			}
+			// The kernel only reports a stop once the stop flag is set and the ring is drained, otherwise its time slice ran out
+			if (load(completion->exitReason) == EXIT_STOP) {
+				break;
+			}
+		}
+		running = false;
+	}
+
+	template<typename Condition>
+	VkResult spinUntil(Condition condition, uint64_t timeoutNs){
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t spins = 0; !condition(); spins++) {
+			if (!running) {
+				return launchResult != VK_SUCCESS ? launchResult.load() : VK_ERROR_INITIALIZATION_FAILED;
+			}
+			if (spins > 1024) {
+				if (timeoutNs != UINT64_MAX && (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() >= timeoutNs) {
+					return VK_TIMEOUT;
+				}
+				std::this_thread::yield();
+			}
+		}
+		return VK_SUCCESS;
+	}
+
+public:
+	uint32_t ringSize;
+	VkDeviceSize dataElements;
+
+	// Mapped payload buffer, jobs address it through offset/count in elements
+	uint32_t* values(){
+		return data;
+	}
+
+	// Publishes a job over values()[offset, offset + count), ticket identifies it in wait()
+	VkResult submit(uint32_t offset, uint32_t count, uint32_t* ticket, uint64_t timeoutNs = UINT64_MAX){
+		assert((VkDeviceSize)offset + count <= dataElements);
+		std::lock_guard<std::mutex> lock(producerMutex);
+		uint32_t index = nextJob;
+		VkResult result = spinUntil([&] { return index - load(completion->tail) < ringSize; }, timeoutNs);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		JobDescriptor& job = jobs[index % ringSize];
+		job.sequence = index + 1;
+		job.offset = offset;
+		job.count = count;
+		// Release orders the descriptor and payload writes before the new head becomes visible
+		store(ringHeader->head, index + 1);
+		nextJob = index + 1;
+		*ticket = index + 1;
+		return VK_SUCCESS;
+	}
+
+	VkResult wait(uint32_t ticket, uint64_t timeoutNs = UINT64_MAX){
+		uint32_t slot = (ticket - 1) % ringSize;
+		return spinUntil([&] {
+			return load(done[slot]) == ticket || (int32_t)(load(completion->tail) - ticket) >= 0;
+		}, timeoutNs);
+	}
+
+	// Number of times the kernel has been (re)launched, one per time slice
+	uint32_t launches(){
+		return load(completion->launches);
+	}
+
+	// Lets the kernel drain all published jobs, then waits for it to exit
+	VkResult stop(uint64_t timeoutNs = UINT64_MAX){
+		store(ringHeader->stop, 1);
+		auto start = std::chrono::steady_clock::now();
+		while (running) {
+			if (timeoutNs != UINT64_MAX && (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() >= timeoutNs) {
+				return VK_TIMEOUT;
+			}
+			std::this_thread::yield();
+		}
+		if (supervisor.joinable()) {
+			supervisor.join();
+		}
+		return launchResult;
+	}
+
+	PersistentKernelQueue(ComputeManager* manager, uint32_t ringSize = 256, VkDeviceSize dataElements = 1 << 20, uint32_t maxJobsPerLaunch = 4096, uint32_t maxIdlePolls = 1 << 14)
+		: manager(manager), ringSize(ringSize), dataElements(dataElements)
+	{
+		pushConstants = { ringSize, maxJobsPerLaunch, maxIdlePolls };
+		manager->createKernel("persistent.comp.spv", 3, &kernel, sizeof(PushConstants));
+
+		ringMemory.size = sizeof(RingHeader) + ringSize * sizeof(JobDescriptor);
+		completionMemory.size = sizeof(CompletionHeader) + ringSize * sizeof(uint32_t);
+		dataMemory.size = dataElements * sizeof(uint32_t);
+		manager->createBuffer(SHARED_BUFFER, &ringMemory);
+		manager->createBuffer(SHARED_BUFFER, &completionMemory);
+		manager->createBuffer(SHARED_BUFFER, &dataMemory);
+		uint8_t* ring = static_cast<uint8_t*>(mapBlock(manager, &ringMemory));
+		ringHeader = reinterpret_cast<RingHeader*>(ring);
+		jobs = reinterpret_cast<JobDescriptor*>(ring + sizeof(RingHeader));
+		uint8_t* completionFlags = static_cast<uint8_t*>(mapBlock(manager, &completionMemory));
+		completion = reinterpret_cast<CompletionHeader*>(completionFlags);
+		done = reinterpret_cast<uint32_t*>(completionFlags + sizeof(CompletionHeader));
+		data = static_cast<uint32_t*>(mapBlock(manager, &dataMemory));
+
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &descriptorPool));
+		VkDescriptorSetAllocateInfo allocInfo =
+			vks::initializers::descriptorSetAllocateInfo(descriptorPool, &kernel.descriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSet));
+		VkDescriptorBufferInfo bufferDescriptors[3] = {
+			{ ringMemory.buffer, 0, VK_WHOLE_SIZE },
+			{ completionMemory.buffer, 0, VK_WHOLE_SIZE },
+			{ dataMemory.buffer, 0, VK_WHOLE_SIZE },
+		};
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferDescriptors[0]),
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &bufferDescriptors[1]),
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &bufferDescriptors[2]),
+		};
+		vkUpdateDescriptorSets(manager->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		// The same command buffer is resubmitted for every time slice, the kernel picks up at the completed tail
+		VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+		// Family of the queue submitterFor(true) launches on, the normal family when there is no separate priority queue
+		cmdPoolInfo.queueFamilyIndex = manager->separatePriorityQueue ? manager->priorityQueueFamilyIndex : manager->queueFamilyIndex;
+		VK_CHECK_RESULT(vkCreateCommandPool(manager->device, &cmdPoolInfo, nullptr, &commandPool));
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+			vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &commandBuffer));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		vkCmdPushConstants(commandBuffer, kernel.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, 1, 1, 1);
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+		VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &fence));
+
+		running = true;
+		supervisor = std::thread(&PersistentKernelQueue::supervise, this);
+	}
+
+	~PersistentKernelQueue()
+	{
+		stop();
+		vkDestroyFence(manager->device, fence, nullptr);
+		vkDestroyCommandPool(manager->device, commandPool, nullptr);
+		vkDestroyDescriptorPool(manager->device, descriptorPool, nullptr);
+		vkUnmapMemory(manager->device, dataMemory.memory);
+		vkUnmapMemory(manager->device, completionMemory.memory);
+		vkUnmapMemory(manager->device, ringMemory.memory);
+		manager->clean(&dataMemory);
+		manager->clean(&completionMemory);
+		manager->clean(&ringMemory);
+		manager->destroyKernel(&kernel);
+	}
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <new>
+#include <vector>
+
+#include "ComputeManager.hpp"
+
+/*
+	Standard allocator over ComputeManager::allocatePinned. Containers using it keep their elements in persistently mapped,
+	host coherent Vulkan memory, so the GPU copies straight from and into them without a blockMemoryCopy on either side.
+	Every allocation is its own VkDeviceMemory: reserve() up front instead of growing element by element.
+*/
+template<typename T>
+class PinnedAllocator
+{
+public:
+	using value_type = T;
+
+	ComputeManager* manager;
+
+	explicit PinnedAllocator(ComputeManager* manager) noexcept : manager(manager) {}
+
+	template<typename U>
+	PinnedAllocator(const PinnedAllocator<U>& other) noexcept : manager(other.manager) {}
+
+	T* allocate(size_t n){
+		if (n > SIZE_MAX / sizeof(T)) {
+			throw std::bad_array_new_length();
+		}
+		void* mapped;
+		// Zero sized buffers are not allowed
+		if (manager->allocatePinned(std::max<VkDeviceSize>(n * sizeof(T), 1), &mapped) != VK_SUCCESS) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(mapped);
+	}
+
+	void deallocate(T* pointer, size_t){
+		manager->freePinned(pointer);
+	}
+
+	template<typename U>
+	bool operator==(const PinnedAllocator<U>& other) const noexcept {
+		return manager == other.manager;
+	}
+};
+
+template<typename T>
+using PinnedVector = std::vector<T, PinnedAllocator<T>>;
+
+// The elements of a non-empty vector as a block for stageMemorycpy / stageMemoryRegions
+template<typename T>
+DeviceMemoryBlock pinnedBlock(const PinnedVector<T>& vector){
+	DeviceMemoryBlock block = {};
+	bool pinned = vector.get_allocator().manager->pinnedBlock(vector.data(), vector.size() * sizeof(T), &block);
+	assert(pinned);
+	(void)pinned;
+	return block;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "ComputeManager.hpp"
+
+// Specialization constant values of one pipeline variant
+class SpecializationConstants
+{
+public:
+	std::vector<VkSpecializationMapEntry> entries;
+	std::vector<uint8_t> data;
+
+	template<typename T>
+	SpecializationConstants& set(uint32_t constantID, T value){
+		uint32_t offset = static_cast<uint32_t>(data.size());
+		entries.push_back(vks::initializers::specializationMapEntry(constantID, offset, sizeof(T)));
+		data.resize(offset + sizeof(T));
+		memcpy(data.data() + offset, &value, sizeof(T));
+		return *this;
+	}
+
+	// Only valid while this object is alive and unchanged
+	VkSpecializationInfo info() const {
+		return vks::initializers::specializationInfo(entries, data.size(), data.data());
+	}
+
+	std::string key() const {
+		std::string key;
+		for (const VkSpecializationMapEntry& entry : entries) {
+			key.append(reinterpret_cast<const char*>(&entry.constantID), sizeof(entry.constantID));
+			key.append(reinterpret_cast<const char*>(data.data() + entry.offset), entry.size);
+		}
+		return key;
+	}
+};
+
+/*
+	Cache of pipeline variants keyed by shader plus specialization data.
+	Variants compile on background threads, either ahead of time through warm() or on first request,
+	so request threads either wait on the returned future or keep running on the generic kernel meanwhile.
+	All variants share the pipeline layout of the generic kernel.
+*/
+class PipelineVariantCache
+{
+	ComputeManager* manager;
+	const ComputeKernel* generic;
+
+	std::mutex mutex;
+	std::unordered_map<std::string, std::shared_future<VkPipeline>> variants;
+	// Separate lock so request() never waits for a worker creating a shader module
+	std::mutex shaderModuleMutex;
+	std::unordered_map<std::string, VkShaderModule> shaderModules;
+
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<std::function<void()>> compileQueue;
+	std::vector<std::thread> workers;
+	bool stopping = false;
+
+	void workerLoop(){
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this] { return stopping || !compileQueue.empty(); });
+				if (compileQueue.empty()) {
+					return;
+				}
+				task = std::move(compileQueue.front());
+				compileQueue.pop_front();
+			}
+			task();
+		}
+	}
+
+	// Runs on a worker thread, so is the module creation (from the embedded SPIR-V, or the shader file when it is not embedded)
+	VkPipeline compile(const std::string& shaderName, const SpecializationConstants& constants){
+		VkShaderModule shaderModule;
+		{
+			std::lock_guard<std::mutex> lock(shaderModuleMutex);
+			auto it = shaderModules.find(shaderName);
+			if (it == shaderModules.end()) {
+				it = shaderModules.emplace(shaderName, manager->loadShaderModule(shaderName.c_str())).first;
+			}
+			shaderModule = it->second;
+		}
+		if (shaderModule == VK_NULL_HANDLE) {
+			return VK_NULL_HANDLE;
+		}
+
+		VkSpecializationInfo specializationInfo = constants.info();
+		VkPipelineShaderStageCreateInfo shaderStage = {};
+		shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		shaderStage.module = shaderModule;
+		shaderStage.pName = "main";
+		shaderStage.pSpecializationInfo = constants.entries.empty() ? nullptr : &specializationInfo;
+		// Same subgroup size and dispatch base support as the generic kernel the variant replaces
+		shaderStage.flags = generic->stageFlags;
+		VkPipelineShaderStageRequiredSubgroupSizeCreateInfo requiredSubgroupSizeInfo = {};
+		requiredSubgroupSizeInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO;
+		requiredSubgroupSizeInfo.requiredSubgroupSize = generic->requiredSubgroupSize;
+		if (generic->requiredSubgroupSize != 0) {
+			shaderStage.pNext = &requiredSubgroupSizeInfo;
+		}
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(generic->pipelineLayout, generic->pipelineFlags);
+		computePipelineCreateInfo.stage = shaderStage;
+
+		// The VkPipelineCache is internally synchronized, workers share it
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkResult result;
+		{
+			MetricTimer timer(METRIC_PIPELINE_COMPILE_TIME);
+			result = vkCreateComputePipelines(manager->device, manager->pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline);
+		}
+		Metrics::instance().count(METRIC_PIPELINE_COMPILES);
+		if (result != VK_SUCCESS) {
+			std::cout << "Pipeline variant of \"" << shaderName << "\" failed to compile: " << result << "\n";
+			return VK_NULL_HANDLE;
+		}
+		return pipeline;
+	}
+
+public:
+	// Non-blocking, queues a compile for a variant that has not been requested yet
+	std::shared_future<VkPipeline> request(const std::string& shaderName, const SpecializationConstants& constants){
+		std::string key = shaderName + '\0' + constants.key();
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = variants.find(key);
+		if (it != variants.end()) {
+			return it->second;
+		}
+		auto task = std::make_shared<std::packaged_task<VkPipeline()>>([this, shaderName, constants] {
+			return compile(shaderName, constants);
+		});
+		std::shared_future<VkPipeline> future = task->get_future().share();
+		variants.emplace(key, future);
+		{
+			std::lock_guard<std::mutex> queueLock(queueMutex);
+			compileQueue.push_back([task] { (*task)(); });
+		}
+		queueCondition.notify_one();
+		return future;
+	}
+
+	// Compiles a warm list ahead of time
+	void warm(const std::vector<std::pair<std::string, SpecializationConstants>>& warmList){
+		for (const auto& variant : warmList) {
+			request(variant.first, variant.second);
+		}
+	}
+
+	// Blocks until the variant is compiled
+	VkPipeline get(const std::string& shaderName, const SpecializationConstants& constants){
+		return request(shaderName, constants).get();
+	}
+
+	// Fills kernel with the variant when it is ready and with the generic kernel otherwise, never blocks on the compiler
+	bool resolve(const std::string& shaderName, const SpecializationConstants& constants, ComputeKernel* kernel){
+		std::shared_future<VkPipeline> future = request(shaderName, constants);
+		*kernel = *generic;
+		if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready && future.get() != VK_NULL_HANDLE) {
+			kernel->pipeline = future.get();
+			return true;
+		}
+		return false;
+	}
+
+	PipelineVariantCache(ComputeManager* manager, const ComputeKernel* generic, uint32_t threadCount = 0)
+		: manager(manager), generic(generic)
+	{
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+		}
+		for (uint32_t i = 0; i < threadCount; i++) {
+			workers.emplace_back(&PipelineVariantCache::workerLoop, this);
+		}
+	}
+
+	~PipelineVariantCache()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCondition.notify_all();
+		// Workers finish queued compiles before leaving, so every future is satisfied
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		for (auto& variant : variants) {
+			VkPipeline pipeline = variant.second.get();
+			if (pipeline != VK_NULL_HANDLE) {
+				vkDestroyPipeline(manager->device, pipeline, nullptr);
+			}
+		}
+		for (auto& shaderModule : shaderModules) {
+			if (shaderModule.second != VK_NULL_HANDLE) {
+				vkDestroyShaderModule(manager->device, shaderModule.second, nullptr);
+			}
+		}
+	}
+};
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "KernelVariants.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VKHPC_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Storage types of reduced precision buffers, kernels compute in the precision the variant allows
+enum ElementType{
+	ELEMENT_FLOAT32,
+	ELEMENT_FLOAT16,
+	ELEMENT_BFLOAT16,
+	// Symmetric quantization, value = q * scale with q in [-127, 127]
+	ELEMENT_INT8
+};
+
+inline size_t elementSize(ElementType type)
+{
+	switch (type){
+	case ELEMENT_FLOAT16:
+	case ELEMENT_BFLOAT16:
+		return 2;
+	case ELEMENT_INT8:
+		return 1;
+	default:
+		return 4;
+	}
+}
+
+inline const char* elementTypeName(ElementType type)
+{
+	switch (type){
+	case ELEMENT_FLOAT16:
+		return "fp16";
+	case ELEMENT_BFLOAT16:
+		return "bf16";
+	case ELEMENT_INT8:
+		return "int8";
+	default:
+		return "fp32";
+	}
+}
+
+// Round to nearest even, overflow saturates to infinity
+inline uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t exponent = (bits >> 23) & 0xFF;
+	uint32_t mantissa = bits & 0x7FFFFF;
+	if (exponent == 0xFF) {
+		return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	}
+	int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+	if (halfExponent >= 0x1F) {
+		return static_cast<uint16_t>(sign | 0x7C00);
+	}
+	if (halfExponent <= 0) {
+		if (halfExponent < -10) {
+			return static_cast<uint16_t>(sign);
+		}
+		// Subnormal half
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - halfExponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1))) {
+			half++;
+		}
+		return static_cast<uint16_t>(sign | half);
+	}
+	uint32_t half = sign | (halfExponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1FFF;
+	// A carry into the exponent is the correct rounding
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		half++;
+	}
+	return static_cast<uint16_t>(half);
+}
+
+inline float halfToFloat(uint16_t half)
+{
+	uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1F;
+	uint32_t mantissa = half & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0x1F) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else if (exponent != 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	else if (mantissa == 0) {
+		bits = sign;
+	}
+	else {
+		// Subnormal half, normalize
+		exponent = 113;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Round to nearest even, matches packBfloat16 in the shaders
+inline uint16_t floatToBfloat16(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if (std::isnan(value)) {
+		return static_cast<uint16_t>((bits >> 16) | 0x40);
+	}
+	bits += 0x7FFF + ((bits >> 16) & 1);
+	return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float bfloat16ToFloat(uint16_t value)
+{
+	uint32_t bits = static_cast<uint32_t>(value) << 16;
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+inline int8_t floatToInt8(float value, float inverseScale)
+{
+	return static_cast<int8_t>(std::clamp(static_cast<int32_t>(std::nearbyint(value * inverseScale)), -127, 127));
+}
+
+#ifdef VKHPC_X86_SIMD
+// Compiled for the instruction sets below regardless of the global flags, only called after a runtime CPU check
+__attribute__((target("avx,f16c"))) inline size_t packHalfF16C(const float* src, uint16_t* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+	}
+	return i;
+}
+
+__attribute__((target("avx,f16c"))) inline size_t unpackHalfF16C(const uint16_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) inline __m256i roundBfloat16AVX2(__m256 value)
+{
+	__m256i bits = _mm256_castps_si256(value);
+	__m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(_mm256_set1_epi32(0x7FFF), _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1))));
+	__m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+	__m256 isNan = _mm256_cmp_ps(value, value, _CMP_UNORD_Q);
+	return _mm256_blendv_epi8(_mm256_srli_epi32(rounded, 16), nan, _mm256_castps_si256(isNan));
+}
+
+__attribute__((target("avx2"))) inline size_t packBfloat16AVX2(const float* src, uint16_t* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i low = roundBfloat16AVX2(_mm256_loadu_ps(src + i));
+		__m256i high = roundBfloat16AVX2(_mm256_loadu_ps(src + i + 8));
+		// packus works per 128 bit lane, restore the element order afterwards
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) inline size_t unpackBfloat16AVX2(const uint16_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) inline __m256i quantizeInt8AVX2(const float* src, __m256 inverseScale)
+{
+	__m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src), inverseScale));
+	return _mm256_min_epi32(_mm256_max_epi32(q, _mm256_set1_epi32(-127)), _mm256_set1_epi32(127));
+}
+
+__attribute__((target("avx2"))) inline size_t packInt8AVX2(const float* src, int8_t* dst, size_t count, float inverseScale)
+{
+	const __m256 scale = _mm256_set1_ps(inverseScale);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i ab = _mm256_packs_epi32(quantizeInt8AVX2(src + i, scale), quantizeInt8AVX2(src + i + 8, scale));
+		__m256i cd = _mm256_packs_epi32(quantizeInt8AVX2(src + i + 16, scale), quantizeInt8AVX2(src + i + 24, scale));
+		__m256i packed = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(ab, cd), order);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) inline size_t unpackInt8AVX2(const int8_t* src, float* dst, size_t count, float scale)
+{
+	const __m256 factor = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i wide = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(wide), factor));
+	}
+	return i;
+}
+#endif
+
+/*
+	Converts float data into the storage type, straight into mapped staging memory when called from PrecisionBuffer.
+	Uses F16C / AVX2 when the CPU has them (simd = true) and finishes the tail with the scalar code.
+*/
+inline void packElements(const float* src, void* dst, size_t count, ElementType type, float scale = 1.0f, bool simd = true)
+{
+	size_t done = 0;
+	switch (type){
+	case ELEMENT_FLOAT32:
+		memcpy(dst, src, count * sizeof(float));
+		return;
+	case ELEMENT_FLOAT16: {
+		uint16_t* out = static_cast<uint16_t*>(dst);
+#ifdef VKHPC_X86_SIMD
+		if (simd && __builtin_cpu_supports("f16c")) {
+			done = packHalfF16C(src, out, count);
+		}
+#endif
+		for (size_t i = done; i < count; i++) {
+			out[i] = floatToHalf(src[i]);
+		}
+		return;
+	}
+	case ELEMENT_BFLOAT16: {
+		uint16_t* out = static_cast<uint16_t*>(dst);
+#ifdef VKHPC_X86_SIMD
+		if (simd && __builtin_cpu_supports("avx2")) {
+			done = packBfloat16AVX2(src, out, count);
+		}
+#endif
+		for (size_t i = done; i < count; i++) {
+			out[i] = floatToBfloat16(src[i]);
+		}
+		return;
+	}
+	case ELEMENT_INT8: {
+		int8_t* out = static_cast<int8_t*>(dst);
+#ifdef VKHPC_X86_SIMD
+		if (simd && __builtin_cpu_supports("avx2")) {
+			done = packInt8AVX2(src, out, count, 1.0f / scale);
+		}
+#endif
+		for (size_t i = done; i < count; i++) {
+			out[i] = floatToInt8(src[i], 1.0f / scale);
+		}
+		return;
+	}
+	}
+}
+
+inline void unpackElements(const void* src, float* dst, size_t count, ElementType type, float scale = 1.0f, bool simd = true)
+{
+	size_t done = 0;
+	switch (type){
+	case ELEMENT_FLOAT32:
+		memcpy(dst, src, count * sizeof(float));
+		return;
+	case ELEMENT_FLOAT16: {
+		const uint16_t* in = static_cast<const uint16_t*>(src);
+#ifdef VKHPC_X86_SIMD
+		if (simd && __builtin_cpu_supports("f16c")) {
+			done = unpackHalfF16C(in, dst, count);
+		}
+#endif
+		for (size_t i = done; i < count; i++) {
+			dst[i] = halfToFloat(in[i]);
+		}
+		return;
+	}
+	case ELEMENT_BFLOAT16: {
+		const uint16_t* in = static_cast<const uint16_t*>(src);
+#ifdef VKHPC_X86_SIMD
+		if (simd && __builtin_cpu_supports("avx2")) {
+			done = unpackBfloat16AVX2(in, dst, count);
+		}
+#endif
+		for (size_t i = done; i < count; i++) {
+			dst[i] = bfloat16ToFloat(in[i]);
+		}
+		return;
+	}
+	case ELEMENT_INT8: {
+		const int8_t* in = static_cast<const int8_t*>(src);
+#ifdef VKHPC_X86_SIMD
+		if (simd && __builtin_cpu_supports("avx2")) {
+			done = unpackInt8AVX2(in, dst, count, scale);
+		}
+#endif
+		for (size_t i = done; i < count; i++) {
+			dst[i] = in[i] * scale;
+		}
+		return;
+	}
+	}
+}
+
+/*
+	Device buffer of count elements stored as type, with a host visible staging buffer of the same size.
+	Host data is always float, conversion happens while staging.
+*/
+class PrecisionBuffer
+{
+	ComputeManager* manager;
+
+public:
+	ElementType type;
+	size_t count;
+	// int8 quantization step
+	float scale;
+	DeviceMemoryBlock hostMemory, deviceMemory;
+
+	VkResult upload(const float* data, bool simd = true){
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		packElements(data, mapped, count, type, scale, simd);
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory.memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(manager->device, 1, &mappedRange);
+		vkUnmapMemory(manager->device, hostMemory.memory);
+		return manager->stageMemorycpy(&hostMemory, &deviceMemory);
+	}
+
+	VkResult download(float* data, bool simd = true){
+		manager->stageMemorycpy(&deviceMemory, &hostMemory);
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory.memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(manager->device, 1, &mappedRange);
+		unpackElements(mapped, data, count, type, scale, simd);
+		vkUnmapMemory(manager->device, hostMemory.memory);
+		return VK_SUCCESS;
+	}
+
+	PrecisionBuffer(ComputeManager* manager, ElementType type, size_t count, float scale = 1.0f)
+		: manager(manager), type(type), count(count), scale(scale)
+	{
+		// Storage buffer sizes stay a multiple of 4 bytes
+		hostMemory.size = (count * elementSize(type) + 3) & ~VkDeviceSize(3);
+		deviceMemory.size = hostMemory.size;
+		VK_CHECK_RESULT(manager->createBuffer(CPU_BUFFER, &hostMemory));
+		VK_CHECK_RESULT(manager->createBuffer(GPU_BUFFER, &deviceMemory));
+	}
+
+	~PrecisionBuffer()
+	{
+		manager->clean(&deviceMemory);
+		manager->clean(&hostMemory);
+	}
+};
+
+// y = alpha * x + y in the given storage type, bindings { x, y } and push constants { elementCount, alpha, xScale, yScale }
+inline KernelVariant saxpyVariant(ElementType type, uint32_t localSizeX = 256)
+{
+	KernelVariant variant;
+	variant.localSizeX = localSizeX;
+	switch (type){
+	case ELEMENT_FLOAT32:
+		variant.shaderName = "saxpy_f32.comp.spv";
+		break;
+	case ELEMENT_FLOAT16:
+		variant.shaderName = "saxpy_f16.comp.spv";
+		variant.needs16BitStorage = true;
+		variant.needsFloat16 = true;
+		break;
+	case ELEMENT_BFLOAT16:
+		variant.shaderName = "saxpy_bf16.comp.spv";
+		variant.needs16BitStorage = true;
+		break;
+	case ELEMENT_INT8:
+		variant.shaderName = "saxpy_i8.comp.spv";
+		variant.needs8BitStorage = true;
+		break;
+	}
+	return variant;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include <vulkan/vulkan.h>
+
+#include "Metrics.hpp"
+
+/*
+	Serializes vkQueueSubmit from any number of threads without a mutex.
+	Callers push their submission onto a lock-free list; whichever caller wins the
+	drain flag submits everything pending (its own and other threads' work) in FIFO order.
+*/
+class QueueSubmitter
+{
+	struct PendingSubmit
+	{
+		uint32_t submitCount;
+		const VkSubmitInfo* pSubmits;
+		VkFence fence;
+		VkResult result;
+		std::atomic<bool> done{ false };
+		PendingSubmit* next = nullptr;
+	};
+
+	std::atomic<PendingSubmit*> pending{ nullptr };
+	std::atomic<bool> draining{ false };
+
+	void drain()
+	{
+		PendingSubmit* list = pending.exchange(nullptr, std::memory_order_acquire);
+		// The list is LIFO, reverse it so submissions keep their arrival order
+		PendingSubmit* ordered = nullptr;
+		while (list) {
+			PendingSubmit* next = list->next;
+			list->next = ordered;
+			ordered = list;
+			list = next;
+		}
+		while (ordered) {
+			// Read next before signalling, the waiter owns the node and may leave right away
+			PendingSubmit* next = ordered->next;
+			Metrics::instance().count(METRIC_SUBMITS);
+			ordered->result = vkQueueSubmit(queue, ordered->submitCount, ordered->pSubmits, ordered->fence);
+			ordered->done.store(true, std::memory_order_release);
+			ordered = next;
+		}
+	}
+
+public:
+	VkQueue queue = VK_NULL_HANDLE;
+
+	VkResult submit(uint32_t submitCount, const VkSubmitInfo* pSubmits, VkFence fence)
+	{
+		PendingSubmit request;
+		request.submitCount = submitCount;
+		request.pSubmits = pSubmits;
+		request.fence = fence;
+		Metrics::instance().gauge(METRIC_QUEUE_DEPTH, 1);
+		request.next = pending.load(std::memory_order_relaxed);
+		while (!pending.compare_exchange_weak(request.next, &request, std::memory_order_release, std::memory_order_relaxed));
+
+		while (!request.done.load(std::memory_order_acquire)) {
+			if (!draining.exchange(true, std::memory_order_acquire)) {
+				drain();
+				draining.store(false, std::memory_order_release);
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		Metrics::instance().gauge(METRIC_QUEUE_DEPTH, -1);
+		return request.result;
+	}
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "ComputeManager.hpp"
+
+// Storage buffer whose memory may move between device and host, see ResidencyManager
+struct ResidentBuffer
+{
+	// Current storage, its VkBuffer changes when the buffer moves
+	DeviceMemoryBlock block;
+	bool hostBacked;
+	uint32_t heapIndex;
+	uint32_t pinCount;
+	uint64_t lastUse;
+};
+
+/*
+	Keeps device local storage buffers within a per-heap budget (VK_EXT_memory_budget when the device has it,
+	the heap size otherwise). When a buffer does not fit, the least recently used idle buffers are moved to host
+	visible memory of another heap; if that is still not enough the new buffer itself lives in host memory.
+	Devices whose only host visible memory is in the device heap (UMA) have nothing to evict to, buffers are
+	then created in the device heap even over budget.
+	Host backed buffers stay usable by kernels (over the bus) and move back on the next acquire() that fits.
+	Bind descriptors only after acquire(), the VkBuffer of a moved buffer is a new one.
+*/
+class ResidencyManager
+{
+	ComputeManager* manager;
+	std::mutex mutex;
+	std::vector<ResidentBuffer*> buffers;
+	std::vector<VkDeviceSize> residentBytes;
+	uint64_t clock = 0;
+	// Whether SHARED_BUFFER memory exists outside the device heap, so that moving a buffer there frees device memory
+	bool separateHostHeap = false;
+
+	// Heap that GPU_BUFFER allocations land in
+	uint32_t deviceHeap(){
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(manager->physicalDevice, &memoryProperties);
+		uint32_t typeIndex = manager->memoryTypeIndex(UINT32_MAX, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		return typeIndex == UINT32_MAX ? 0 : memoryProperties.memoryTypes[typeIndex].heapIndex;
+	}
+
+	bool fits(uint32_t heapIndex, VkDeviceSize size){
+		VkDeviceSize limit, used;
+		budget(heapIndex, &limit, &used);
+		return used + size <= limit;
+	}
+
+	// Evicts idle buffers of the heap, least recently used first, until size fits
+	bool makeRoom(uint32_t heapIndex, VkDeviceSize size, const ResidentBuffer* keep){
+		while (!fits(heapIndex, size)) {
+			if (!separateHostHeap) {
+				return false;
+			}
+			ResidentBuffer* victim = nullptr;
+			for (ResidentBuffer* buffer : buffers) {
+				if (buffer != keep && !buffer->hostBacked && buffer->pinCount == 0 && buffer->heapIndex == heapIndex
+					&& (!victim || buffer->lastUse < victim->lastUse)) {
+					victim = buffer;
+				}
+			}
+			if (!victim || evictLocked(victim) != VK_SUCCESS) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Moves block to freshly created storage of flag outside excludedHeap, the old storage is released
+	VkResult move(ResidentBuffer* buffer, BufferFlag flag, uint32_t excludedHeap = UINT32_MAX){
+		DeviceMemoryBlock target;
+		target.size = buffer->block.size;
+		VkResult result = manager->createBuffer(flag, &target, excludedHeap);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		manager->stageMemorycpy(&buffer->block, &target);
+		manager->clean(&buffer->block);
+		buffer->block = target;
+		return VK_SUCCESS;
+	}
+
+	VkResult evictLocked(ResidentBuffer* buffer){
+		VkResult result = move(buffer, SHARED_BUFFER, buffer->heapIndex);
+		if (result == VK_SUCCESS) {
+			buffer->hostBacked = true;
+			residentBytes[buffer->heapIndex] -= buffer->block.size;
+			Metrics::instance().count(METRIC_EVICTIONS);
+			Metrics::instance().gauge(METRIC_DEVICE_BYTES_RESIDENT, -(int64_t)buffer->block.size);
+		}
+		return result;
+	}
+
+	VkResult restoreLocked(ResidentBuffer* buffer){
+		if (!makeRoom(buffer->heapIndex, buffer->block.size, buffer)) {
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+		VkResult result = move(buffer, GPU_BUFFER);
+		if (result == VK_SUCCESS) {
+			buffer->hostBacked = false;
+			residentBytes[buffer->heapIndex] += buffer->block.size;
+			Metrics::instance().count(METRIC_RESTORES);
+			Metrics::instance().gauge(METRIC_DEVICE_BYTES_RESIDENT, buffer->block.size);
+		}
+		return result;
+	}
+
+public:
+	// Per heap cap in bytes on top of the budget, 0 means the budget alone
+	std::vector<VkDeviceSize> heapLimits;
+	// Share of the reported budget this manager may fill, the rest is left to other allocations and processes
+	float budgetFraction = 0.9f;
+
+	// Byte limit and current usage of a heap, usage is process wide with VK_EXT_memory_budget
+	void budget(uint32_t heapIndex, VkDeviceSize* limit, VkDeviceSize* used){
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+		memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		if (manager->memoryBudgetSupported) {
+			memoryProperties.pNext = &budgetProperties;
+		}
+		vkGetPhysicalDeviceMemoryProperties2(manager->physicalDevice, &memoryProperties);
+
+		*limit = memoryProperties.memoryProperties.memoryHeaps[heapIndex].size;
+		*used = residentBytes[heapIndex];
+		if (manager->memoryBudgetSupported) {
+			*limit = budgetProperties.heapBudget[heapIndex];
+			*used = std::max(*used, budgetProperties.heapUsage[heapIndex]);
+		}
+		*limit = (VkDeviceSize)(*limit * budgetFraction);
+		if (heapLimits[heapIndex] != 0) {
+			*limit = std::min(*limit, heapLimits[heapIndex]);
+		}
+	}
+
+	// Device local when it fits after eviction (or nothing can be evicted to), host backed otherwise
+	VkResult create(VkDeviceSize size, ResidentBuffer** buffer){
+		std::lock_guard<std::mutex> lock(mutex);
+		ResidentBuffer* created = new ResidentBuffer();
+		created->block.size = size;
+		created->heapIndex = deviceHeap();
+		created->lastUse = ++clock;
+
+		VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		if (makeRoom(created->heapIndex, size, nullptr) || !separateHostHeap) {
+			result = manager->createBuffer(GPU_BUFFER, &created->block);
+		}
+		if (result == VK_SUCCESS) {
+			residentBytes[created->heapIndex] += size;
+			Metrics::instance().gauge(METRIC_DEVICE_BYTES_RESIDENT, size);
+		}
+		else if (!separateHostHeap) {
+			delete created;
+			return result;
+		}
+		else {
+			result = manager->createBuffer(SHARED_BUFFER, &created->block, created->heapIndex);
+			if (result != VK_SUCCESS) {
+				delete created;
+				return result;
+			}
+			created->hostBacked = true;
+			Metrics::instance().count(METRIC_HOST_SPILLS);
+		}
+		buffers.push_back(created);
+		*buffer = created;
+		return VK_SUCCESS;
+	}
+
+	// Pins the buffer for use by the caller and brings it back to the device if it fits, never fails
+	DeviceMemoryBlock* acquire(ResidentBuffer* buffer){
+		std::lock_guard<std::mutex> lock(mutex);
+		buffer->pinCount++;
+		buffer->lastUse = ++clock;
+		if (buffer->hostBacked) {
+			restoreLocked(buffer);
+		}
+		return &buffer->block;
+	}
+
+	// Once every acquire() is released the buffer may be evicted again
+	void release(ResidentBuffer* buffer){
+		std::lock_guard<std::mutex> lock(mutex);
+		assert(buffer->pinCount > 0);
+		buffer->pinCount--;
+	}
+
+	VkResult evict(ResidentBuffer* buffer){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (buffer->hostBacked || buffer->pinCount > 0) {
+			return VK_NOT_READY;
+		}
+		return evictLocked(buffer);
+	}
+
+	void destroy(ResidentBuffer* buffer){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!buffer->hostBacked) {
+			residentBytes[buffer->heapIndex] -= buffer->block.size;
+			Metrics::instance().gauge(METRIC_DEVICE_BYTES_RESIDENT, -(int64_t)buffer->block.size);
+		}
+		manager->clean(&buffer->block);
+		buffers.erase(std::find(buffers.begin(), buffers.end(), buffer));
+		delete buffer;
+	}
+
+	ResidencyManager(ComputeManager* manager) : manager(manager)
+	{
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(manager->physicalDevice, &memoryProperties);
+		residentBytes.resize(memoryProperties.memoryHeapCount, 0);
+		heapLimits.resize(memoryProperties.memoryHeapCount, 0);
+		separateHostHeap = manager->memoryTypeIndex(UINT32_MAX, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, deviceHeap()) != UINT32_MAX;
+	}
+
+	~ResidencyManager()
+	{
+		for (ResidentBuffer* buffer : buffers) {
+			manager->clean(&buffer->block);
+			delete buffer;
+		}
+	}
+};
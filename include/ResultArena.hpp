@@ -0,0 +1,98 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "ComputeManager.hpp"
+
+/*
+	Small persistently mapped, host coherent buffer that kernels write scalar results into (sums, counts, flags, residuals).
+	Each slot is bound like any storage buffer through slot(), and once the fence of the submission has signalled the host
+	reads it straight from the mapping: no copy back, no map call.
+	Slots start at multiples of minStorageBufferOffsetAlignment so every slot can be its own descriptor.
+	KernelChain ends with a shader write -> host read barrier, other submitters need one before their fence.
+*/
+class ResultArena
+{
+	ComputeManager* manager;
+	char* mapped = nullptr;
+	std::mutex mutex;
+	std::vector<uint32_t> freeSlots;
+
+public:
+	DeviceMemoryBlock memory;
+	// Bytes a kernel may write per slot
+	VkDeviceSize slotSize;
+	// Distance between slots
+	VkDeviceSize stride;
+	uint32_t slotCount;
+
+	// Reserves a slot, UINT32_MAX when all are taken
+	uint32_t acquire(){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (freeSlots.empty()) {
+			return UINT32_MAX;
+		}
+		uint32_t index = freeSlots.back();
+		freeSlots.pop_back();
+		return index;
+	}
+
+	void release(uint32_t index){
+		assert(index < slotCount);
+		std::lock_guard<std::mutex> lock(mutex);
+		freeSlots.push_back(index);
+	}
+
+	// The slot as a block to bind, valid for the lifetime of the arena
+	DeviceMemoryBlock slot(uint32_t index) const {
+		assert(index < slotCount);
+		DeviceMemoryBlock block = memory;
+		block.offset = index * stride;
+		block.size = slotSize;
+		return block;
+	}
+
+	void* data(uint32_t index){
+		assert(index < slotCount);
+		return mapped + index * stride;
+	}
+
+	// Host writes land before any later submission reads them, e.g. clearing an accumulator
+	template<typename T>
+	void write(uint32_t index, const T& value, uint32_t element = 0){
+		assert((element + 1) * sizeof(T) <= slotSize);
+		memcpy(static_cast<char*>(data(index)) + element * sizeof(T), &value, sizeof(T));
+	}
+
+	// Only after the fence of the submission that wrote the slot has signalled
+	template<typename T>
+	T read(uint32_t index, uint32_t element = 0){
+		assert((element + 1) * sizeof(T) <= slotSize);
+		T value;
+		memcpy(&value, static_cast<const char*>(data(index)) + element * sizeof(T), sizeof(T));
+		return value;
+	}
+
+	ResultArena(ComputeManager* manager, uint32_t slotCount = 64, VkDeviceSize slotSize = 16)
+		: manager(manager), slotSize((slotSize + 3) & ~VkDeviceSize(3)), slotCount(slotCount)
+	{
+		VkDeviceSize alignment = std::max<VkDeviceSize>(manager->profile.minStorageBufferOffsetAlignment, 4);
+		stride = (this->slotSize + alignment - 1) / alignment * alignment;
+		memory.size = stride * slotCount;
+		VK_CHECK_RESULT(manager->createBuffer(SHARED_BUFFER, &memory));
+		void* pointer;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, memory.memory, 0, VK_WHOLE_SIZE, 0, &pointer));
+		mapped = static_cast<char*>(pointer);
+		memset(mapped, 0, memory.size);
+		for (uint32_t i = slotCount; i > 0; i--) {
+			freeSlots.push_back(i - 1);
+		}
+	}
+
+	~ResultArena()
+	{
+		vkUnmapMemory(manager->device, memory.memory);
+		manager->clean(&memory);
+	}
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <bit>
+#include <vector>
+
+#include "ComputeManager.hpp"
+
+/*
+	Logical array of any size, stored as segments of 2^segmentShift elements with one buffer each, so no single
+	descriptor exceeds maxStorageBufferRange and no allocation exceeds maxMemoryAllocationSize.
+	block() stands for the whole array: KernelChain binds it to an array binding (descriptorCounts in createKernel) and
+	the kernel splits a logical index into segment and offset with segmentShift, see shaders/segmented.comp.
+	upload / download take logical element ranges and split them at segment boundaries.
+*/
+class SegmentedBuffer
+{
+	ComputeManager* manager;
+	DeviceMemoryBlock logical = {};
+	// Pinned staging for device local segments, allocated on the first transfer
+	void* staging = nullptr;
+
+	VkResult transfer(void* data, VkDeviceSize firstElement, VkDeviceSize count, MemoryCopyFlag direction){
+		if (count == VK_WHOLE_SIZE) {
+			count = elementCount - firstElement;
+		}
+		assert(firstElement + count <= elementCount);
+		bool hostVisible = flag == CPU_BUFFER || flag == SHARED_BUFFER || flag == PINNED_BUFFER;
+		if (!hostVisible && staging == nullptr) {
+			VkResult result = manager->allocatePinned(stagingSize, &staging);
+			if (result != VK_SUCCESS) {
+				staging = nullptr;
+				return result;
+			}
+		}
+		char* bytes = static_cast<char*>(data);
+		VkDeviceSize element = firstElement;
+		while (element < firstElement + count) {
+			DeviceMemoryBlock* segment = &segments[element >> segmentShift];
+			VkDeviceSize offset = (element & (segmentElements() - 1)) * elementSize;
+			VkDeviceSize size = std::min((firstElement + count - element) * elementSize, segment->size - offset);
+			if (hostVisible) {
+				VK_CHECK_RESULT(manager->blockMemoryCopy(segment, bytes, direction, offset, size));
+			}
+			else {
+				size = std::min(size, stagingSize);
+				DeviceMemoryBlock stagingBlock;
+				manager->pinnedBlock(staging, size, &stagingBlock);
+				VkBufferCopy region = {};
+				region.size = size;
+				if (direction == MEMORY_USER_TO_BLOCK) {
+					memcpy(staging, bytes, size);
+					region.dstOffset = offset;
+					VK_CHECK_RESULT(manager->stageMemoryRegions(&stagingBlock, segment, 1, &region));
+				}
+				else {
+					region.srcOffset = offset;
+					VK_CHECK_RESULT(manager->stageMemoryRegions(segment, &stagingBlock, 1, &region));
+					memcpy(bytes, staging, size);
+				}
+			}
+			bytes += size;
+			element += size / elementSize;
+		}
+		return VK_SUCCESS;
+	}
+
+public:
+	std::vector<DeviceMemoryBlock> segments;
+	BufferFlag flag;
+	VkDeviceSize elementCount;
+	uint32_t elementSize;
+	uint32_t segmentShift;
+	// Bytes per staging copy for device local segments
+	VkDeviceSize stagingSize;
+
+	// Largest power of two element count per segment within the device limits and maxSegmentBytes (0 for none)
+	static uint32_t segmentShiftFor(const DeviceProfile& profile, uint32_t elementSize, VkDeviceSize maxSegmentBytes = 0){
+		VkDeviceSize limit = profile.maxStorageBufferRange;
+		if (profile.maxMemoryAllocationSize > 0) {
+			limit = std::min(limit, profile.maxMemoryAllocationSize);
+		}
+		if (maxSegmentBytes > 0) {
+			limit = std::min(limit, maxSegmentBytes);
+		}
+		assert(limit >= elementSize);
+		return std::bit_width(limit / elementSize) - 1;
+	}
+
+	VkDeviceSize segmentElements() const {
+		return VkDeviceSize(1) << segmentShift;
+	}
+
+	uint32_t segmentCount() const {
+		return static_cast<uint32_t>(segments.size());
+	}
+
+	// The whole array, for KernelChain::dispatch
+	DeviceMemoryBlock* block(){
+		return &logical;
+	}
+
+	VkResult upload(const void* data, VkDeviceSize firstElement = 0, VkDeviceSize count = VK_WHOLE_SIZE){
+		return transfer(const_cast<void*>(data), firstElement, count, MEMORY_USER_TO_BLOCK);
+	}
+
+	VkResult download(void* data, VkDeviceSize firstElement = 0, VkDeviceSize count = VK_WHOLE_SIZE){
+		return transfer(data, firstElement, count, MEMORY_BLOCK_TO_USER);
+	}
+
+	SegmentedBuffer(ComputeManager* manager, BufferFlag flag, VkDeviceSize elementCount, uint32_t elementSize = sizeof(uint32_t),
+		VkDeviceSize maxSegmentBytes = 0, VkDeviceSize stagingSize = 64 << 20)
+		: manager(manager), flag(flag), elementCount(elementCount), elementSize(elementSize), stagingSize(stagingSize)
+	{
+		assert(elementCount > 0 && elementSize % 4 == 0);
+		segmentShift = segmentShiftFor(manager->profile, elementSize, maxSegmentBytes);
+		// Whole elements per staging copy
+		this->stagingSize = std::max<VkDeviceSize>(std::min(stagingSize, elementCount * elementSize) / elementSize, 1) * elementSize;
+		for (VkDeviceSize first = 0; first < elementCount; first += segmentElements()) {
+			DeviceMemoryBlock segment;
+			segment.size = std::min(segmentElements(), elementCount - first) * elementSize;
+			VK_CHECK_RESULT(manager->createBuffer(flag, &segment));
+			segments.push_back(segment);
+		}
+		logical = segments[0];
+		logical.segments = &segments;
+	}
+
+	~SegmentedBuffer()
+	{
+		if (staging) {
+			manager->freePinned(staging);
+		}
+		for (DeviceMemoryBlock& segment : segments) {
+			manager->clean(&segment);
+		}
+	}
+};
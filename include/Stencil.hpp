@@ -0,0 +1,316 @@
+#pragma once
+
+#include <vector>
+
+#include "KernelChain.hpp"
+#include <ShaderLaunchers.hpp>
+
+// What stencils and convolutions read outside the grid
+enum BoundaryMode{
+	BOUNDARY_CLAMP,
+	BOUNDARY_WRAP,
+	BOUNDARY_ZERO,
+	BOUNDARY_MIRROR
+};
+
+// Grid of float samples with x fastest, depth 1 for 2D grids
+struct GridExtent
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+
+	uint64_t voxels() const {
+		return (uint64_t)width * height * depth;
+	}
+
+	VkDeviceSize bytes() const {
+		return voxels() * sizeof(float);
+	}
+};
+
+// Input grid as an r32f storage image for GridStencils::stencilImage
+struct GridImage
+{
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+	GridExtent extent;
+};
+
+/*
+	2D / 3D stencils and separable convolutions on float grids in storage buffers.
+	Every workgroup loads its tile plus a halo of radius samples into shared memory once and computes from there,
+	instead of each invocation reading all of its neighbours from the buffer.
+	stencilImage() runs the same stencil on a storage image, whose tiled layout and texture cache can beat the
+	shared memory tile on large 3D grids; benchmarks/stencilThroughput.cpp compares both on the device at hand.
+*/
+class GridStencils
+{
+	ComputeManager* manager;
+	VkDescriptorPool imageDescriptorPool;
+	VkFence fence;
+
+	// PushConstants of convolve.comp, stencil.comp or stencil_image.comp, the three share the fields
+	template<typename PushConstants>
+	PushConstants parameters(GridExtent extent, const std::vector<float>& weights, uint32_t radius, BoundaryMode boundary, uint32_t axis){
+		PushConstants push = {};
+		push.width = extent.width;
+		push.height = extent.height;
+		push.depth = extent.depth;
+		push.radius = radius;
+		push.boundary = boundary;
+		push.axis = axis;
+		std::copy(weights.begin(), weights.end(), push.weights);
+		return push;
+	}
+
+	static uint32_t groups(uint32_t size, uint32_t localSize){
+		return (size + localSize - 1) / localSize;
+	}
+
+	// Records and submits on the manager's pool, waits for the fence
+	template<typename Record>
+	VkResult submit(Record record){
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(manager->commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+		VkCommandBuffer commandBuffer;
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &commandBuffer));
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		record(commandBuffer);
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+		VK_CHECK_RESULT(vkResetFences(manager->device, 1, &fence));
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		VK_CHECK_RESULT(manager->submitter.submit(1, &submitInfo, fence));
+		{
+			MetricTimer fenceTimer(METRIC_FENCE_WAIT_TIME);
+			uint64_t waitStart = JobTrace::instance().mark();
+			VK_CHECK_RESULT(vkWaitForFences(manager->device, 1, &fence, VK_TRUE, UINT64_MAX));
+			if (JobTrace::instance().enabled()) {
+				JobTrace::instance().wait(waitStart);
+			}
+		}
+		vkFreeCommandBuffers(manager->device, manager->commandPool, 1, &commandBuffer);
+		return VK_SUCCESS;
+	}
+
+public:
+	// Tile shapes: convolution along x, along y / z, 2D and 3D stencil
+	ComputeKernel convolutionX, convolutionYZ, stencil2D, stencil3D, stencilImage2D, stencilImage3D;
+	uint32_t convolutionLocalSize[2][2] = { { 128, 2 }, { 32, 8 } };
+	uint32_t stencil2DLocalSize[3] = { 16, 16, 1 };
+	uint32_t stencil3DLocalSize[3] = { 8, 8, 4 };
+	// Largest radius the shared memory tiles are sized for (the push constants hold 17 weights)
+	uint32_t maxConvolutionRadius = 8;
+	uint32_t maxStencilRadius = 4;
+
+	/*
+		1D convolution of input along axis (0 x, 1 y, 2 z) into output with 2 * radius + 1 weights,
+		weights[radius] is the centre sample.
+	*/
+	KernelChain& convolve(KernelChain& chain, DeviceMemoryBlock* input, DeviceMemoryBlock* output, GridExtent extent, uint32_t axis,
+		const std::vector<float>& weights, BoundaryMode boundary = BOUNDARY_CLAMP){
+		assert(weights.size() % 2 == 1 && weights.size() <= 2 * maxConvolutionRadius + 1 && axis < 3);
+		uint32_t radius = static_cast<uint32_t>(weights.size() / 2);
+		shaders::convolve::PushConstants push = parameters<shaders::convolve::PushConstants>(extent, weights, radius, boundary, axis);
+		const uint32_t* localSize = convolutionLocalSize[axis == 0 ? 0 : 1];
+		ComputeKernel* kernel = axis == 0 ? &convolutionX : &convolutionYZ;
+		uint32_t planeHeight = axis == 2 ? extent.depth : extent.height;
+		uint32_t remaining = axis == 2 ? extent.height : extent.depth;
+		return shaders::convolve::dispatch(chain, kernel, { input, output }, push, groups(extent.width, localSize[0]), groups(planeHeight, localSize[1]), remaining);
+	}
+
+	/*
+		The same 1D convolution along every axis of the grid (x, y, then z for 3D).
+		scratch has the size of the grid, input is left untouched.
+	*/
+	KernelChain& separable(KernelChain& chain, DeviceMemoryBlock* input, DeviceMemoryBlock* scratch, DeviceMemoryBlock* output, GridExtent extent,
+		const std::vector<float>& weights, BoundaryMode boundary = BOUNDARY_CLAMP){
+		if (extent.depth > 1) {
+			convolve(chain, input, output, extent, 0, weights, boundary);
+			convolve(chain, output, scratch, extent, 1, weights, boundary);
+			return convolve(chain, scratch, output, extent, 2, weights, boundary);
+		}
+		convolve(chain, input, scratch, extent, 0, weights, boundary);
+		return convolve(chain, scratch, output, extent, 1, weights, boundary);
+	}
+
+	/*
+		Star stencil: weights[0] times the centre plus weights[k] times the sum of the neighbours at distance k along each axis,
+		radius = weights.size() - 1. { -6, 1 } on a 3D grid is the 7-point Laplacian.
+	*/
+	KernelChain& stencil(KernelChain& chain, DeviceMemoryBlock* input, DeviceMemoryBlock* output, GridExtent extent,
+		const std::vector<float>& weights, BoundaryMode boundary = BOUNDARY_CLAMP){
+		assert(!weights.empty() && weights.size() <= maxStencilRadius + 1);
+		shaders::stencil::PushConstants push = parameters<shaders::stencil::PushConstants>(extent, weights, static_cast<uint32_t>(weights.size() - 1), boundary, 0);
+		bool volume = extent.depth > 1;
+		const uint32_t* localSize = volume ? stencil3DLocalSize : stencil2DLocalSize;
+		return shaders::stencil::dispatch(chain, volume ? &stencil3D : &stencil2D, { input, output }, push,
+			groups(extent.width, localSize[0]), groups(extent.height, localSize[1]), groups(extent.depth, localSize[2]));
+	}
+
+	// VK_ERROR_FORMAT_NOT_SUPPORTED when the grid exceeds the 3D image limits of the device
+	VkResult createImage(GridExtent extent, GridImage* image){
+		image->extent = extent;
+		const VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		VkImageFormatProperties formatProperties;
+		VkResult result = vkGetPhysicalDeviceImageFormatProperties(manager->physicalDevice, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TYPE_3D, VK_IMAGE_TILING_OPTIMAL, usage, 0, &formatProperties);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		if (extent.width > formatProperties.maxExtent.width || extent.height > formatProperties.maxExtent.height || extent.depth > formatProperties.maxExtent.depth) {
+			return VK_ERROR_FORMAT_NOT_SUPPORTED;
+		}
+
+		VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_3D;
+		imageCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+		imageCreateInfo.extent = { extent.width, extent.height, extent.depth };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.usage = usage;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		result = vkCreateImage(manager->device, &imageCreateInfo, nullptr, &image->image);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(manager->device, image->image, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = manager->memoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		assert(memAlloc.memoryTypeIndex != UINT32_MAX);
+		result = vkAllocateMemory(manager->device, &memAlloc, nullptr, &image->memory);
+		if (result != VK_SUCCESS) {
+			vkDestroyImage(manager->device, image->image, nullptr);
+			return result;
+		}
+		VK_CHECK_RESULT(vkBindImageMemory(manager->device, image->image, image->memory, 0));
+		Metrics::instance().count(METRIC_BYTES_ALLOCATED, memAlloc.allocationSize);
+
+		VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+		viewCreateInfo.image = image->image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+		viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+		viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		VK_CHECK_RESULT(vkCreateImageView(manager->device, &viewCreateInfo, nullptr, &image->view));
+		return VK_SUCCESS;
+	}
+
+	void destroyImage(GridImage* image){
+		vkDestroyImageView(manager->device, image->view, nullptr);
+		vkDestroyImage(manager->device, image->image, nullptr);
+		vkFreeMemory(manager->device, image->memory, nullptr);
+	}
+
+	// Copies a grid from a buffer into the image and leaves it in VK_IMAGE_LAYOUT_GENERAL for stencilImage()
+	VkResult uploadImage(DeviceMemoryBlock* input, GridImage* image){
+		return submit([&](VkCommandBuffer commandBuffer) {
+			VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+			imageBarrier.image = image->image;
+			imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			// Earlier stencils may still read the old contents
+			imageBarrier.srcAccessMask = 0;
+			imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+			VkBufferImageCopy region = {};
+			region.bufferOffset = input->offset;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.imageExtent = { image->extent.width, image->extent.height, image->extent.depth };
+			vkCmdCopyBufferToImage(commandBuffer, input->buffer, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			Metrics::instance().count(METRIC_BYTES_STAGED, image->extent.bytes());
+
+			imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+		});
+	}
+
+	// stencil() reading the grid from an uploaded image, as a submission of its own
+	VkResult stencilImage(GridImage* image, DeviceMemoryBlock* output, const std::vector<float>& weights, BoundaryMode boundary = BOUNDARY_CLAMP){
+		assert(!weights.empty() && weights.size() <= 17);
+		bool volume = image->extent.depth > 1;
+		ComputeKernel* kernel = volume ? &stencilImage3D : &stencilImage2D;
+		shaders::stencil_image::PushConstants push = parameters<shaders::stencil_image::PushConstants>(image->extent, weights, static_cast<uint32_t>(weights.size() - 1), boundary, 0);
+		VK_CHECK_RESULT(vkResetDescriptorPool(manager->device, imageDescriptorPool, 0));
+		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(imageDescriptorPool, &kernel->descriptorSetLayout, 1);
+		VkDescriptorSet descriptorSet;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSet));
+		VkDescriptorImageInfo imageDescriptor = vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, image->view, VK_IMAGE_LAYOUT_GENERAL);
+		VkDescriptorBufferInfo bufferDescriptor = output->descriptor();
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageDescriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &bufferDescriptor),
+		};
+		vkUpdateDescriptorSets(manager->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		const uint32_t* localSize = volume ? stencil3DLocalSize : stencil2DLocalSize;
+		uint64_t traceStart = JobTrace::instance().mark();
+		VkResult result = submit([&](VkCommandBuffer commandBuffer) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+			vkCmdPushConstants(commandBuffer, kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+			vkCmdDispatch(commandBuffer, groups(image->extent.width, localSize[0]), groups(image->extent.height, localSize[1]), groups(image->extent.depth, localSize[2]));
+			Metrics::instance().count(METRIC_DISPATCHES);
+
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		});
+		if (JobTrace::instance().enabled()) {
+			// Only buffer bindings can be recorded, replay counts the image dispatch as skipped
+			JobTrace::instance().submit(kernel, {}, groups(image->extent.width, localSize[0]), groups(image->extent.height, localSize[1]),
+				groups(image->extent.depth, localSize[2]), &push, sizeof(push), traceStart);
+		}
+		return result;
+	}
+
+	GridStencils(ComputeManager* manager) : manager(manager)
+	{
+		shaders::convolve::createKernel(manager, &convolutionX, { convolutionLocalSize[0][0], convolutionLocalSize[0][1], maxConvolutionRadius });
+		shaders::convolve::createKernel(manager, &convolutionYZ, { convolutionLocalSize[1][0], convolutionLocalSize[1][1], maxConvolutionRadius });
+		shaders::stencil::createKernel(manager, &stencil2D, { stencil2DLocalSize[0], stencil2DLocalSize[1], stencil2DLocalSize[2], maxStencilRadius, 0 });
+		shaders::stencil::createKernel(manager, &stencil3D, { stencil3DLocalSize[0], stencil3DLocalSize[1], stencil3DLocalSize[2], maxStencilRadius, 1 });
+		// The 3D tile has to fit the shared memory of the device
+		assert((stencil3DLocalSize[0] + 2 * maxStencilRadius) * (stencil3DLocalSize[1] + 2 * maxStencilRadius) * (stencil3DLocalSize[2] + 2 * maxStencilRadius) * sizeof(float)
+			<= manager->profile.maxComputeSharedMemorySize);
+		shaders::stencil_image::createKernel(manager, &stencilImage2D, { stencil2DLocalSize[0], stencil2DLocalSize[1], stencil2DLocalSize[2] });
+		shaders::stencil_image::createKernel(manager, &stencilImage3D, { stencil3DLocalSize[0], stencil3DLocalSize[1], stencil3DLocalSize[2] });
+
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &imageDescriptorPool));
+		VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+		VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &fence));
+	}
+
+	~GridStencils()
+	{
+		vkDestroyFence(manager->device, fence, nullptr);
+		vkDestroyDescriptorPool(manager->device, imageDescriptorPool, nullptr);
+		manager->destroyKernel(&stencilImage3D);
+		manager->destroyKernel(&stencilImage2D);
+		manager->destroyKernel(&stencil3D);
+		manager->destroyKernel(&stencil2D);
+		manager->destroyKernel(&convolutionYZ);
+		manager->destroyKernel(&convolutionX);
+	}
+};
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "ComputeManager.hpp"
+
+enum JobClass{
+	// Latency sensitive, runs on the priority queue and is never split
+	JOB_INTERACTIVE,
+	// Throughput work, runs on the normal queue in chunks of batchChunkGroups work groups
+	JOB_BATCH
+};
+
+struct TenantJob
+{
+	uint32_t tenant = 0;
+	JobClass jobClass = JOB_BATCH;
+	ComputeKernel* kernel = nullptr;
+	std::vector<DeviceMemoryBlock*> bindings;
+	std::vector<uint8_t> pushConstants;
+	// One dimensional, chunks are cut along x with vkCmdDispatchBase so gl_GlobalInvocationID stays correct
+	// (only for kernels whose pipelineFlags include VK_PIPELINE_CREATE_DISPATCH_BASE_BIT, as createKernel sets)
+	uint32_t groupCountX = 1;
+	// Jobs whose deadline is within deadlineHorizon run before fair share order, earliest first
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+	// Called from the dispatcher thread once the last chunk has completed
+	std::function<void(VkResult)> done;
+};
+
+/*
+	Host side scheduler for several tenants sharing one device. Interactive and batch jobs have a lane each, with its own
+	dispatcher thread, on the priority queue and on the normal queue respectively (see ComputeManager::priorityQueue).
+	Within a lane tenants get work group time in proportion to their weight (start time fair queuing), unless a job is
+	close to its deadline. Batch jobs are cut into chunks and the lane picks again after every chunk, so when both lanes
+	end up on one queue an interactive job waits for at most one chunk instead of a whole batch job.
+*/
+class TenantScheduler
+{
+	struct QueuedJob
+	{
+		TenantJob job;
+		uint32_t nextGroup;
+		std::chrono::steady_clock::time_point submitted;
+	};
+
+	struct Tenant
+	{
+		std::deque<QueuedJob> jobs;
+		// Work groups dispatched so far divided by the weight, the tenant with the lowest goes next
+		double virtualTime = 0.0;
+	};
+
+	struct Lane
+	{
+		bool highPriority;
+		VkCommandPool commandPool;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		VkDescriptorPool descriptorPool;
+		std::map<uint32_t, Tenant> tenants;
+		// Start tag of the chunk that ran last, idle tenants catch up to it instead of keeping old credit
+		double virtualClock = 0.0;
+		std::thread thread;
+	};
+
+	ComputeManager* manager;
+	Lane lanes[2];
+	std::map<uint32_t, double> weights;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	double weight(uint32_t tenant){
+		auto found = weights.find(tenant);
+		return found == weights.end() ? 1.0 : found->second;
+	}
+
+	// Next tenant to run on the lane, nullptr when the lane is empty
+	Tenant* pick(Lane& lane){
+		Tenant* fairest = nullptr;
+		Tenant* earliest = nullptr;
+		for (auto& [id, tenant] : lane.tenants) {
+			if (tenant.jobs.empty()) {
+				continue;
+			}
+			if (!fairest || tenant.virtualTime < fairest->virtualTime) {
+				fairest = &tenant;
+			}
+			if (!earliest || tenant.jobs.front().job.deadline < earliest->jobs.front().job.deadline) {
+				earliest = &tenant;
+			}
+		}
+		if (earliest && earliest->jobs.front().job.deadline - std::chrono::steady_clock::now() <= deadlineHorizon) {
+			return earliest;
+		}
+		return fairest;
+	}
+
+	VkResult runChunk(Lane& lane, TenantJob& job, uint32_t baseGroup, uint32_t groupCount){
+		uint64_t traceStart = JobTrace::instance().mark();
+		VkDescriptorSet descriptorSet;
+		VkDescriptorSetAllocateInfo allocInfo =
+			vks::initializers::descriptorSetAllocateInfo(lane.descriptorPool, &job.kernel->descriptorSetLayout, 1);
+		VkResult result = vkAllocateDescriptorSets(manager->device, &allocInfo, &descriptorSet);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		std::vector<VkDescriptorBufferInfo> bufferDescriptors(job.bindings.size());
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets(job.bindings.size());
+		for (uint32_t i = 0; i < job.bindings.size(); i++) {
+			bufferDescriptors[i] = job.bindings[i]->descriptor();
+			writeDescriptorSets[i] = vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, i, &bufferDescriptors[i]);
+		}
+		vkUpdateDescriptorSets(manager->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(lane.commandBuffer, &cmdBufInfo));
+		// Host writes and uploads before, host reads after, as in KernelChain
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(lane.commandBuffer, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		vkCmdBindPipeline(lane.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, job.kernel->pipeline);
+		vkCmdBindDescriptorSets(lane.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, job.kernel->pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+		if (!job.pushConstants.empty()) {
+			vkCmdPushConstants(lane.commandBuffer, job.kernel->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, static_cast<uint32_t>(job.pushConstants.size()), job.pushConstants.data());
+		}
+		assert(baseGroup == 0 || (job.kernel->pipelineFlags & VK_PIPELINE_CREATE_DISPATCH_BASE_BIT));
+		vkCmdDispatchBase(lane.commandBuffer, baseGroup, 0, 0, groupCount, 1, 1);
+		Metrics::instance().count(METRIC_DISPATCHES);
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(lane.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_FLAGS_NONE, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		VK_CHECK_RESULT(vkEndCommandBuffer(lane.commandBuffer));
+
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &lane.commandBuffer;
+		{
+			MetricTimer timer(METRIC_COMPUTE_TIME);
+			result = manager->submitterFor(lane.highPriority).submit(1, &submitInfo, lane.fence);
+			uint64_t waitStart = JobTrace::instance().mark();
+			if (result == VK_SUCCESS) {
+				result = vkWaitForFences(manager->device, 1, &lane.fence, VK_TRUE, UINT64_MAX);
+			}
+			if (JobTrace::instance().enabled()) {
+				// A chunk replays as a dispatch of its group count from group 0
+				JobTrace::instance().wait(waitStart);
+				JobTrace::instance().submit(job.kernel, job.bindings, groupCount, 1, 1, job.pushConstants.data(), static_cast<uint32_t>(job.pushConstants.size()), traceStart);
+			}
+		}
+		vkResetFences(manager->device, 1, &lane.fence);
+		vkResetCommandBuffer(lane.commandBuffer, 0);
+		vkResetDescriptorPool(manager->device, lane.descriptorPool, 0);
+		return result;
+	}
+
+	void dispatcherLoop(Lane* lane){
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			Tenant* tenant = nullptr;
+			condition.wait(lock, [&] { tenant = pick(*lane); return stopping || tenant != nullptr; });
+			if (!tenant) {
+				break;
+			}
+			// The job stays at the head of its tenant while it runs, submit only appends
+			QueuedJob& queued = tenant->jobs.front();
+			uint32_t baseGroup = queued.nextGroup;
+			uint32_t groupCount = queued.job.groupCountX - baseGroup;
+			// Pipelines built without VK_PIPELINE_CREATE_DISPATCH_BASE_BIT cannot start at a base group, they run whole
+			if (!lane->highPriority && (queued.job.kernel->pipelineFlags & VK_PIPELINE_CREATE_DISPATCH_BASE_BIT)) {
+				groupCount = std::min(groupCount, batchChunkGroups);
+			}
+			lane->virtualClock = tenant->virtualTime;
+			tenant->virtualTime += groupCount / weight(queued.job.tenant);
+
+			lock.unlock();
+			VkResult result = runChunk(*lane, queued.job, baseGroup, groupCount);
+			lock.lock();
+
+			queued.nextGroup += groupCount;
+			if (result != VK_SUCCESS || queued.nextGroup == queued.job.groupCountX) {
+				QueuedJob finished = std::move(queued);
+				tenant->jobs.pop_front();
+				lock.unlock();
+				Metrics::instance().record(METRIC_JOB_LATENCY,
+					std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - finished.submitted).count());
+				if (finished.job.done) {
+					finished.job.done(result);
+				}
+				lock.lock();
+			}
+		}
+	}
+
+public:
+	// Work groups per batch chunk, smaller bounds interactive latency better but costs a submission per chunk
+	uint32_t batchChunkGroups;
+	// How close a deadline has to be before it overrides fair share order
+	std::chrono::steady_clock::duration deadlineHorizon = std::chrono::milliseconds(5);
+
+	// Relative share of a tenant (1.0 by default), applies to both lanes
+	void setWeight(uint32_t tenant, double weight){
+		assert(weight > 0.0);
+		std::lock_guard<std::mutex> lock(mutex);
+		weights[tenant] = weight;
+	}
+
+	// Thread safe, buffers and push constants stay in use until done is called
+	void submit(TenantJob job){
+		assert(job.kernel && job.bindings.size() == job.kernel->bindingCount && job.groupCountX > 0);
+		assert(job.pushConstants.size() == job.kernel->pushConstantSize);
+		// Array bindings (SegmentedBuffer) go through KernelChain
+		assert(job.kernel->descriptorCounts.empty());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Lane& lane = lanes[job.jobClass == JOB_INTERACTIVE ? 0 : 1];
+			Tenant& tenant = lane.tenants[job.tenant];
+			if (tenant.jobs.empty()) {
+				tenant.virtualTime = std::max(tenant.virtualTime, lane.virtualClock);
+			}
+			tenant.jobs.push_back({ std::move(job), 0, std::chrono::steady_clock::now() });
+		}
+		condition.notify_all();
+	}
+
+	TenantScheduler(ComputeManager* manager, uint32_t batchChunkGroups = 256, uint32_t maxBindings = 8)
+		: manager(manager), batchChunkGroups(batchChunkGroups)
+	{
+		for (uint32_t i = 0; i < 2; i++) {
+			Lane& lane = lanes[i];
+			lane.highPriority = i == 0;
+			VkCommandPoolCreateInfo cmdPoolInfo = {};
+			cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			cmdPoolInfo.queueFamilyIndex = lane.highPriority ? manager->priorityQueueFamilyIndex : manager->queueFamilyIndex;
+			cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			VK_CHECK_RESULT(vkCreateCommandPool(manager->device, &cmdPoolInfo, nullptr, &lane.commandPool));
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+				vks::initializers::commandBufferAllocateInfo(lane.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(manager->device, &cmdBufAllocateInfo, &lane.commandBuffer));
+			VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
+			VK_CHECK_RESULT(vkCreateFence(manager->device, &fenceInfo, nullptr, &lane.fence));
+			std::vector<VkDescriptorPoolSize> poolSizes = {
+				vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxBindings),
+			};
+			VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(manager->device, &descriptorPoolInfo, nullptr, &lane.descriptorPool));
+		}
+		for (Lane& lane : lanes) {
+			lane.thread = std::thread(&TenantScheduler::dispatcherLoop, this, &lane);
+		}
+	}
+
+	// Finishes every queued job before returning
+	~TenantScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (Lane& lane : lanes) {
+			lane.thread.join();
+			vkDestroyDescriptorPool(manager->device, lane.descriptorPool, nullptr);
+			vkDestroyFence(manager->device, lane.fence, nullptr);
+			vkDestroyCommandPool(manager->device, lane.commandPool, nullptr);
+		}
+	}
+};
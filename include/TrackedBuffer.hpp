@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+#include "ComputeManager.hpp"
+
+// Byte range within a buffer
+struct BufferRange
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+};
+
+/*
+	Device buffer with a persistently mapped staging copy that remembers which parts the host changed.
+	Writes mark granules of granularity bytes dirty, upload() flushes and copies only the dirty granules,
+	coalesced into contiguous ranges and recorded as a single multi-region copy.
+	read() copies back only the requested ranges the same way.
+*/
+class TrackedBuffer
+{
+	ComputeManager* manager;
+	std::vector<uint64_t> dirtyBits;
+	char* mapped = nullptr;
+
+	size_t granuleCount() const {
+		return static_cast<size_t>((size + granularity - 1) / granularity);
+	}
+
+	// Expands a range to nonCoherentAtomSize as flush and invalidate require, clamped to the allocation
+	VkMappedMemoryRange atomRange(VkDeviceSize offset, VkDeviceSize rangeSize) const {
+		VkDeviceSize atom = std::max<VkDeviceSize>(manager->profile.nonCoherentAtomSize, 1);
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory.memory;
+		mappedRange.offset = offset / atom * atom;
+		VkDeviceSize end = (offset + rangeSize + atom - 1) / atom * atom;
+		mappedRange.size = end >= size ? VK_WHOLE_SIZE : end - mappedRange.offset;
+		return mappedRange;
+	}
+
+	VkResult copyRanges(const std::vector<BufferRange>& ranges, bool toDevice){
+		std::vector<VkBufferCopy> regions(ranges.size());
+		for (size_t i = 0; i < ranges.size(); i++) {
+			regions[i].srcOffset = ranges[i].offset;
+			regions[i].dstOffset = ranges[i].offset;
+			regions[i].size = ranges[i].size;
+		}
+		if (toDevice) {
+			return manager->stageMemoryRegions(&hostMemory, &deviceMemory, static_cast<uint32_t>(regions.size()), regions.data());
+		}
+		return manager->stageMemoryRegions(&deviceMemory, &hostMemory, static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+public:
+	DeviceMemoryBlock hostMemory, deviceMemory;
+	VkDeviceSize size;
+	// Bytes covered by one dirty bit
+	VkDeviceSize granularity;
+	// Dirty runs separated by at most this many clean granules upload as one region
+	uint32_t mergeGap = 0;
+
+	// Mapped staging memory, writes through it must be reported with markDirty()
+	void* data(){
+		return mapped;
+	}
+
+	void markDirty(VkDeviceSize offset, VkDeviceSize rangeSize){
+		if (rangeSize == 0) {
+			return;
+		}
+		assert(offset + rangeSize <= size);
+		size_t first = static_cast<size_t>(offset / granularity);
+		size_t last = static_cast<size_t>((offset + rangeSize - 1) / granularity);
+		for (size_t g = first; g <= last; g++) {
+			dirtyBits[g / 64] |= 1ull << (g % 64);
+		}
+	}
+
+	void markAllDirty(){
+		markDirty(0, size);
+	}
+
+	// Copies into staging memory and marks the range
+	void write(VkDeviceSize offset, const void* source, VkDeviceSize rangeSize){
+		memcpy(mapped + offset, source, rangeSize);
+		markDirty(offset, rangeSize);
+	}
+
+	// Coalesced dirty ranges in ascending order
+	std::vector<BufferRange> dirtyRanges() const {
+		std::vector<BufferRange> ranges;
+		size_t count = granuleCount();
+		size_t g = 0;
+		while (g < count) {
+			uint64_t word = dirtyBits[g / 64] >> (g % 64);
+			if (word == 0) {
+				// Skip the clean rest of this word
+				g = (g / 64 + 1) * 64;
+				continue;
+			}
+			g += std::countr_zero(word);
+			if (g >= count) {
+				break;
+			}
+			size_t start = g;
+			while (g < count && (dirtyBits[g / 64] >> (g % 64)) & 1) {
+				g++;
+			}
+			VkDeviceSize offset = start * granularity;
+			VkDeviceSize end = std::min<VkDeviceSize>(g * granularity, size);
+			if (!ranges.empty() && offset - (ranges.back().offset + ranges.back().size) <= mergeGap * granularity) {
+				ranges.back().size = end - ranges.back().offset;
+			}
+			else {
+				ranges.push_back({ offset, end - offset });
+			}
+		}
+		return ranges;
+	}
+
+	// Flushes and copies the dirty ranges to the device in one submission, returns the bytes copied through uploaded
+	VkResult upload(VkDeviceSize* uploaded = nullptr){
+		std::vector<BufferRange> ranges = dirtyRanges();
+		VkDeviceSize bytes = 0;
+		if (!ranges.empty()) {
+			std::vector<VkMappedMemoryRange> mappedRanges;
+			for (const BufferRange& range : ranges) {
+				mappedRanges.push_back(atomRange(range.offset, range.size));
+				bytes += range.size;
+			}
+			VK_CHECK_RESULT(vkFlushMappedMemoryRanges(manager->device, static_cast<uint32_t>(mappedRanges.size()), mappedRanges.data()));
+			VK_CHECK_RESULT(copyRanges(ranges, true));
+			std::fill(dirtyBits.begin(), dirtyBits.end(), 0);
+		}
+		if (uploaded != nullptr) {
+			*uploaded = bytes;
+		}
+		return VK_SUCCESS;
+	}
+
+	// Copies the ranges back from the device in one submission, they are then readable through data()
+	VkResult read(const std::vector<BufferRange>& ranges){
+		if (ranges.empty()) {
+			return VK_SUCCESS;
+		}
+		VK_CHECK_RESULT(copyRanges(ranges, false));
+		std::vector<VkMappedMemoryRange> mappedRanges;
+		for (const BufferRange& range : ranges) {
+			assert(range.offset + range.size <= size);
+			mappedRanges.push_back(atomRange(range.offset, range.size));
+		}
+		return vkInvalidateMappedMemoryRanges(manager->device, static_cast<uint32_t>(mappedRanges.size()), mappedRanges.data());
+	}
+
+	// Reads one range from the device into destination
+	VkResult read(VkDeviceSize offset, void* destination, VkDeviceSize rangeSize){
+		VK_CHECK_RESULT(read({ { offset, rangeSize } }));
+		memcpy(destination, mapped + offset, rangeSize);
+		return VK_SUCCESS;
+	}
+
+	// granularity of 0 tracks 4096 byte pages
+	TrackedBuffer(ComputeManager* manager, VkDeviceSize size, VkDeviceSize granularity = 0)
+		: manager(manager), size(size), granularity(granularity == 0 ? 4096 : granularity)
+	{
+		hostMemory.size = size;
+		deviceMemory.size = size;
+		VK_CHECK_RESULT(manager->createBuffer(CPU_BUFFER, &hostMemory));
+		VK_CHECK_RESULT(manager->createBuffer(GPU_BUFFER, &deviceMemory));
+		void* pointer;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &pointer));
+		mapped = static_cast<char*>(pointer);
+		dirtyBits.assign((granuleCount() + 63) / 64, 0);
+	}
+
+	~TrackedBuffer()
+	{
+		vkUnmapMemory(manager->device, hostMemory.memory);
+		manager->clean(&deviceMemory);
+		manager->clean(&hostMemory);
+	}
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+
+#include "ComputeManager.hpp"
+
+// Device buffer of count elements of T, either owning its memory or a view created by BufferPack
+template<typename T>
+struct TypedBuffer
+{
+	DeviceMemoryBlock block;
+	size_t count = 0;
+
+	VkDeviceSize bytes() const {
+		return count * sizeof(T);
+	}
+
+	VkResult create(ComputeManager* manager, BufferFlag flag, size_t elementCount){
+		count = elementCount;
+		block.size = bytes();
+		block.offset = 0;
+		return manager->createBuffer(flag, &block);
+	}
+};
+
+/*
+	Lays out several arrays in one device allocation, each at a multiple of minStorageBufferOffsetAlignment.
+	All inputs upload with a single multi-region vkCmdCopyBuffer through one staging buffer, and all
+	outputs read back the same way, so a job with many arrays costs one allocation and one copy each way.
+
+	BufferPack pack(manager);
+	pack.add(&a, n, aData).add(&b, n, bData).add(&result, n, nullptr, resultData);
+	pack.create();
+	pack.upload();
+	// dispatch with bindings { &a.block, &b.block, &result.block }, each bound to its own range
+	pack.download();
+*/
+class BufferPack
+{
+	struct Member
+	{
+		DeviceMemoryBlock* view;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		// Bytes of input / output, size rounded up to 4
+		VkDeviceSize dataSize;
+		const void* input;
+		void* output;
+	};
+
+	ComputeManager* manager;
+	std::vector<Member> members;
+	VkDeviceSize totalSize = 0;
+	bool created = false;
+
+	VkResult copy(bool toDevice){
+		std::vector<VkBufferCopy> regions;
+		for (const Member& member : members) {
+			if ((toDevice ? member.input : member.output) != nullptr) {
+				VkBufferCopy region = {};
+				region.srcOffset = member.offset;
+				region.dstOffset = member.offset;
+				region.size = member.size;
+				regions.push_back(region);
+			}
+		}
+		if (regions.empty()) {
+			return VK_SUCCESS;
+		}
+		if (toDevice) {
+			return manager->stageMemoryRegions(&hostMemory, &deviceMemory, static_cast<uint32_t>(regions.size()), regions.data());
+		}
+		return manager->stageMemoryRegions(&deviceMemory, &hostMemory, static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+public:
+	// Staging and device allocations holding every member
+	DeviceMemoryBlock hostMemory, deviceMemory;
+
+	// Reserves count elements for view, input is uploaded by upload() and output filled by download(), both optional
+	template<typename T>
+	BufferPack& add(TypedBuffer<T>* view, size_t count, const std::type_identity_t<T>* input = nullptr, std::type_identity_t<T>* output = nullptr){
+		assert(!created);
+		view->count = count;
+		return add(&view->block, count * sizeof(T), input, output);
+	}
+
+	BufferPack& add(DeviceMemoryBlock* view, VkDeviceSize size, const void* input = nullptr, void* output = nullptr){
+		assert(!created);
+		VkDeviceSize alignment = std::max<VkDeviceSize>(manager->profile.minStorageBufferOffsetAlignment, 4);
+		VkDeviceSize offset = (totalSize + alignment - 1) / alignment * alignment;
+		// Storage buffer ranges stay a multiple of 4 bytes
+		VkDeviceSize alignedSize = (size + 3) & ~VkDeviceSize(3);
+		members.push_back({ view, offset, alignedSize, size, input, output });
+		totalSize = offset + alignedSize;
+		return *this;
+	}
+
+	// Allocates both buffers and points every view at its range of deviceMemory
+	VkResult create(){
+		assert(!created && !members.empty());
+		hostMemory.size = totalSize;
+		deviceMemory.size = totalSize;
+		VkResult result = manager->createBuffer(CPU_BUFFER, &hostMemory);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		result = manager->createBuffer(GPU_BUFFER, &deviceMemory);
+		if (result != VK_SUCCESS) {
+			manager->clean(&hostMemory);
+			return result;
+		}
+		for (Member& member : members) {
+			member.view->buffer = deviceMemory.buffer;
+			member.view->memory = deviceMemory.memory;
+			member.view->offset = member.offset;
+			member.view->size = member.size;
+		}
+		created = true;
+		return VK_SUCCESS;
+	}
+
+	// Gathers all inputs into the staging buffer with one mapping, then one copy to the device
+	VkResult upload(){
+		assert(created);
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		VkDeviceSize bytes = 0;
+		for (const Member& member : members) {
+			if (member.input != nullptr) {
+				memcpy(static_cast<char*>(mapped) + member.offset, member.input, member.dataSize);
+				bytes += member.dataSize;
+			}
+		}
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory.memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(manager->device, 1, &mappedRange);
+		vkUnmapMemory(manager->device, hostMemory.memory);
+		Metrics::instance().count(METRIC_BYTES_HOST_COPIED, bytes);
+		return copy(true);
+	}
+
+	// One copy of all outputs back to staging, then scatters them into the output pointers
+	VkResult download(){
+		assert(created);
+		VK_CHECK_RESULT(copy(false));
+		void* mapped;
+		VK_CHECK_RESULT(vkMapMemory(manager->device, hostMemory.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+		VkMappedMemoryRange mappedRange = vks::initializers::mappedMemoryRange();
+		mappedRange.memory = hostMemory.memory;
+		mappedRange.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(manager->device, 1, &mappedRange);
+		VkDeviceSize bytes = 0;
+		for (const Member& member : members) {
+			if (member.output != nullptr) {
+				memcpy(member.output, static_cast<const char*>(mapped) + member.offset, member.dataSize);
+				bytes += member.dataSize;
+			}
+		}
+		vkUnmapMemory(manager->device, hostMemory.memory);
+		Metrics::instance().count(METRIC_BYTES_HOST_COPIED, bytes);
+		return VK_SUCCESS;
+	}
+
+	BufferPack(ComputeManager* manager) : manager(manager) {}
+
+	// Views are not cleaned separately, they go away with the pack
+	~BufferPack()
+	{
+		if (created) {
+			manager->clean(&deviceMemory);
+			manager->clean(&hostMemory);
+		}
+	}
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 #define VK_FLAGS_NONE 0 
 
 #define VK_CHECK_RESULT(f)																				\
@@ -6,6 +8,7 @@
 	if (res != VK_SUCCESS)																				\
 	{																									\
 		std::cout << "Fatal : VkResult is \"" << res << "\" in " << __FILE__ << " at line " << __LINE__ << "\n"; \
+		Metrics::instance().count(METRIC_VK_ERRORS);																\
 		assert(res == VK_SUCCESS);																		\
 	}																									\
 }
@@ -13,6 +16,16 @@
 #include <iostream>
 #include <stdexcept>
 #include <fstream>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Metrics.hpp"
 
 #include <vulkan/vulkan.h>
 
@@ -21,6 +34,30 @@ struct DeviceMemoryBlock
 	VkBuffer buffer;
 	VkDeviceMemory memory;
 	VkDeviceSize size;
+	// Non-zero for views into a shared buffer (see BufferPack), buffers are bound at memory offset 0
+	VkDeviceSize offset = 0;
+	// Set on the block standing for a whole SegmentedBuffer, bound to an array binding one descriptor per segment
+	const std::vector<DeviceMemoryBlock>* segments = nullptr;
+
+	VkDescriptorBufferInfo descriptor() const {
+		return { buffer, offset, size };
+	}
+};
+
+struct ComputeKernel
+{
+	VkShaderModule shaderModule;
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	uint32_t bindingCount;
+	uint32_t pushConstantSize;
+	// Descriptors per binding, empty when every binding is a single descriptor
+	std::vector<uint32_t> descriptorCounts;
+	// As passed to createKernel, variants of the kernel are built with the same flags
+	VkPipelineShaderStageCreateFlags stageFlags = 0;
+	uint32_t requiredSubgroupSize = 0;
+	VkPipelineCreateFlags pipelineFlags = 0;
 };
 
 enum MemoryCopyFlag{
@@ -30,11 +67,52 @@ enum MemoryCopyFlag{
 
 enum BufferFlag{
 	CPU_BUFFER,
-	GPU_BUFFER
+	GPU_BUFFER,
+	INDIRECT_BUFFER,
+	SHARED_BUFFER,
+	PINNED_BUFFER
 };
 
+VkShaderModule createShaderModule(const uint32_t* code, size_t size, VkDevice device)
+{
+	VkShaderModule shaderModule;
+	VkShaderModuleCreateInfo moduleCreateInfo{};
+	moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleCreateInfo.codeSize = size;
+	moduleCreateInfo.pCode = code;
+
+	VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, NULL, &shaderModule));
+
+	return shaderModule;
+}
+
 VkShaderModule loadShader(const char *fileName, VkDevice device)
 {
+#ifdef __linux__
+	// The driver reads the SPIR-V straight from the page cache, no copy into a heap buffer
+	int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+	struct stat fileStat;
+	if (fd >= 0 && fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		size_t size = static_cast<size_t>(fileStat.st_size);
+		void* shaderCode = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (shaderCode == MAP_FAILED)
+		{
+			std::cerr << "Error: Could not map shader file \"" << fileName << "\"" << "\n";
+			return VK_NULL_HANDLE;
+		}
+		VkShaderModule shaderModule = createShaderModule(static_cast<const uint32_t*>(shaderCode), size, device);
+		munmap(shaderCode, size);
+		return shaderModule;
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	std::cerr << "Error: Could not open shader file \"" << fileName << "\"" << "\n";
+	return VK_NULL_HANDLE;
+#else
 	std::ifstream is(fileName, std::ios::binary | std::ios::in | std::ios::ate);
 
 	if (is.is_open())
@@ -64,4 +142,5 @@ VkShaderModule loadShader(const char *fileName, VkDevice device)
 		std::cerr << "Error: Could not open shader file \"" << fileName << "\"" << "\n";
 		return VK_NULL_HANDLE;
 	}
-}
\ No newline at end of file
+#endif
+}
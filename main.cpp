@@ -1,39 +1,162 @@
 #include<ComputeManager.hpp>
+#include<PinnedVector.hpp>
+#ifdef __linux__
+#include<JobServer.hpp>
+#include<FileStream.hpp>
+#endif
 
 #define BUFFER_ELEMENTS 32
 
+static MetricFormat metricsFormat(CommandLineParser& parser) {
+	return parser.getValueAsString("metricsformat", "prometheus") == "json" ? METRIC_FORMAT_JSON : METRIC_FORMAT_PROMETHEUS;
+}
+
+#ifdef __linux__
+// Keeps the device, kernel and buffers warm and serves jobs over a Unix domain socket until SIGINT / SIGTERM
+static int runDaemon(CommandLineParser& parser) {
+	uint32_t maxElements = parser.getValueAsInt("elements", BUFFER_ELEMENTS);
+	std::string kernelName = parser.getValueAsString("kernel", "headless.comp.spv");
+	ComputeManager *manager = new ComputeManager(parser.getValueAsString("cache", ""));
+
+	// Constant 0 is the element count of the bundled kernels, unused constant IDs are ignored
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &maxElements);
+	ComputeKernel kernel;
+	manager->createKernel(kernelName.c_str(), 1, &kernel, 0, &specializationInfo);
+
+	JobServer *server = new JobServer(manager, &kernel,
+		parser.getValueAsString("socket", "/tmp/vkhpc.sock"),
+		maxElements,
+		parser.getValueAsInt("queuedepth", 4),
+		parser.getValueAsInt("localsize", 1));
+	server->metricsTarget = parser.getValueAsString("metrics", "");
+	server->metricsFormat = metricsFormat(parser);
+	int status = server->run();
+	delete(server);
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return status;
+}
+
+// Sends one job with the same input as the default mode to a running daemon
+static int runClient(CommandLineParser& parser) {
+	uint32_t elementCount = parser.getValueAsInt("elements", BUFFER_ELEMENTS);
+	JobClient client(parser.getValueAsString("socket", "/tmp/vkhpc.sock"), elementCount);
+	if (!client.connected()) {
+		return 1;
+	}
+	for (uint32_t i = 0; i < elementCount; i++) {
+		client.payload()[i] = i;
+	}
+	JobReply reply;
+	VkResult result = client.submit(elementCount, &reply);
+	if (result != VK_SUCCESS) {
+		std::cerr << "Job failed: " << result << "\n";
+		return 1;
+	}
+	printf("Compute output (%.3f ms on server):\n", reply.elapsedNanoseconds / 1e6);
+	for (uint32_t i = 0; i < elementCount; i++) {
+		printf("%d \t", client.payload()[i]);
+	}
+	std::cout << std::endl;
+	return 0;
+}
+
+// Streams --input through the stream kernel into --output chunk by chunk
+static int runStream(CommandLineParser& parser) {
+	const size_t chunkSize = (size_t)parser.getValueAsInt("chunk", 16) << 20;
+	uint32_t localSize = 256;
+	ComputeManager *manager = new ComputeManager(parser.getValueAsString("cache", ""));
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("stream.comp.spv", 1, &kernel, sizeof(uint32_t), &specializationInfo);
+
+	FileStream *stream = new FileStream(manager, &kernel, chunkSize, 3, localSize);
+	StreamStats stats;
+	VkResult result = stream->run(parser.getValueAsString("input", ""), parser.getValueAsString("output", ""), &stats);
+	if (result == VK_SUCCESS) {
+		printf("%.2f MB in %u chunks, %.3f s, %.2f GB/s end to end (read %.3f s, gpu submit %.3f s, write %.3f s, O_DIRECT %d, io_uring %d)\n",
+			stats.bytes / 1e6, stats.chunks, stats.seconds, stats.gigabytesPerSecond(),
+			stats.readSeconds, stats.gpuSeconds, stats.writeSeconds, stats.directIO, stats.ioUring);
+	}
+	delete(stream);
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return result == VK_SUCCESS ? 0 : 1;
+}
+#endif
+
 int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("daemon", { "--daemon" }, false, "Serve jobs over a Unix domain socket (Linux only)");
+	parser.add("client", { "--client" }, false, "Send one job to a running daemon (Linux only)");
+	parser.add("socket", { "--socket" }, true, "Socket path (default: /tmp/vkhpc.sock)");
+	parser.add("elements", { "--elements" }, true, "Maximum elements per job (default: 32)");
+	parser.add("kernel", { "--kernel" }, true, "SPIR-V kernel served by the daemon (default: headless.comp.spv)");
+	parser.add("queuedepth", { "--queue-depth" }, true, "Jobs the daemon runs concurrently (default: 4)");
+	parser.add("localsize", { "--local-size" }, true, "Workgroup size of the served kernel (default: 1)");
+	parser.add("input", { "--input" }, true, "Stream this binary file of uint32 values through the GPU (Linux only)");
+	parser.add("output", { "--output" }, true, "Output file of --input");
+	parser.add("chunk", { "--chunk" }, true, "Streaming chunk size in MiB (default: 16)");
+	parser.add("metrics", { "--metrics" }, true, "Write runtime metrics to a file or unix:<socket path>");
+	parser.add("metricsformat", { "--metrics-format" }, true, "Metrics format, prometheus or json (default: prometheus)");
+	parser.add("cache", { "--cache" }, true, "Directory for the device selection and pipeline caches, speeds up later runs (default: none)");
+	parser.add("trace", { "--trace" }, true, "Record buffers, copies, dispatches and waits to this file for benchmarks/traceReplay");
+	parser.add("tracehashes", { "--trace-hashes" }, false, "Add hashes of the host payloads to the trace");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	if (parser.isSet("trace") && !JobTrace::instance().start(parser.getValueAsString("trace", ""), parser.isSet("tracehashes"))) {
+		return 1;
+	}
+	if (parser.isSet("daemon") || parser.isSet("client")) {
+#ifdef __linux__
+		return parser.isSet("daemon") ? runDaemon(parser) : runClient(parser);
+#else
+		std::cerr << "Error: Daemon mode is only available on Linux\n";
+		return 1;
+#endif
+	}
+
+	if (parser.isSet("input")) {
+#ifdef __linux__
+		return runStream(parser);
+#else
+		std::cerr << "Error: File streaming is only available on Linux\n";
+		return 1;
+#endif
+	}
+
+	const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
+	ComputeManager *manager = new ComputeManager(parser.getValueAsString("cache", ""));
+
 	/*
-		Prepare storage buffers
+		Prepare storage buffers, the vectors live in mapped memory the GPU copies from and into
 	*/
-	std::vector<uint32_t> computeInput(BUFFER_ELEMENTS);
-	std::vector<uint32_t> computeOutput(BUFFER_ELEMENTS);
+	PinnedVector<uint32_t> computeInput(BUFFER_ELEMENTS, PinnedAllocator<uint32_t>(manager));
+	PinnedVector<uint32_t> computeOutput(BUFFER_ELEMENTS, PinnedAllocator<uint32_t>(manager));
 
 	// Fill input data
 	uint32_t n = 0;
 	std::generate(computeInput.begin(), computeInput.end(), [&n] { return n++; });
 
-	const VkDeviceSize bufferSize = BUFFER_ELEMENTS * sizeof(uint32_t);
-	ComputeManager *manager = new ComputeManager();
-
-	// VkBuffer deviceBuffer, hostBuffer;
-	// VkDeviceMemory deviceMemory, hostMemory;
-	DeviceMemoryBlock hostMemory, deviceMemory;
-	hostMemory.size = bufferSize;
+	DeviceMemoryBlock hostInput = pinnedBlock(computeInput);
+	DeviceMemoryBlock hostOutput = pinnedBlock(computeOutput);
+	DeviceMemoryBlock deviceMemory;
 	deviceMemory.size = bufferSize;
-	manager->createBuffer(CPU_BUFFER, &hostMemory);
 	manager->createBuffer(GPU_BUFFER, &deviceMemory);
 
-	manager->blockMemoryCopy(&hostMemory, computeInput.data(), MEMORY_USER_TO_BLOCK);
-	manager->stageMemorycpy(&hostMemory, &deviceMemory);
+	manager->stageMemorycpy(&hostInput, &deviceMemory);
 	
 	manager->preparePipeline(&deviceMemory);
-	manager->compute(&hostMemory, &deviceMemory);
+	manager->compute(&hostInput, &deviceMemory);
 	
-	manager->stageMemorycpy(&deviceMemory, &hostMemory);
-	manager->blockMemoryCopy(&hostMemory, computeOutput.data(), MEMORY_BLOCK_TO_USER);
+	manager->stageMemorycpy(&deviceMemory, &hostOutput);
 	manager->clean(&deviceMemory);
-	manager->clean(&hostMemory);
 
 	// Output buffer contents
 	printf("Compute input:\n");
@@ -47,6 +170,12 @@ int main(int argc, char* argv[]) {
 		printf("%d \t", v);
 	}
 	std::cout << std::endl;
+	// Pinned storage goes back to the manager before it is destroyed
+	computeInput = PinnedVector<uint32_t>(PinnedAllocator<uint32_t>(manager));
+	computeOutput = PinnedVector<uint32_t>(PinnedAllocator<uint32_t>(manager));
 	delete(manager);
+	if (parser.isSet("metrics")) {
+		Metrics::instance().exportTo(parser.getValueAsString("metrics", ""), metricsFormat(parser));
+	}
 	return 0;
 }
@@ -0,0 +1,293 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <KernelChain.hpp>
+
+/*
+	Performance regression suite, one CTest test per case (see CMakeLists.txt). Every case runs jobs through the public
+	API and reports the median and the median absolute deviation of its samples, lower is better. Baselines are kept
+	per machine (host, device and driver) in perf/baselines; a case fails when its median is both more than --tolerance
+	percent and more than --sigmas robust standard deviations above the baseline.
+	Exit codes: 0 pass, 1 regression or wrong results, 77 no baseline for this machine yet (CTest reports a skip).
+*/
+
+#define PERF_SKIPPED 77
+
+struct PerfResult
+{
+	double median;
+	double mad;
+	uint32_t samples;
+};
+
+struct PerfCase
+{
+	const char* name;
+	const char* unit;
+	uint32_t warmup;
+	uint32_t samples;
+	// One sample, false when the results were wrong
+	std::function<bool(ComputeManager*, double*)> run;
+};
+
+static double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	size_t middle = values.size() / 2;
+	return values.size() % 2 ? values[middle] : 0.5 * (values[middle - 1] + values[middle]);
+}
+
+static PerfResult summarize(const std::vector<double>& samples) {
+	PerfResult result;
+	result.median = median(samples);
+	std::vector<double> deviations;
+	for (double sample : samples) {
+		deviations.push_back(std::abs(sample - result.median));
+	}
+	result.mad = median(deviations);
+	result.samples = static_cast<uint32_t>(samples.size());
+	return result;
+}
+
+// host_device_driver with everything but letters and digits replaced, so it is a file name on every platform
+static std::string machineId(ComputeManager* manager) {
+	std::string host = "host";
+#ifdef __linux__
+	char name[256] = {};
+	if (gethostname(name, sizeof(name) - 1) == 0) {
+		host = name;
+	}
+#endif
+	std::string id = host + "_" + manager->profile.deviceName + "_" + std::to_string(manager->profile.driverVersion);
+	for (char& c : id) {
+		if (!isalnum(static_cast<unsigned char>(c))) {
+			c = '_';
+		}
+	}
+	return id;
+}
+
+// Lines of "case median mad samples"
+static std::map<std::string, PerfResult> loadBaselines(const std::string& path) {
+	std::map<std::string, PerfResult> baselines;
+	std::ifstream is(path);
+	std::string line;
+	while (std::getline(is, line)) {
+		std::istringstream fields(line);
+		std::string name;
+		PerfResult result;
+		if (line.empty() || line[0] == '#' || !(fields >> name >> result.median >> result.mad >> result.samples)) {
+			continue;
+		}
+		baselines[name] = result;
+	}
+	return baselines;
+}
+
+static bool saveBaselines(const std::string& path, const std::string& machine, const std::map<std::string, PerfResult>& baselines) {
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+	std::ofstream os(path, std::ios::trunc);
+	os << "# vkHPC performance baselines for " << machine << "\n";
+	os << "# case median mad samples\n";
+	for (auto& [name, result] : baselines) {
+		os << name << " " << result.median << " " << result.mad << " " << result.samples << "\n";
+	}
+	return os.good();
+}
+
+static uint32_t fibonacci(uint32_t n) {
+	if (n <= 1) {
+		return n;
+	}
+	uint32_t curr = 1;
+	uint32_t prev = 1;
+	for (uint32_t i = 2; i < n; ++i) {
+		uint32_t temp = curr;
+		curr += prev;
+		prev = temp;
+	}
+	return curr;
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start, double scale) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * scale;
+}
+
+int main(int argc, char* argv[]) {
+	CommandLineParser parser;
+	parser.add("help", { "--help" }, false, "Show help");
+	parser.add("case", { "--case" }, true, "Case to run, or all (default: all)");
+	parser.add("baselines", { "--baselines" }, true, "Baseline directory (default: perf/baselines)");
+	parser.add("update", { "--update-baseline" }, false, "Store the results as the baseline of this machine instead of comparing");
+	parser.add("tolerance", { "--tolerance" }, true, "Slowdown in percent that is never a regression (default: 10)");
+	parser.add("sigmas", { "--sigmas" }, true, "Robust standard deviations a slowdown has to exceed (default: 3)");
+	parser.add("report", { "--report" }, true, "Append the comparison to this file");
+	parser.parse(argc, argv);
+	if (parser.isSet("help")) {
+		parser.printHelp();
+		return 0;
+	}
+	const std::string caseName = parser.getValueAsString("case", "all");
+	const double tolerance = parser.getValueAsInt("tolerance", 10) / 100.0;
+	const double sigmas = parser.getValueAsInt("sigmas", 3);
+
+	ComputeManager *manager = new ComputeManager();
+	uint32_t localSize = 256;
+	VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &localSize);
+	ComputeKernel kernel;
+	manager->createKernel("stream.comp.spv", 1, &kernel, sizeof(uint32_t), &specializationInfo);
+
+	// Small job latency: upload, one dispatch and readback of 4096 elements
+	const uint32_t smallElements = 4096;
+	DeviceMemoryBlock smallHost, smallDevice;
+	smallHost.size = smallDevice.size = smallElements * sizeof(uint32_t);
+	manager->createBuffer(CPU_BUFFER, &smallHost);
+	manager->createBuffer(GPU_BUFFER, &smallDevice);
+	std::vector<uint32_t> smallInput(smallElements), smallOutput(smallElements);
+	for (uint32_t i = 0; i < smallElements; i++) {
+		smallInput[i] = i % 48;
+	}
+
+	// Large buffer streaming: 256 MiB to the device and back
+	const VkDeviceSize largeSize = 256ull << 20;
+	DeviceMemoryBlock largeHost, largeDevice;
+	largeHost.size = largeDevice.size = largeSize;
+	manager->createBuffer(CPU_BUFFER, &largeHost);
+	manager->createBuffer(GPU_BUFFER, &largeDevice);
+
+	// Multi-kernel graph: eight dependent stages over four 16 MiB buffers in one submission
+	const uint32_t graphElements = 4u << 20;
+	std::vector<DeviceMemoryBlock> graphBuffers(4);
+	for (DeviceMemoryBlock& block : graphBuffers) {
+		block.size = graphElements * sizeof(uint32_t);
+		manager->createBuffer(SHARED_BUFFER, &block);
+	}
+	std::vector<uint32_t> graphOutput(graphElements);
+
+	std::vector<PerfCase> cases = {
+		{ "small_job_latency", "us", 20, 200, [&](ComputeManager* manager, double* sample) {
+			auto start = std::chrono::steady_clock::now();
+			manager->blockMemoryCopy(&smallHost, smallInput.data(), MEMORY_USER_TO_BLOCK);
+			manager->stageMemorycpy(&smallHost, &smallDevice);
+			KernelChain chain(manager, 1, 1);
+			chain.dispatch(&kernel, { &smallDevice }, smallElements / localSize, 1, 1, &smallElements);
+			chain.run();
+			manager->stageMemorycpy(&smallDevice, &smallHost);
+			manager->blockMemoryCopy(&smallHost, smallOutput.data(), MEMORY_BLOCK_TO_USER);
+			*sample = elapsed(start, 1e6);
+			return smallOutput[47] == fibonacci(47) && smallOutput[100] == fibonacci(100 % 48);
+		} },
+		{ "large_buffer_streaming", "ms", 2, 10, [&](ComputeManager* manager, double* sample) {
+			auto start = std::chrono::steady_clock::now();
+			manager->stageMemorycpy(&largeHost, &largeDevice);
+			manager->stageMemorycpy(&largeDevice, &largeHost);
+			*sample = elapsed(start, 1e3);
+			return true;
+		} },
+		{ "kernel_graph", "ms", 3, 30, [&](ComputeManager* manager, double* sample) {
+			for (uint32_t i = 0; i < graphElements; i++) {
+				graphOutput[i] = i % 48;
+			}
+			for (DeviceMemoryBlock& block : graphBuffers) {
+				manager->blockMemoryCopy(&block, graphOutput.data(), MEMORY_USER_TO_BLOCK);
+			}
+			auto start = std::chrono::steady_clock::now();
+			KernelChain chain(manager, 8, 1);
+			for (uint32_t stage = 0; stage < 8; stage++) {
+				chain.dispatch(&kernel, { &graphBuffers[stage % graphBuffers.size()] }, graphElements / localSize, 1, 1, &graphElements);
+			}
+			chain.run();
+			*sample = elapsed(start, 1e3);
+			// Buffer 0 went through stages 0 and 4
+			manager->blockMemoryCopy(&graphBuffers[0], graphOutput.data(), MEMORY_BLOCK_TO_USER);
+			return graphOutput[3] == fibonacci(fibonacci(3)) && graphOutput[5] == fibonacci(fibonacci(5));
+		} },
+	};
+
+	const std::string machine = machineId(manager);
+	const std::string baselinePath = parser.getValueAsString("baselines", "perf/baselines") + "/" + machine + ".txt";
+	std::map<std::string, PerfResult> baselines = loadBaselines(baselinePath);
+	std::ostringstream report;
+	report << "machine " << machine << "\n";
+	report << "case \t\t\tbaseline \tcurrent \tdelta \tstatus\n";
+	int status = 0;
+	bool ran = false;
+	for (PerfCase& perfCase : cases) {
+		if (caseName != "all" && caseName != perfCase.name) {
+			continue;
+		}
+		ran = true;
+		std::vector<double> samples;
+		bool correct = true;
+		for (uint32_t i = 0; i < perfCase.warmup + perfCase.samples; i++) {
+			double sample;
+			correct = perfCase.run(manager, &sample) && correct;
+			if (i >= perfCase.warmup) {
+				samples.push_back(sample);
+			}
+		}
+		PerfResult current = summarize(samples);
+		char line[256];
+		if (!correct) {
+			snprintf(line, sizeof(line), "%-24s\t- \t\t%.2f %s \t- \tWRONG RESULTS\n", perfCase.name, current.median, perfCase.unit);
+			status = 1;
+		}
+		else if (parser.isSet("update")) {
+			baselines[perfCase.name] = current;
+			snprintf(line, sizeof(line), "%-24s\t- \t\t%.2f %s \t- \tstored\n", perfCase.name, current.median, perfCase.unit);
+		}
+		else if (baselines.count(perfCase.name) == 0) {
+			snprintf(line, sizeof(line), "%-24s\t- \t\t%.2f %s \t- \tno baseline\n", perfCase.name, current.median, perfCase.unit);
+			status = status == 0 ? PERF_SKIPPED : status;
+		}
+		else {
+			const PerfResult& baseline = baselines[perfCase.name];
+			// 1.4826 * MAD estimates the standard deviation of normally distributed samples
+			double sigma = 1.4826 * std::max(baseline.mad, current.mad);
+			double slowdown = current.median - baseline.median;
+			bool regressed = slowdown > tolerance * baseline.median && slowdown > sigmas * sigma;
+			snprintf(line, sizeof(line), "%-24s\t%.2f %s \t%.2f %s \t%+.1f%% \t%s\n", perfCase.name, baseline.median, perfCase.unit,
+				current.median, perfCase.unit, 100.0 * slowdown / baseline.median, regressed ? "REGRESSION" : "ok");
+			if (regressed) {
+				status = 1;
+			}
+		}
+		report << line;
+	}
+	if (!ran) {
+		std::cerr << "Unknown case " << caseName << "\n";
+		status = 1;
+	}
+	if (parser.isSet("update") && status == 0 && ran) {
+		if (!saveBaselines(baselinePath, machine, baselines)) {
+			std::cerr << "Could not write " << baselinePath << "\n";
+			status = 1;
+		}
+	}
+	if (status == PERF_SKIPPED) {
+		report << "no baseline in " << baselinePath << ", store one with --update-baseline\n";
+	}
+	std::cout << report.str();
+	if (parser.isSet("report")) {
+		std::ofstream(parser.getValueAsString("report", ""), std::ios::app) << report.str();
+	}
+
+	for (DeviceMemoryBlock& block : graphBuffers) {
+		manager->clean(&block);
+	}
+	manager->clean(&largeDevice);
+	manager->clean(&largeHost);
+	manager->clean(&smallDevice);
+	manager->clean(&smallHost);
+	manager->destroyKernel(&kernel);
+	delete(manager);
+	return status;
+}
@@ -0,0 +1,623 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+	Build step (see CMakeLists.txt): embeds SPIR-V modules into EmbeddedShaders.hpp as constexpr arrays together with the
+	bindings, push constant block and specialization constants reflected from each module, and writes typed launchers
+	for them into ShaderLaunchers.hpp. Runs on the build host, so it reads SPIR-V directly instead of linking a reflection library.
+	usage: embedShaders <output directory> <module.spv>...
+*/
+
+enum SpirvOp{
+	OP_NAME = 5,
+	OP_MEMBER_NAME = 6,
+	OP_TYPE_BOOL = 20,
+	OP_TYPE_INT = 21,
+	OP_TYPE_FLOAT = 22,
+	OP_TYPE_VECTOR = 23,
+	OP_TYPE_IMAGE = 25,
+	OP_TYPE_SAMPLER = 26,
+	OP_TYPE_SAMPLED_IMAGE = 27,
+	OP_TYPE_ARRAY = 28,
+	OP_TYPE_RUNTIME_ARRAY = 29,
+	OP_TYPE_STRUCT = 30,
+	OP_TYPE_POINTER = 32,
+	OP_CONSTANT = 43,
+	OP_SPEC_CONSTANT_TRUE = 48,
+	OP_SPEC_CONSTANT_FALSE = 49,
+	OP_SPEC_CONSTANT = 50,
+	OP_SPEC_CONSTANT_COMPOSITE = 51,
+	OP_VARIABLE = 59,
+	OP_DECORATE = 71,
+	OP_MEMBER_DECORATE = 72
+};
+
+enum SpirvDecoration{
+	DECORATION_SPEC_ID = 1,
+	DECORATION_BUFFER_BLOCK = 3,
+	DECORATION_ARRAY_STRIDE = 6,
+	DECORATION_BUILT_IN = 11,
+	DECORATION_BINDING = 33,
+	DECORATION_DESCRIPTOR_SET = 34,
+	DECORATION_OFFSET = 35
+};
+
+enum SpirvStorageClass{
+	STORAGE_UNIFORM_CONSTANT = 0,
+	STORAGE_UNIFORM = 2,
+	STORAGE_PUSH_CONSTANT = 9,
+	STORAGE_STORAGE_BUFFER = 12
+};
+
+#define SPIRV_MAGIC 0x07230203
+#define BUILT_IN_WORKGROUP_SIZE 25
+#define IMAGE_DIM_BUFFER 5
+
+struct SpirvInstruction
+{
+	uint32_t opcode;
+	std::vector<uint32_t> operands;
+};
+
+struct Binding
+{
+	uint32_t binding;
+	std::string name;
+	std::string type;
+	// 0 for runtime sized arrays
+	uint32_t descriptorCount;
+};
+
+struct PushConstantMember
+{
+	std::string name;
+	// C++ declaration with %s in place of the name
+	std::string declaration;
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct SpecializationConstant
+{
+	uint32_t specId;
+	std::string name;
+	std::string type;
+	std::string defaultValue;
+	uint32_t size;
+};
+
+struct Reflection
+{
+	std::string fileName;
+	std::string identifier;
+	std::vector<uint32_t> words;
+	std::vector<Binding> bindings;
+	std::vector<PushConstantMember> pushConstants;
+	std::vector<SpecializationConstant> specializationConstants;
+};
+
+static std::string literalString(const std::vector<uint32_t>& operands, size_t first){
+	std::string text;
+	for (size_t i = first; i < operands.size(); i++) {
+		for (int b = 0; b < 4; b++) {
+			char c = static_cast<char>((operands[i] >> (8 * b)) & 0xff);
+			if (c == 0) {
+				return text;
+			}
+			text += c;
+		}
+	}
+	return text;
+}
+
+// Values -> values, MAX_RADIUS -> maxRadius, invalid characters dropped
+static std::string camelCase(const std::string& name){
+	bool upperCase = std::none_of(name.begin(), name.end(), [](char c) { return islower(static_cast<unsigned char>(c)); });
+	std::string result;
+	bool nextUpper = false;
+	for (char c : name) {
+		if (c == '_' || !isalnum(static_cast<unsigned char>(c))) {
+			nextUpper = !result.empty();
+			continue;
+		}
+		if (result.empty()) {
+			result += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		}
+		else if (nextUpper) {
+			result += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+		}
+		else {
+			result += upperCase ? static_cast<char>(tolower(static_cast<unsigned char>(c))) : c;
+		}
+		nextUpper = false;
+	}
+	if (!result.empty() && isdigit(static_cast<unsigned char>(result[0]))) {
+		result = "_" + result;
+	}
+	return result;
+}
+
+class SpirvModule
+{
+	std::vector<SpirvInstruction> instructions;
+	std::map<uint32_t, std::string> names;
+	std::map<std::pair<uint32_t, uint32_t>, std::string> memberNames;
+	std::map<uint32_t, std::map<uint32_t, std::vector<uint32_t>>> decorations;
+	std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, std::vector<uint32_t>>> memberDecorations;
+	std::map<uint32_t, SpirvInstruction> definitions;
+
+	bool decorated(uint32_t id, uint32_t decoration) const {
+		auto it = decorations.find(id);
+		return it != decorations.end() && it->second.count(decoration) != 0;
+	}
+
+	uint32_t decoration(uint32_t id, uint32_t decoration) const {
+		return decorations.at(id).at(decoration).at(0);
+	}
+
+	const SpirvInstruction& definition(uint32_t id) const {
+		auto it = definitions.find(id);
+		if (it == definitions.end()) {
+			throw std::runtime_error("undefined id " + std::to_string(id));
+		}
+		return it->second;
+	}
+
+	uint32_t constantValue(uint32_t id) const {
+		const SpirvInstruction& constant = definition(id);
+		if (constant.opcode != OP_CONSTANT) {
+			throw std::runtime_error("array length is not a constant");
+		}
+		return constant.operands[2];
+	}
+
+	std::string name(uint32_t id) const {
+		auto it = names.find(id);
+		return it != names.end() ? it->second : "";
+	}
+
+	// C++ scalar type of an int, float or bool type, empty for anything else
+	std::string scalarType(uint32_t typeId) const {
+		const SpirvInstruction& type = definition(typeId);
+		switch (type.opcode) {
+		case OP_TYPE_BOOL:
+			return "VkBool32";
+		case OP_TYPE_INT:
+			return std::string(type.operands[2] ? "int" : "uint") + std::to_string(type.operands[1]) + "_t";
+		case OP_TYPE_FLOAT:
+			// Half floats are passed as their bits
+			return type.operands[1] == 64 ? "double" : type.operands[1] == 32 ? "float" : "uint16_t";
+		}
+		return "";
+	}
+
+	uint32_t typeSize(uint32_t typeId) const {
+		const SpirvInstruction& type = definition(typeId);
+		switch (type.opcode) {
+		case OP_TYPE_BOOL:
+			return 4;
+		case OP_TYPE_INT:
+		case OP_TYPE_FLOAT:
+			return type.operands[1] / 8;
+		case OP_TYPE_VECTOR:
+			return type.operands[2] * typeSize(type.operands[1]);
+		case OP_TYPE_ARRAY:
+			return constantValue(type.operands[2]) * (decorated(typeId, DECORATION_ARRAY_STRIDE) ? decoration(typeId, DECORATION_ARRAY_STRIDE) : typeSize(type.operands[1]));
+		case OP_TYPE_STRUCT: {
+			uint32_t size = 0;
+			for (uint32_t member = 0; member + 1 < type.operands.size(); member++) {
+				uint32_t offset = memberDecorations.at({ typeId, member }).at(DECORATION_OFFSET).at(0);
+				size = std::max(size, offset + typeSize(type.operands[member + 1]));
+			}
+			return size;
+		}
+		}
+		return 0;
+	}
+
+	// Scalars, vectors and tightly packed arrays of them map to C++ types, anything else becomes bytes
+	std::string declaration(uint32_t typeId) const {
+		const SpirvInstruction& type = definition(typeId);
+		std::string scalar = scalarType(typeId);
+		if (!scalar.empty()) {
+			return scalar + " %s";
+		}
+		if (type.opcode == OP_TYPE_VECTOR) {
+			return scalarType(type.operands[1]) + " %s[" + std::to_string(type.operands[2]) + "]";
+		}
+		if (type.opcode == OP_TYPE_ARRAY) {
+			uint32_t elementType = type.operands[1];
+			std::string element = scalarType(elementType);
+			uint32_t stride = decorated(typeId, DECORATION_ARRAY_STRIDE) ? decoration(typeId, DECORATION_ARRAY_STRIDE) : typeSize(elementType);
+			if (!element.empty() && stride == typeSize(elementType)) {
+				return element + " %s[" + std::to_string(constantValue(type.operands[2])) + "]";
+			}
+		}
+		return "uint8_t %s[" + std::to_string(typeSize(typeId)) + "]";
+	}
+
+	std::string descriptorType(uint32_t storageClass, uint32_t typeId) const {
+		const SpirvInstruction& type = definition(typeId);
+		switch (storageClass) {
+		case STORAGE_STORAGE_BUFFER:
+			return "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER";
+		case STORAGE_UNIFORM:
+			return decorated(typeId, DECORATION_BUFFER_BLOCK) ? "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER" : "VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER";
+		case STORAGE_UNIFORM_CONSTANT:
+			if (type.opcode == OP_TYPE_IMAGE) {
+				bool texelBuffer = type.operands[2] == IMAGE_DIM_BUFFER;
+				if (type.operands[6] == 2) {
+					return texelBuffer ? "VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER" : "VK_DESCRIPTOR_TYPE_STORAGE_IMAGE";
+				}
+				return texelBuffer ? "VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER" : "VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE";
+			}
+			if (type.opcode == OP_TYPE_SAMPLER) {
+				return "VK_DESCRIPTOR_TYPE_SAMPLER";
+			}
+			if (type.opcode == OP_TYPE_SAMPLED_IMAGE) {
+				return "VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER";
+			}
+		}
+		throw std::runtime_error("unsupported resource type");
+	}
+
+	static std::string floatLiteral(uint32_t bits){
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		if (!std::isfinite(value)) {
+			char text[64];
+			snprintf(text, sizeof(text), "std::bit_cast<float>(0x%08xu)", bits);
+			return text;
+		}
+		char text[64];
+		snprintf(text, sizeof(text), "%.9g", value);
+		std::string literal = text;
+		if (literal.find_first_of(".e") == std::string::npos) {
+			literal += ".0";
+		}
+		return literal + "f";
+	}
+
+public:
+	SpirvModule(const std::vector<uint32_t>& words){
+		if (words.size() < 5 || words[0] != SPIRV_MAGIC) {
+			throw std::runtime_error("not a SPIR-V module");
+		}
+		for (size_t i = 5; i < words.size();) {
+			uint32_t wordCount = words[i] >> 16;
+			if (wordCount == 0 || i + wordCount > words.size()) {
+				throw std::runtime_error("truncated instruction");
+			}
+			SpirvInstruction instruction = { words[i] & 0xffff, std::vector<uint32_t>(words.begin() + i + 1, words.begin() + i + wordCount) };
+			i += wordCount;
+			const std::vector<uint32_t>& operands = instruction.operands;
+			switch (instruction.opcode) {
+			case OP_NAME:
+				names[operands[0]] = literalString(operands, 1);
+				break;
+			case OP_MEMBER_NAME:
+				memberNames[{ operands[0], operands[1] }] = literalString(operands, 2);
+				break;
+			case OP_DECORATE:
+				decorations[operands[0]][operands[1]] = std::vector<uint32_t>(operands.begin() + 2, operands.end());
+				break;
+			case OP_MEMBER_DECORATE:
+				memberDecorations[{ operands[0], operands[1] }][operands[2]] = std::vector<uint32_t>(operands.begin() + 3, operands.end());
+				break;
+			case OP_TYPE_BOOL: case OP_TYPE_INT: case OP_TYPE_FLOAT: case OP_TYPE_VECTOR: case OP_TYPE_IMAGE: case OP_TYPE_SAMPLER:
+			case OP_TYPE_SAMPLED_IMAGE: case OP_TYPE_ARRAY: case OP_TYPE_RUNTIME_ARRAY: case OP_TYPE_STRUCT: case OP_TYPE_POINTER:
+				definitions[operands[0]] = instruction;
+				break;
+			case OP_CONSTANT: case OP_SPEC_CONSTANT_TRUE: case OP_SPEC_CONSTANT_FALSE: case OP_SPEC_CONSTANT: case OP_SPEC_CONSTANT_COMPOSITE: case OP_VARIABLE:
+				definitions[operands[1]] = instruction;
+				instructions.push_back(instruction);
+				break;
+			}
+		}
+	}
+
+	void reflect(Reflection* reflection) const {
+		// The spec constants gl_WorkGroupSize is built from
+		std::map<uint32_t, std::string> localSizeNames;
+		for (const SpirvInstruction& instruction : instructions) {
+			if (instruction.opcode == OP_SPEC_CONSTANT_COMPOSITE && decorated(instruction.operands[1], DECORATION_BUILT_IN)
+				&& decoration(instruction.operands[1], DECORATION_BUILT_IN) == BUILT_IN_WORKGROUP_SIZE) {
+				const char* axes[3] = { "localSizeX", "localSizeY", "localSizeZ" };
+				for (uint32_t axis = 0; axis < 3 && axis + 2 < instruction.operands.size(); axis++) {
+					localSizeNames[instruction.operands[axis + 2]] = axes[axis];
+				}
+			}
+		}
+
+		for (const SpirvInstruction& instruction : instructions) {
+			const std::vector<uint32_t>& operands = instruction.operands;
+			uint32_t id = operands[1];
+			if ((instruction.opcode == OP_SPEC_CONSTANT || instruction.opcode == OP_SPEC_CONSTANT_TRUE || instruction.opcode == OP_SPEC_CONSTANT_FALSE)
+				&& decorated(id, DECORATION_SPEC_ID)) {
+				SpecializationConstant constant;
+				constant.specId = decoration(id, DECORATION_SPEC_ID);
+				constant.name = localSizeNames.count(id) ? localSizeNames.at(id) : camelCase(name(id));
+				if (constant.name.empty()) {
+					constant.name = "specId" + std::to_string(constant.specId);
+				}
+				constant.type = scalarType(operands[0]);
+				constant.size = typeSize(operands[0]);
+				if (instruction.opcode != OP_SPEC_CONSTANT) {
+					constant.defaultValue = instruction.opcode == OP_SPEC_CONSTANT_TRUE ? "VK_TRUE" : "VK_FALSE";
+				}
+				else if (constant.type == "float") {
+					constant.defaultValue = floatLiteral(operands[2]);
+				}
+				else if (constant.type == "double" || constant.size == 8) {
+					uint64_t bits = operands[2] | (uint64_t)operands[3] << 32;
+					constant.defaultValue = constant.type == "double" ? "std::bit_cast<double>(" + std::to_string(bits) + "ull)"
+						: constant.type == "int64_t" ? std::to_string((int64_t)bits) + "ll" : std::to_string(bits) + "ull";
+				}
+				else {
+					constant.defaultValue = constant.type[0] == 'i' ? std::to_string((int32_t)operands[2]) : std::to_string(operands[2]) + "u";
+				}
+				reflection->specializationConstants.push_back(constant);
+			}
+			if (instruction.opcode != OP_VARIABLE) {
+				continue;
+			}
+			uint32_t storageClass = operands[2];
+			const SpirvInstruction& pointer = definition(operands[0]);
+			uint32_t typeId = pointer.operands[2];
+			if (storageClass == STORAGE_PUSH_CONSTANT) {
+				const SpirvInstruction& block = definition(typeId);
+				for (uint32_t member = 0; member + 1 < block.operands.size(); member++) {
+					PushConstantMember pushConstant;
+					auto memberName = memberNames.find({ typeId, member });
+					pushConstant.name = camelCase(memberName != memberNames.end() ? memberName->second : "");
+					if (pushConstant.name.empty()) {
+						pushConstant.name = "member" + std::to_string(member);
+					}
+					pushConstant.offset = memberDecorations.at({ typeId, member }).at(DECORATION_OFFSET).at(0);
+					pushConstant.size = typeSize(block.operands[member + 1]);
+					pushConstant.declaration = declaration(block.operands[member + 1]);
+					reflection->pushConstants.push_back(pushConstant);
+				}
+				std::sort(reflection->pushConstants.begin(), reflection->pushConstants.end(),
+					[](const PushConstantMember& a, const PushConstantMember& b) { return a.offset < b.offset; });
+			}
+			else if (storageClass == STORAGE_STORAGE_BUFFER || storageClass == STORAGE_UNIFORM || storageClass == STORAGE_UNIFORM_CONSTANT) {
+				if (!decorated(id, DECORATION_BINDING)) {
+					continue;
+				}
+				if (decorated(id, DECORATION_DESCRIPTOR_SET) && decoration(id, DECORATION_DESCRIPTOR_SET) != 0) {
+					throw std::runtime_error("kernels have a single descriptor set, " + name(id) + " is in set " + std::to_string(decoration(id, DECORATION_DESCRIPTOR_SET)));
+				}
+				Binding binding;
+				binding.binding = decoration(id, DECORATION_BINDING);
+				binding.descriptorCount = 1;
+				const SpirvInstruction& type = definition(typeId);
+				if (type.opcode == OP_TYPE_ARRAY || type.opcode == OP_TYPE_RUNTIME_ARRAY) {
+					binding.descriptorCount = type.opcode == OP_TYPE_ARRAY ? constantValue(type.operands[2]) : 0;
+					typeId = type.operands[1];
+				}
+				binding.type = descriptorType(storageClass, typeId);
+				// Anonymous blocks are named after their block type
+				binding.name = camelCase(name(id).empty() ? name(typeId) : name(id));
+				reflection->bindings.push_back(binding);
+			}
+		}
+
+		std::sort(reflection->bindings.begin(), reflection->bindings.end(), [](const Binding& a, const Binding& b) { return a.binding < b.binding; });
+		for (uint32_t i = 0; i < reflection->bindings.size(); i++) {
+			Binding& binding = reflection->bindings[i];
+			if (binding.binding != i) {
+				throw std::runtime_error("bindings have to be numbered 0..n-1, binding " + std::to_string(i) + " is missing");
+			}
+			bool taken = binding.name.empty();
+			for (uint32_t j = 0; j < i; j++) {
+				taken = taken || reflection->bindings[j].name == binding.name;
+			}
+			if (taken) {
+				binding.name += "Binding" + std::to_string(i);
+			}
+		}
+		std::sort(reflection->specializationConstants.begin(), reflection->specializationConstants.end(),
+			[](const SpecializationConstant& a, const SpecializationConstant& b) { return a.specId < b.specId; });
+	}
+};
+
+static std::string format(const std::string& declaration, const std::string& name){
+	std::string text = declaration;
+	text.replace(text.find("%s"), 2, name);
+	return text;
+}
+
+static void writeEmbedded(std::ostream& os, const Reflection& shader){
+	os << "// " << shader.fileName << "\nnamespace shaders::" << shader.identifier << "\n{\n";
+	os << "inline constexpr uint32_t spirv[] = {";
+	for (size_t i = 0; i < shader.words.size(); i++) {
+		char word[16];
+		snprintf(word, sizeof(word), "0x%08x,", shader.words[i]);
+		os << (i % 8 == 0 ? "\n\t" : " ") << word;
+	}
+	os << "\n};\n";
+	os << "inline constexpr const char* fileName = \"" << shader.fileName << "\";\n";
+
+	os << "inline constexpr uint32_t bindingCount = " << shader.bindings.size() << ";\n";
+	os << "inline constexpr std::array<VkDescriptorType, " << shader.bindings.size() << "> bindingTypes = {";
+	for (size_t i = 0; i < shader.bindings.size(); i++) {
+		os << (i ? ", " : " ") << shader.bindings[i].type;
+	}
+	os << " };\n";
+	os << "// Descriptors per binding, 0 for runtime sized arrays\n";
+	os << "inline constexpr std::array<uint32_t, " << shader.bindings.size() << "> descriptorCounts = {";
+	for (size_t i = 0; i < shader.bindings.size(); i++) {
+		os << (i ? ", " : " ") << shader.bindings[i].descriptorCount;
+	}
+	os << " };\n";
+
+	if (!shader.pushConstants.empty()) {
+		os << "struct PushConstants\n{\n";
+		uint32_t end = 0;
+		for (const PushConstantMember& member : shader.pushConstants) {
+			if (member.offset > end) {
+				os << "\tuint8_t padding" << end << "[" << member.offset - end << "];\n";
+			}
+			os << "\t" << format(member.declaration, member.name) << ";\n";
+			end = std::max(end, member.offset + member.size);
+		}
+		os << "};\n";
+		for (const PushConstantMember& member : shader.pushConstants) {
+			os << "static_assert(offsetof(PushConstants, " << member.name << ") == " << member.offset << ");\n";
+		}
+		os << "static_assert(sizeof(PushConstants) == " << end << ");\n";
+		os << "inline constexpr uint32_t pushConstantSize = sizeof(PushConstants);\n";
+	}
+	else {
+		os << "inline constexpr uint32_t pushConstantSize = 0;\n";
+	}
+
+	os << "// Defaults from the module\nstruct Specialization\n{\n";
+	for (const SpecializationConstant& constant : shader.specializationConstants) {
+		os << "\t" << constant.type << " " << constant.name << " = " << constant.defaultValue << ";\n";
+	}
+	os << "};\n";
+	os << "inline constexpr std::array<VkSpecializationMapEntry, " << shader.specializationConstants.size() << "> specializationMapEntries = {";
+	for (size_t i = 0; i < shader.specializationConstants.size(); i++) {
+		const SpecializationConstant& constant = shader.specializationConstants[i];
+		os << (i ? "," : "") << "\n\tVkSpecializationMapEntry{ " << constant.specId << ", offsetof(Specialization, " << constant.name << "), " << constant.size << " }";
+	}
+	os << (shader.specializationConstants.empty() ? "" : "\n") << "};\n";
+	os << "}\n\n";
+}
+
+static void writeLauncher(std::ostream& os, const Reflection& shader){
+	bool arrays = false;
+	bool runtimeArrays = false;
+	bool buffersOnly = true;
+	for (const Binding& binding : shader.bindings) {
+		arrays = arrays || binding.descriptorCount != 1;
+		runtimeArrays = runtimeArrays || binding.descriptorCount == 0;
+		buffersOnly = buffersOnly && binding.type == "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER";
+	}
+	os << "namespace shaders::" << shader.identifier << "\n{\n";
+	// KernelChain binds storage buffers only, kernels with images get createKernel alone
+	if (buffersOnly) {
+		os << "struct Bindings\n{\n";
+		for (const Binding& binding : shader.bindings) {
+			os << "\tDeviceMemoryBlock* " << binding.name << ";\n";
+		}
+		os << "};\n\n";
+	}
+
+	os << "inline VkResult createKernel(ComputeManager* manager, ComputeKernel* kernel, ";
+	if (arrays) {
+		// Runtime sized arrays are sized when the kernel is built, e.g. with the segment count of a SegmentedBuffer
+		os << "const std::array<uint32_t, " << shader.bindings.size() << ">& counts" << (runtimeArrays ? "" : " = descriptorCounts") << ", ";
+	}
+	os << "const Specialization& specialization = {}){\n";
+	if (runtimeArrays) {
+		os << "\tassert(std::none_of(counts.begin(), counts.end(), [](uint32_t count) { return count == 0; }));\n";
+	}
+	os << "\tVkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(" << shader.specializationConstants.size()
+		<< ", specializationMapEntries.data(), sizeof(Specialization), &specialization);\n";
+	os << "\treturn manager->createKernel(fileName, std::vector<VkDescriptorType>(bindingTypes.begin(), bindingTypes.end()), kernel, pushConstantSize, "
+		<< (shader.specializationConstants.empty() ? "nullptr" : "&specializationInfo") << ", 0, 0"
+		<< (arrays ? ", std::vector<uint32_t>(counts.begin(), counts.end())" : "") << ");\n";
+	os << "}\n";
+
+	if (buffersOnly) {
+		std::string bindingList;
+		for (size_t i = 0; i < shader.bindings.size(); i++) {
+			bindingList += (i ? ", bindings." : "bindings.") + shader.bindings[i].name;
+		}
+		std::string pushParameter = shader.pushConstants.empty() ? "" : "const PushConstants& pushConstants, ";
+		std::string pushArgument = shader.pushConstants.empty() ? "nullptr" : "&pushConstants";
+		os << "\ninline KernelChain& dispatch(KernelChain& chain, ComputeKernel* kernel, const Bindings& bindings, " << pushParameter
+			<< "uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1){\n";
+		os << "\treturn chain.dispatch(kernel, { " << bindingList << " }, groupCountX, groupCountY, groupCountZ, " << pushArgument << ");\n}\n";
+		os << "\ninline KernelChain& dispatchIndirect(KernelChain& chain, ComputeKernel* kernel, const Bindings& bindings, " << pushParameter
+			<< "DeviceMemoryBlock* argumentBlock, VkDeviceSize indirectOffset = 0){\n";
+		os << "\treturn chain.dispatchIndirect(kernel, { " << bindingList << " }, argumentBlock, indirectOffset, " << pushArgument << ");\n}\n";
+	}
+	os << "}\n\n";
+}
+
+static bool writeFile(const std::filesystem::path& path, const std::string& text){
+	std::ofstream os(path, std::ios::binary | std::ios::trunc);
+	os << text;
+	return os.good();
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: embedShaders <output directory> <module.spv>...\n";
+		return 1;
+	}
+	std::filesystem::path outputDirectory = argv[1];
+	std::vector<Reflection> shaders;
+	for (int i = 2; i < argc; i++) {
+		std::filesystem::path path = argv[i];
+		Reflection shader;
+		shader.fileName = path.filename().string();
+		// stream.comp.spv -> stream
+		shader.identifier = shader.fileName.substr(0, shader.fileName.find('.'));
+		for (char& c : shader.identifier) {
+			c = isalnum(static_cast<unsigned char>(c)) ? c : '_';
+		}
+		std::ifstream is(path, std::ios::binary | std::ios::ate);
+		size_t size = is.is_open() ? static_cast<size_t>(is.tellg()) : 0;
+		if (size == 0 || size % 4 != 0) {
+			std::cerr << "Error: " << path << " is not a SPIR-V module\n";
+			return 1;
+		}
+		shader.words.resize(size / 4);
+		is.seekg(0, std::ios::beg);
+		is.read(reinterpret_cast<char*>(shader.words.data()), size);
+		try {
+			SpirvModule(shader.words).reflect(&shader);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Error: " << path << ": " << e.what() << "\n";
+			return 1;
+		}
+		shaders.push_back(shader);
+	}
+	std::sort(shaders.begin(), shaders.end(), [](const Reflection& a, const Reflection& b) { return a.fileName < b.fileName; });
+
+	std::ostringstream embedded;
+	embedded << "// Generated by tools/embedShaders.cpp, do not edit\n#pragma once\n\n#include <array>\n#include <bit>\n#include <cstddef>\n#include <cstdint>\n#include <cstring>\n\n#include <vulkan/vulkan.h>\n\n";
+	for (const Reflection& shader : shaders) {
+		writeEmbedded(embedded, shader);
+	}
+	embedded << "struct EmbeddedShader\n{\n\tconst char* fileName;\n\tconst uint32_t* code;\n\tsize_t size;\n};\n\n";
+	embedded << "inline constexpr EmbeddedShader embeddedShaders[] = {\n";
+	for (const Reflection& shader : shaders) {
+		embedded << "\t{ shaders::" << shader.identifier << "::fileName, shaders::" << shader.identifier << "::spirv, sizeof(shaders::" << shader.identifier << "::spirv) },\n";
+	}
+	embedded << "\t{ nullptr, nullptr, 0 }\n};\n\n";
+	embedded << "// Module of a SPIR-V file name as passed to ComputeManager::createKernel, nullptr if it was not embedded at build time\n";
+	embedded << "inline const EmbeddedShader* findEmbeddedShader(const char* fileName){\n";
+	embedded << "\tfor (const EmbeddedShader* shader = embeddedShaders; shader->fileName; shader++) {\n";
+	embedded << "\t\tif (strcmp(shader->fileName, fileName) == 0) {\n\t\t\treturn shader;\n\t\t}\n\t}\n\treturn nullptr;\n}\n";
+
+	std::ostringstream launchers;
+	launchers << "// Generated by tools/embedShaders.cpp, do not edit\n#pragma once\n\n#include \"EmbeddedShaders.hpp\"\n#include <KernelChain.hpp>\n\n";
+	for (const Reflection& shader : shaders) {
+		writeLauncher(launchers, shader);
+	}
+
+	std::filesystem::create_directories(outputDirectory);
+	if (!writeFile(outputDirectory / "EmbeddedShaders.hpp", embedded.str()) || !writeFile(outputDirectory / "ShaderLaunchers.hpp", launchers.str())) {
+		std::cerr << "Error: Could not write to " << outputDirectory << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,11 @@
+# Records the default job of main into a trace and replays it with traceReplay --check, which fails when any
+# dispatch, copy or run of the trace could not be replayed.
+# usage: cmake -DMAIN=<main> -DTRACE_REPLAY=<traceReplay> -DTRACE=<trace file> -P traceRoundtrip.cmake
+execute_process(COMMAND ${MAIN} --trace ${TRACE} RESULT_VARIABLE RECORD_RESULT)
+if(NOT RECORD_RESULT EQUAL 0)
+    message(FATAL_ERROR "main --trace failed: ${RECORD_RESULT}")
+endif()
+execute_process(COMMAND ${TRACE_REPLAY} --trace ${TRACE} --mode fast --check RESULT_VARIABLE REPLAY_RESULT)
+if(NOT REPLAY_RESULT EQUAL 0)
+    message(FATAL_ERROR "traceReplay --check failed: ${REPLAY_RESULT}")
+endif()